@@ -0,0 +1,140 @@
+#include "audio_sink.h"
+
+#include "file_utils.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+namespace rideau {
+
+bool NullAudioSink::open(Playback *p) {
+  ENSURE(p != nullptr);
+  playback = p;
+  return true;
+}
+
+void NullAudioSink::close() { playback = nullptr; }
+
+usize NullAudioSink::pump(usize frameCount) {
+  ENSURE(playback != nullptr);
+
+  float *mix[2] = {mixBuffer[0], mixBuffer[1]};
+  usize done = 0;
+  while (done < frameCount) {
+    const u32 n = std::min(frameCount - done, (usize)MIX_CHUNK_FRAMES);
+    renderPlayback(playback, mix, n);
+    done += n;
+  }
+  return done;
+}
+
+static const u32 WAV_HEADER_SIZE = 44;
+
+static void writeWavHeader(FILE *f, u32 sampleRate, usize framesCount) {
+  const u32 channels = 2;
+  const u32 bytesPerSample = sizeof(float);
+  const u32 dataSize = framesCount * channels * bytesPerSample;
+
+  u8 header[WAV_HEADER_SIZE];
+  u8 *h = header;
+  memcpy(h, "RIFF", 4);
+  h += 4;
+  writeu32le(&h, 36 + dataSize);
+  memcpy(h, "WAVEfmt ", 8);
+  h += 8;
+  writeu32le(&h, 16);
+  writeu32le(&h, (channels << 16) | 3); // IEEE float
+  writeu32le(&h, sampleRate);
+  writeu32le(&h, sampleRate * channels * bytesPerSample);
+  writeu32le(&h, ((bytesPerSample * 8) << 16) | (channels * bytesPerSample));
+  memcpy(h, "data", 4);
+  h += 4;
+  writeu32le(&h, dataSize);
+  ASSERT(h - header == WAV_HEADER_SIZE);
+
+  int ret = fseek(f, 0, SEEK_SET);
+  ENSURE(ret == 0);
+  size_t writeSize = fwrite(header, sizeof(u8), ARRAY_SIZE(header), f);
+  ENSURE(writeSize == ARRAY_SIZE(header));
+}
+
+bool WavAudioSink::open(Playback *p) {
+  ENSURE(p != nullptr);
+  ENSURE(filename != nullptr);
+
+  file = fopen(filename, "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "unable to open %s for writing\n", filename);
+    return false;
+  }
+
+  playback = p;
+  framesWritten = 0;
+  // Sizes are patched on close
+  writeWavHeader(file, playback->sampleRate, 0);
+  return true;
+}
+
+void WavAudioSink::close() {
+  if (file == nullptr)
+    return;
+
+  writeWavHeader(file, playback->sampleRate, framesWritten);
+
+  int ret = fclose(file);
+  ENSURE(ret == 0);
+  file = nullptr;
+  playback = nullptr;
+}
+
+usize WavAudioSink::pump(usize frameCount) {
+  ENSURE(file != nullptr);
+
+  float *mix[2] = {mixBuffer[0], mixBuffer[1]};
+  usize done = 0;
+  while (done < frameCount) {
+    const u32 n = std::min(frameCount - done, (usize)MIX_CHUNK_FRAMES);
+    renderPlayback(playback, mix, n);
+
+    u8 *w = fileBuffer;
+    for (u32 i = 0; i < n; ++i) {
+      for (int c = 0; c < 2; ++c) {
+        u32 x;
+        memcpy(&x, &mix[c][i], sizeof(x));
+        writeu32le(&w, x);
+      }
+    }
+
+    const usize size = w - fileBuffer;
+    size_t writeSize = fwrite(fileBuffer, sizeof(u8), size, file);
+    ENSURE(writeSize == size);
+
+    done += n;
+  }
+
+  framesWritten += done;
+  return done;
+}
+
+usize renderOffline(Playback &playback, AudioSink &sink) {
+  ENSURE(!sink.isRealtime());
+  ENSURE(playback.speed > 0.0f);
+
+  // Once through: a loop region would wrap forever
+  playback.isLooping = false;
+  playback.currentFrame = 0;
+  playback.isPlaying = true;
+
+  // Stop at the end of the song, framesCount frames at 1x
+  const usize length =
+      (usize)ceil((double)playback.framesCount / playback.speed);
+  const usize maxPump = 64 * MIX_CHUNK_FRAMES;
+  usize rendered = 0;
+  while (playback.isPlaying && rendered < length)
+    rendered += sink.pump(std::min(length - rendered, maxPump));
+
+  return rendered;
+}
+
+} // namespace rideau
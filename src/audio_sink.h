@@ -0,0 +1,64 @@
+#ifndef AUDIO_SINK_H
+#define AUDIO_SINK_H
+
+#include "playback.h"
+#include "utils.h"
+
+#include <stdio.h>
+
+namespace rideau {
+
+// Where the playback goes.  Real-time sinks pull frames from the playback on
+// their own audio thread; offline sinks are driven by the caller through pump,
+// as fast as the pipeline can go.
+struct AudioSink {
+  Playback *playback = nullptr;
+
+  virtual ~AudioSink() {}
+
+  virtual bool open(Playback *p) = 0;
+  virtual void close() = 0;
+
+  virtual bool isRealtime() const { return false; }
+  virtual float latency() const { return 0.0f; }
+
+  // Offline sinks: render frameCount frames.  Returns the number of frames
+  // rendered.
+  virtual usize pump(usize frameCount) {
+    UNUSED(frameCount);
+    return 0;
+  }
+};
+
+// Renders and discards the frames
+struct NullAudioSink : AudioSink {
+  float mixBuffer[2][MIX_CHUNK_FRAMES];
+
+  bool open(Playback *p) override;
+  void close() override;
+  usize pump(usize frameCount) override;
+};
+
+// Writes the frames to a 32-bit float stereo WAV file
+struct WavAudioSink : AudioSink {
+  const char *filename = nullptr;
+  FILE *file = nullptr;
+  usize framesWritten = 0;
+
+  float mixBuffer[2][MIX_CHUNK_FRAMES];
+  u8 fileBuffer[MIX_CHUNK_FRAMES * 2 * sizeof(float)];
+
+  explicit WavAudioSink(const char *wavFilename) : filename(wavFilename) {}
+
+  bool open(Playback *p) override;
+  void close() override;
+  usize pump(usize frameCount) override;
+};
+
+// Play the whole song once from the start through an offline sink, at the
+// playback speed and without looping.  Returns the number of frames rendered.
+usize renderOffline(Playback &playback, AudioSink &sink);
+
+} // namespace rideau
+
+#endif
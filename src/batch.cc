@@ -0,0 +1,238 @@
+#include "batch.h"
+
+#include "lz11.h"
+#include "simulator.h"
+#include "track.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utility>
+
+namespace rideau {
+
+static bool isTriggerFilename(const char *name) {
+  const char prefix[] = "trigger";
+  const char suffix[] = ".bytes.lz";
+  const usize length = strlen(name);
+  return length >= strlen(prefix) + strlen(suffix) &&
+         strncmp(name, prefix, strlen(prefix)) == 0 &&
+         strcmp(name + length - strlen(suffix), suffix) == 0;
+}
+
+static void findInDirectory(const std::string &dir,
+                            std::vector<std::string> *files) {
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) {
+    fprintf(stderr, "Cannot open %s\n", dir.c_str());
+    return;
+  }
+
+  while (dirent *entry = readdir(d)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    const std::string path = dir + "/" + entry->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode))
+      findInDirectory(path, files);
+    else if (isTriggerFilename(entry->d_name))
+      files->push_back(path);
+  }
+  closedir(d);
+}
+
+std::vector<std::string>
+findTriggerFiles(const std::vector<std::string> &paths) {
+  std::vector<std::string> files;
+  for (const std::string &path : paths) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      findInDirectory(path, &files);
+    else
+      files.push_back(path);
+  }
+  std::sort(files.begin(), files.end());
+  files.erase(std::unique(files.begin(), files.end()), files.end());
+  return files;
+}
+
+// Where the transformed file goes
+static std::string getOutputPath(const std::string &input,
+                                 const char *outDir) {
+  if (outDir == nullptr)
+    return input;
+
+  const usize nameAt = input.rfind('/');
+  const std::string name = input.substr(nameAt + 1); // npos + 1 is 0
+  const std::string dir =
+      nameAt == std::string::npos ? "" : input.substr(0, nameAt);
+  const std::string folder = dir.substr(dir.rfind('/') + 1);
+
+  std::string path = outDir;
+  if (!folder.empty() && folder != "." && folder != "..")
+    path += "/" + folder;
+  return path + "/" + name;
+}
+
+// Create outDir and the folder of output under it
+static bool createOutputFolders(const std::string &output, const char *outDir,
+                                std::string *error) {
+  if (outDir == nullptr)
+    return true;
+
+  // Other jobs may be creating the same folders
+  const std::string folder = output.substr(0, output.rfind('/'));
+  for (const std::string &path : {std::string(outDir), folder}) {
+    if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+      *error = "cannot create " + path;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Run one file through the pipeline.  Returns an empty string on success, or
+// why it failed.
+static std::string transformTrackFile(
+    const std::string &input, const std::vector<TrackTransform> &transforms,
+    const char *outDir) {
+  // Decompress and parse, whatever the file holds
+  u32 rawSize;
+  u8 *raw = readLZ11File(input.c_str(), &rawSize);
+  if (raw == nullptr)
+    return "cannot read, or not an LZ11 file";
+
+  Track track;
+  const bool isParsed = tryParseTrack(raw, rawSize, &track);
+  free(raw);
+  if (!isParsed)
+    return "not a trigger file";
+
+  Simulation before;
+  simulateTrack(track, &before);
+
+  // Transform
+  for (const TrackTransform &transform : transforms) {
+    const char *error = applyTrackTransform(transform, track);
+    if (error != nullptr)
+      return error;
+  }
+  sortTrack(track);
+
+  // Validate
+  u32 index;
+  if (const char *error = findTrackError(track, &index)) {
+    if (index == track.triggers.size())
+      return error;
+    char where[64];
+    snprintf(where, sizeof(where), "trigger %u at tick %u: ", index,
+             track.triggers[index].tick);
+    return where + std::string(error);
+  }
+
+  // Don't make a playable chart any less so
+  Simulation after;
+  simulateTrack(track, &after);
+  if (after.issues.size() > before.issues.size()) {
+    // Transforms move triggers around, so issues are told apart by reason:
+    // the first issue whose reason came up fewer times before is a new one
+    std::vector<std::pair<const char *, u32>> reasonCounts;
+    const auto countOf = [&](const char *reason) -> u32 & {
+      for (auto &count : reasonCounts)
+        if (strcmp(count.first, reason) == 0)
+          return count.second;
+      reasonCounts.emplace_back(reason, 0);
+      return reasonCounts.back().second;
+    };
+    for (const SimulationIssue &issue : before.issues)
+      ++countOf(issue.reason);
+    const SimulationIssue *newIssue = nullptr;
+    for (const SimulationIssue &issue : after.issues) {
+      u32 &count = countOf(issue.reason);
+      if (count == 0) {
+        newIssue = &issue;
+        break;
+      }
+      --count;
+    }
+    ENSURE(newIssue != nullptr);
+
+    const SimulationIssue &issue = *newIssue;
+    char where[128];
+    snprintf(where, sizeof(where),
+             "%zu playability issues, up from %zu; trigger %u at tick %u: ",
+             after.issues.size(), before.issues.size(), issue.triggerIndex,
+             track.triggers[issue.triggerIndex].tick);
+    return where + std::string(issue.reason);
+  }
+
+  // Compress, next to the output, then move it over
+  std::string error;
+  const std::string output = getOutputPath(input, outDir);
+  if (!createOutputFolders(output, outDir, &error))
+    return error;
+  const std::string temporary = output + ".tmp";
+
+  FILE *dst = fopen(temporary.c_str(), "wb");
+  if (dst == nullptr)
+    return "cannot write " + temporary;
+
+  const u32 outSize = getTrackRawSize(track);
+  u8 *out = (u8 *)malloc(outSize);
+  ENSURE(out != nullptr);
+  writeTrack(track, out, outSize);
+  compressLZ11(out, outSize, dst);
+  free(out);
+
+  if (fclose(dst) != 0 || rename(temporary.c_str(), output.c_str()) != 0) {
+    remove(temporary.c_str());
+    return "cannot write " + output;
+  }
+  return "";
+}
+
+u32 transformTrackFiles(const std::vector<std::string> &files,
+                        const std::vector<TrackTransform> &transforms,
+                        const char *outDir, ThreadPool *pool) {
+  ENSURE(pool != nullptr);
+
+  // Inputs from folders of the same name would race for the same output
+  std::vector<std::pair<std::string, usize>> outputs;
+  for (usize i = 0; i < files.size(); ++i)
+    outputs.emplace_back(getOutputPath(files[i], outDir), i);
+  std::sort(outputs.begin(), outputs.end());
+  bool isClashing = false;
+  for (usize i = 1; i < outputs.size(); ++i) {
+    if (outputs[i].first != outputs[i - 1].first)
+      continue;
+    fprintf(stderr, "%s: same output as %s, %s\n",
+            files[outputs[i].second].c_str(),
+            files[outputs[i - 1].second].c_str(), outputs[i].first.c_str());
+    isClashing = true;
+  }
+  if (isClashing)
+    return files.size();
+
+  std::vector<std::string> errors(files.size());
+  pool->parallelFor(files.size(), [&](usize i) {
+    errors[i] = transformTrackFile(files[i], transforms, outDir);
+  });
+
+  u32 failedCount = 0;
+  for (usize i = 0; i < files.size(); ++i) {
+    if (errors[i].empty())
+      continue;
+    fprintf(stderr, "%s: %s\n", files[i].c_str(), errors[i].c_str());
+    ++failedCount;
+  }
+  return failedCount;
+}
+
+} // namespace rideau
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "thread_pool.h"
+#include "track_transform.h"
+#include "utils.h"
+
+#include <string>
+#include <vector>
+
+namespace rideau {
+
+// Trigger files named by paths.  Directories are searched recursively for
+// triggerNNN.bytes.lz files; other paths are kept as they are.  Sorted, so
+// that reports come out in the same order on every run.
+std::vector<std::string>
+findTriggerFiles(const std::vector<std::string> &paths);
+
+// Stream each file through decompress, transforms in order, validate and
+// compress, one file per job on pool.  Outputs go to
+// outDir/FOLDER/triggerNNN.bytes.lz, FOLDER being the one of the input as in
+// the game's music folder, or replace the input if outDir is nullptr.  Files
+// are replaced atomically, and left alone if they fail to validate, or if
+// auto-play finds more issues after the transforms than before.  Reports
+// failures on stderr and returns how many files failed.  If two files would
+// go to the same output, nothing is transformed and all of them fail.
+u32 transformTrackFiles(const std::vector<std::string> &files,
+                        const std::vector<TrackTransform> &transforms,
+                        const char *outDir, ThreadPool *pool);
+
+} // namespace rideau
+
+#endif
@@ -0,0 +1,203 @@
+#include "bcstm.h"
+
+#include "file_utils.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace rideau {
+
+static const u16 INFO_BLOCK_TYPE = 0x4000;
+static const u16 SEEK_BLOCK_TYPE = 0x4001;
+static const u16 DATA_BLOCK_TYPE = 0x4002;
+static const u8 DSP_ADPCM_ENCODING = 2;
+
+static u32 get32(const u8 *p) { return readu32le(&p); }
+static u16 get16(const u8 *p) { return readu16le(&p); }
+
+static bool inFile(const u8 *raw, usize rawSize, const u8 *p, usize size) {
+  return p >= raw && (usize)(p - raw) <= rawSize &&
+         size <= rawSize - (usize)(p - raw);
+}
+
+bool parseBCSTM(const u8 *raw, usize rawSize, BcstmStream *stream) {
+  ENSURE(raw != nullptr);
+  ENSURE(stream != nullptr);
+
+  if (rawSize < 0x40 || memcmp(raw, "CSTM", 4) != 0 || get16(raw + 4) != 0xFEFF)
+    return false;
+
+  const u8 *info = nullptr;
+  const u8 *seek = nullptr;
+  usize seekSize = 0;
+  const u8 *data = nullptr;
+  const u16 blocksRefCount = get16(raw + 0x10);
+  for (u16 i = 0; i < blocksRefCount; ++i) {
+    const u8 *ref = raw + 0x14 + i * 12;
+    if (!inFile(raw, rawSize, ref, 12))
+      return false;
+    const u8 *block = raw + get32(ref + 4);
+    const u32 size = get32(ref + 8);
+    if (!inFile(raw, rawSize, block, size) || size < 8)
+      return false;
+
+    switch (get16(ref)) {
+    case INFO_BLOCK_TYPE:
+      info = block;
+      break;
+    case SEEK_BLOCK_TYPE:
+      seek = block;
+      seekSize = size;
+      break;
+    case DATA_BLOCK_TYPE:
+      data = block;
+      break;
+    }
+  }
+  if (info == nullptr || data == nullptr || memcmp(info, "INFO", 4) != 0)
+    return false;
+
+  // Offsets in the INFO header are relative to its body
+  const u8 *infoBody = info + 8;
+  const u8 *streamInfo = infoBody + get32(infoBody + 4);
+  const u8 *channelTable = infoBody + get32(infoBody + 0x14);
+  if (!inFile(raw, rawSize, streamInfo, 0x38) ||
+      !inFile(raw, rawSize, channelTable, 4))
+    return false;
+
+  if (streamInfo[0] != DSP_ADPCM_ENCODING)
+    return false;
+  stream->channelsCount = streamInfo[2];
+  stream->sampleRate = get32(streamInfo + 0x04);
+  stream->samplesCount = get32(streamInfo + 0x0C);
+  stream->blocksCount = get32(streamInfo + 0x10);
+  stream->blockSize = get32(streamInfo + 0x14);
+  stream->blockSamples = get32(streamInfo + 0x18);
+  stream->lastBlockSamples = get32(streamInfo + 0x20);
+  stream->lastBlockPaddedSize = get32(streamInfo + 0x24);
+  stream->data = data + 8 + get32(streamInfo + 0x34);
+
+  const u32 channels = stream->channelsCount;
+  if (channels == 0 || channels > BcstmStream::MAX_CHANNELS ||
+      stream->blocksCount == 0 || stream->sampleRate == 0)
+    return false;
+  const u64 blocksSamples =
+      (u64)(stream->blocksCount - 1) * stream->blockSamples +
+      stream->lastBlockSamples;
+  if (blocksSamples < stream->samplesCount)
+    return false;
+  const u64 dataSize =
+      (u64)(stream->blocksCount - 1) * stream->blockSize * channels +
+      (u64)stream->lastBlockPaddedSize * channels;
+  if (!inFile(raw, rawSize, stream->data, dataSize))
+    return false;
+
+  if (get32(channelTable) < channels ||
+      !inFile(raw, rawSize, channelTable, 4 + channels * 8))
+    return false;
+  for (u32 c = 0; c < channels; ++c) {
+    const u8 *channelInfo = channelTable + get32(channelTable + 4 + c * 8 + 4);
+    if (!inFile(raw, rawSize, channelInfo, 8))
+      return false;
+    const u8 *adpcmInfo = channelInfo + get32(channelInfo + 4);
+    if (!inFile(raw, rawSize, adpcmInfo, 0x26))
+      return false;
+
+    for (int i = 0; i < 16; ++i)
+      stream->coefs[c][i] = get16(adpcmInfo + i * 2);
+    stream->history[c][0] = get16(adpcmInfo + 0x22);
+    stream->history[c][1] = get16(adpcmInfo + 0x24);
+  }
+
+  // Without per-block history, blocks of a channel decode in sequence
+  const usize seekEntriesSize = (usize)stream->blocksCount * channels * 4;
+  stream->seek = (seek != nullptr && memcmp(seek, "SEEK", 4) == 0 &&
+                  seekEntriesSize <= seekSize - 8)
+                     ? seek + 8
+                     : nullptr;
+
+  return true;
+}
+
+// Decode samplesCount samples of 8-byte frames: a predictor/scale byte, then
+// 14 signed nibbles
+static void decodeBlock(const u8 *src, u32 samplesCount, const s16 coefs[16],
+                        s16 yn1, s16 yn2, s16 *dst) {
+  u32 i = 0;
+  while (i < samplesCount) {
+    const u8 ps = *src++;
+    const s32 scale = 1 << (ps & 0xF);
+    const s32 coef1 = coefs[((ps >> 4) & 7) * 2];
+    const s32 coef2 = coefs[((ps >> 4) & 7) * 2 + 1];
+
+    for (u32 j = 0; j < 14 && i < samplesCount; ++j, ++i) {
+      s32 nibble = (j & 1) ? (src[j / 2] & 0xF) : (src[j / 2] >> 4);
+      if (nibble >= 8)
+        nibble -= 16;
+
+      s32 sample = nibble * scale * 2048 + 1024 + coef1 * yn1 + coef2 * yn2;
+      sample = std::clamp(sample >> 11, -32768, 32767);
+
+      yn2 = yn1;
+      yn1 = sample;
+      *dst++ = sample;
+    }
+    src += 7;
+  }
+}
+
+void decodeBCSTM(const BcstmStream &stream, ThreadPool *pool, s16 *const *pcm) {
+  ENSURE(pool != nullptr);
+  ENSURE(pcm != nullptr);
+
+  const u32 channels = stream.channelsCount;
+  const u32 lastBlock = stream.blocksCount - 1;
+
+  auto decodeChannelBlock = [&](u32 b, u32 c, s16 yn1, s16 yn2) {
+    const usize firstSample = (usize)b * stream.blockSamples;
+    if (firstSample >= stream.samplesCount)
+      return;
+
+    const u32 blockSize =
+        b == lastBlock ? stream.lastBlockPaddedSize : stream.blockSize;
+    const u8 *src = stream.data + (usize)b * stream.blockSize * channels +
+                    (usize)c * blockSize;
+    u32 samplesCount =
+        b == lastBlock ? stream.lastBlockSamples : stream.blockSamples;
+    samplesCount = std::min<usize>(samplesCount,
+                                   stream.samplesCount - firstSample);
+
+    decodeBlock(src, samplesCount, stream.coefs[c], yn1, yn2,
+                pcm[c] + firstSample);
+  };
+
+  if (stream.seek != nullptr) {
+    pool->parallelFor((usize)stream.blocksCount * channels, [&](usize i) {
+      const u32 b = i / channels;
+      const u32 c = i % channels;
+      s16 yn1 = stream.history[c][0];
+      s16 yn2 = stream.history[c][1];
+      if (b > 0) {
+        const u8 *entry = stream.seek + i * 4;
+        yn1 = get16(entry);
+        yn2 = get16(entry + 2);
+      }
+      decodeChannelBlock(b, c, yn1, yn2);
+    });
+  } else {
+    pool->parallelFor(channels, [&](usize c) {
+      for (u32 b = 0; b < stream.blocksCount; ++b) {
+        const usize firstSample = (usize)b * stream.blockSamples;
+        s16 yn1 = stream.history[c][0];
+        s16 yn2 = stream.history[c][1];
+        if (b > 0 && firstSample >= 2 && firstSample <= stream.samplesCount) {
+          yn1 = pcm[c][firstSample - 1];
+          yn2 = pcm[c][firstSample - 2];
+        }
+        decodeChannelBlock(b, c, yn1, yn2);
+      }
+    });
+  }
+}
+
+} // namespace rideau
@@ -0,0 +1,46 @@
+#ifndef BCSTM_H
+#define BCSTM_H
+
+#include "thread_pool.h"
+#include "utils.h"
+
+namespace rideau {
+
+// DSP-ADPCM stream of a BCSTM file.  Samples are split into blocks of
+// blockSamples per channel, stored interleaved by channel in the DATA block:
+//
+//    Block 0: ch0 | ch1 | ... Block 1: ch0 | ch1 | ...
+//
+// The SEEK block holds the decoder history at the start of each block, so
+// every (block, channel) pair decodes on its own.
+struct BcstmStream {
+  static const u32 MAX_CHANNELS = 16;
+
+  u32 channelsCount;
+  u32 sampleRate;
+  u32 samplesCount;
+
+  u32 blocksCount;
+  u32 blockSize; // bytes per channel
+  u32 blockSamples;
+  u32 lastBlockPaddedSize;
+  u32 lastBlockSamples;
+
+  s16 coefs[MAX_CHANNELS][16];
+  s16 history[MAX_CHANNELS][2]; // yn1, yn2 at the start of the stream
+
+  const u8 *data;
+  const u8 *seek; // yn1, yn2 per channel per block, or nullptr
+};
+
+// Returns false when raw isn't a little-endian DSP-ADPCM BCSTM; stream points
+// into raw
+bool parseBCSTM(const u8 *raw, usize rawSize, BcstmStream *stream);
+
+// Decode channel c to pcm[c], samplesCount samples each, spreading blocks
+// across pool
+void decodeBCSTM(const BcstmStream &stream, ThreadPool *pool, s16 *const *pcm);
+
+} // namespace rideau
+
+#endif
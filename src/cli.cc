@@ -0,0 +1,343 @@
+#include "audio_sink.h"
+#include "batch.h"
+#include "packed_track.h"
+#include "pattern_index.h"
+#include "playback.h"
+#include "simulator.h"
+#include "song.h"
+#include "thread_pool.h"
+#include "track.h"
+#include "track_file.h"
+#include "track_transform.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "utils.h"
+
+// Headless tools: everything rideau does that needs no window nor sound device
+
+namespace rideau {
+
+// Render song and hitsounds of track offline, as fast as possible.  Without
+// wavFile, the frames are discarded.
+static bool renderTrack(const Track &track, Song &song, const char *wavFile) {
+  Playback playback;
+  playback.init(song.samples, song.framesCount, song.sampleRate);
+
+  Track fixed = track;
+  fixTickCount(fixed, playback.framesCount, playback.sampleRate);
+  playback.hitsounds.buildSchedule(fixed, playback.framesCount);
+  playback.hitsounds.enabled = true;
+  playback.hitsounds.publish();
+
+  NullAudioSink nullSink;
+  WavAudioSink wavSink(wavFile);
+  AudioSink &sink = wavFile ? (AudioSink &)wavSink : nullSink;
+  if (!sink.open(&playback)) {
+    playback.deinit();
+    return false;
+  }
+
+  auto renderStart = std::chrono::steady_clock::now();
+  const usize frames = renderOffline(playback, sink);
+  sink.close();
+  std::chrono::duration<float> renderSec =
+      std::chrono::steady_clock::now() - renderStart;
+
+  const float audioSec = (float)frames / playback.sampleRate;
+  printf("Rendered %.1fs of audio in %.3fs (%.0fx real time)\n", audioSec,
+         renderSec.count(), audioSec / renderSec.count());
+  playback.deinit();
+  return true;
+}
+
+} // namespace rideau
+
+int main(int argc, char *argv[]) {
+  using namespace rideau;
+
+  int opt;
+  bool renderMode = false;
+  const char *renderFile = nullptr;
+  const char *verifyFile = nullptr;
+  std::vector<TrackTransform> transforms;
+  const char *outDir = nullptr;
+  const char *indexFile = nullptr;
+  const char *query = nullptr;
+  bool simulateMode = false;
+
+  const char *const usage =
+      "Usage: %s PATH...\n"
+      "       %s -n|-o WAV_FILE TRIGGER_FILE MUSIC_FILE\n"
+      "       %s -V MUSIC_FILE\n"
+      "       %s -t TRANSFORM [-t TRANSFORM]... [-d OUT_DIR] PATH...\n"
+      "       %s -I INDEX_FILE PATH...\n"
+      "       %s -q QUERY INDEX_FILE\n"
+      "       %s -s PATH...\n"
+      "\n"
+      "Transforms apply in order to every trigger file under PATH:\n"
+      "  shift=TICKS  move triggers and zones by TICKS\n"
+      "  scale=TICKS  stretch the track to TICKS ticks\n"
+      "  mirror       flip BMS lanes or FMS positions\n"
+      "  ends=plain   drop the arrows of hold ends\n"
+      "  ends=slide   add arrows to hold ends\n"
+      "\n"
+      "Queries are triggers in a row, or ... for up to 16 others before the\n"
+      "next type, e.g.:\n"
+      "  slide:angle=90|270 slide:angle=90|270 slide:angle=90|270\n"
+      "  hold:lane=A ... end|endslide:lane!=A\n"
+      "  touch touch:dt<=8 touch:dt<=8 touch:dt<=8\n"
+      "Types: touch slide hold holdlet end endslide, or * for any.\n"
+      "Constraints: lane=N|N..., lane=X or lane!=X for a lane variable X,\n"
+      "angle=DEG|DEG..., dt=TICKS since the previous trigger (or <=, >=).\n";
+
+  while ((opt = getopt(argc, argv, "no:V:t:d:I:q:s")) != -1) {
+    switch (opt) {
+    case 't': {
+      TrackTransform transform;
+      if (!parseTrackTransform(optarg, &transform)) {
+        fprintf(stderr, "Unknown transform: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      transforms.push_back(transform);
+      break;
+    }
+    case 'd':
+      outDir = optarg;
+      break;
+    case 'n':
+      renderMode = true;
+      break;
+    case 'o':
+      renderMode = true;
+      renderFile = optarg;
+      break;
+    case 'V':
+      verifyFile = optarg;
+      break;
+    case 'I':
+      indexFile = optarg;
+      break;
+    case 'q':
+      query = optarg;
+      break;
+    case 's':
+      simulateMode = true;
+      break;
+    default:
+      fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0], argv[0],
+              argv[0], argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  ThreadPool threadPool;
+  threadPool.init();
+
+  if (verifyFile != nullptr) {
+    bool ok = verifySongDecoder(verifyFile, &threadPool);
+    threadPool.deinit();
+    return ok ? 0 : 1;
+  }
+
+  if (indexFile != nullptr) {
+    if (argc - optind < 1) {
+      fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0], argv[0],
+              argv[0], argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+    const std::vector<std::string> files =
+        findTriggerFiles(std::vector<std::string>(argv + optind, argv + argc));
+
+    auto start = std::chrono::steady_clock::now();
+    PatternIndex index;
+    buildPatternIndex(files, &threadPool, &index);
+    const bool ok = writePatternIndex(index, indexFile);
+    std::chrono::duration<float> sec =
+        std::chrono::steady_clock::now() - start;
+
+    printf("Indexed %zu tracks, %zu triggers, %zu trigrams in %.3fs\n",
+           index.tracks.size(), index.tokens.size(), index.trigrams.size(),
+           sec.count());
+    threadPool.deinit();
+    return ok && index.tracks.size() == files.size() ? 0 : 1;
+  }
+
+  if (query != nullptr) {
+    threadPool.deinit();
+    if (argc - optind != 1) {
+      fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0], argv[0],
+              argv[0], argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+    PatternQuery pattern;
+    std::string error;
+    if (!parsePatternQuery(query, &pattern, &error)) {
+      fprintf(stderr, "Invalid query: %s\n", error.c_str());
+      return 1;
+    }
+
+    PatternIndex index;
+    if (!readPatternIndex(argv[optind], &index))
+      return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<PatternMatch> matches;
+    findPattern(index, pattern, &matches);
+    std::chrono::duration<float, std::milli> ms =
+        std::chrono::steady_clock::now() - start;
+
+    for (const PatternMatch &m : matches)
+      printf("%s: tick %u, %.0fms\n", index.tracks[m.track].filename.c_str(),
+             m.tick, m.tick * 1000 / TICKS_PER_SECOND);
+    printf("%zu matches in %.2fms\n", matches.size(), ms.count());
+    return 0;
+  }
+
+  if (!transforms.empty() || outDir != nullptr) {
+    if (transforms.empty() || argc - optind < 1) {
+      fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0], argv[0],
+              argv[0], argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+    const std::vector<std::string> files =
+        findTriggerFiles(std::vector<std::string>(argv + optind, argv + argc));
+
+    auto start = std::chrono::steady_clock::now();
+    const u32 failedCount =
+        transformTrackFiles(files, transforms, outDir, &threadPool);
+    std::chrono::duration<float> sec =
+        std::chrono::steady_clock::now() - start;
+
+    printf("Transformed %zu files in %.3fs, %u failed\n",
+           files.size() - failedCount, sec.count(), failedCount);
+    threadPool.deinit();
+    return failedCount == 0 ? 0 : 1;
+  }
+
+  if (renderMode) {
+    if (argc - optind != 2) {
+      fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0], argv[0],
+              argv[0], argv[0]);
+      exit(EXIT_FAILURE);
+    }
+
+    Track track;
+    parseTrackFile(argv[optind], &track);
+    checkTrack(track);
+
+    Song song;
+    bool ok = loadSong(argv[optind + 1], &threadPool, &song);
+    ENSURE(ok);
+
+    ok = renderTrack(track, song, renderFile);
+    freeSong(&song);
+    threadPool.deinit();
+    return ok ? 0 : 1;
+  }
+
+  if (argc - optind < 1) {
+    fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0], argv[0],
+              argv[0], argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Print stats of each trigger file.  A lone triggerNNN file brings the
+  // other difficulties of its folder along; folders bring all the trigger
+  // files under them.
+  std::vector<std::string> triggerFiles;
+  struct stat st;
+  if (argc - optind == 1 && !simulateMode &&
+      !(stat(argv[optind], &st) == 0 && S_ISDIR(st.st_mode)))
+    triggerFiles = findDifficultyFiles(argv[optind]);
+  else
+    triggerFiles =
+        findTriggerFiles(std::vector<std::string>(argv + optind, argv + argc));
+
+  // Packed and on all cores, so that whole game dumps load in a blink
+  std::vector<PackedTrack> tracks(triggerFiles.size());
+  std::vector<u8> loaded(triggerFiles.size());
+  threadPool.parallelFor(triggerFiles.size(), [&](usize i) {
+    loaded[i] = parsePackedTrackFile(triggerFiles[i].c_str(), &tracks[i]);
+  });
+
+  // Auto-play every track, timed on its own to compare with real time
+  std::vector<Simulation> simulations(simulateMode ? triggerFiles.size() : 0);
+  auto simulateStart = std::chrono::steady_clock::now();
+  threadPool.parallelFor(simulations.size(), [&](usize i) {
+    if (loaded[i])
+      simulateTrack(tracks[i], &simulations[i]);
+  });
+  std::chrono::duration<float> simulateSec =
+      std::chrono::steady_clock::now() - simulateStart;
+
+  u32 failedCount = 0;
+  usize triggersCount = 0;
+  float playSec = 0;
+  for (usize i = 0; i < triggerFiles.size(); ++i) {
+    const char *const filename = triggerFiles[i].c_str();
+    if (!loaded[i]) {
+      fprintf(stderr, "%s: cannot read trigger file\n", filename);
+      ++failedCount;
+      continue;
+    }
+
+    const PackedTrack &track = tracks[i];
+    if (triggerFiles.size() > 1 && !simulateMode)
+      printf("%s\n", filename);
+    if (!simulateMode)
+      printTrackStats(track);
+    triggersCount += track.triggerCount;
+    playSec += track.tickCount / TICKS_PER_SECOND;
+
+    u32 index;
+    if (const char *error = findTrackError(track, &index)) {
+      if (index < track.triggerCount)
+        fprintf(stderr, "%s: trigger %u at tick %u: %s\n", filename, index,
+                track.triggers[index].tick, error);
+      else
+        fprintf(stderr, "%s: %s\n", filename, error);
+      ++failedCount;
+    } else if (simulateMode) {
+      const Simulation &s = simulations[i];
+      if (triggerFiles.size() == 1) {
+        for (const ScoreEvent &e : s.timeline)
+          printf("tick %u, %.0fms: %s %s, combo %u, score %u\n", e.tick,
+                 e.hitTick * 1000 / TICKS_PER_SECOND,
+                 TRIGGER_TYPE_NAMES[track.triggers[e.triggerIndex].type],
+                 JUDGEMENT_NAMES[(u32)e.judgement], e.combo, e.score);
+      }
+      printf("%s: score %u/%u, max combo %u, %zu issues\n", filename,
+             s.score, s.maxScore, s.maxCombo, s.issues.size());
+      for (const SimulationIssue &issue : s.issues)
+        fprintf(stderr, "%s: trigger %u at tick %u: %s\n", filename,
+                issue.triggerIndex, track.triggers[issue.triggerIndex].tick,
+                issue.reason);
+      if (!s.issues.empty())
+        ++failedCount;
+    }
+  }
+
+  if (simulateMode)
+    printf("Played %zu tracks, %.0f minutes, in %.3fms (%.0fx real time), "
+           "%u failed\n",
+           triggerFiles.size(), playSec / 60, simulateSec.count() * 1000,
+           playSec / simulateSec.count(), failedCount);
+  else if (triggerFiles.size() > 1)
+    printf("%zu tracks, %zu triggers, %zu KiB of packed triggers, "
+           "%u invalid\n",
+           triggerFiles.size(), triggersCount,
+           triggersCount * sizeof(PackedTrigger) / 1024, failedCount);
+
+  threadPool.deinit();
+  return failedCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include "fft.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+namespace rideau {
+
+void FFT::init(u32 fftSize) {
+  ENSURE(fftSize >= 4 && (fftSize & (fftSize - 1)) == 0);
+
+  size = fftSize;
+  log2Size = 0;
+  while ((1u << log2Size) < size)
+    ++log2Size;
+
+  cosTable = (float *)malloc(size / 2 * sizeof(float));
+  sinTable = (float *)malloc(size / 2 * sizeof(float));
+  bitReverse = (u32 *)malloc(size * sizeof(u32));
+  hannWindow = (float *)malloc(size * sizeof(float));
+  ENSURE(cosTable != nullptr && sinTable != nullptr);
+  ENSURE(bitReverse != nullptr && hannWindow != nullptr);
+
+  for (u32 i = 0; i < size / 2; ++i) {
+    const double a = -2.0 * M_PI * i / size;
+    cosTable[i] = cos(a);
+    sinTable[i] = sin(a);
+  }
+
+  for (u32 i = 0; i < size; ++i) {
+    u32 r = 0;
+    for (u32 b = 0; b < log2Size; ++b)
+      r |= ((i >> b) & 1) << (log2Size - 1 - b);
+    bitReverse[i] = r;
+  }
+
+  for (u32 i = 0; i < size; ++i)
+    hannWindow[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / size);
+}
+
+void FFT::deinit() {
+  free(cosTable);
+  free(sinTable);
+  free(bitReverse);
+  free(hannWindow);
+}
+
+void FFT::forward(float *re, float *im) const {
+  for (u32 i = 0; i < size; ++i) {
+    const u32 j = bitReverse[i];
+    if (j > i) {
+      float t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+
+  for (u32 half = 1; half < size; half *= 2) {
+    const u32 twiddleStride = size / (half * 2);
+    for (u32 start = 0; start < size; start += half * 2) {
+      for (u32 k = 0; k < half; ++k) {
+        const float wr = cosTable[k * twiddleStride];
+        const float wi = sinTable[k * twiddleStride];
+        const u32 a = start + k;
+        const u32 b = a + half;
+        const float tr = re[b] * wr - im[b] * wi;
+        const float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+void FFT::magnitudes2(const float *frame0, const float *frame1, float *mag0,
+                      float *mag1, float *re, float *im) const {
+  // Pack both real frames into one complex FFT: Z = X + iY, then
+  // X[k] = (Z[k] + conj(Z[N-k])) / 2 and Y[k] = (Z[k] - conj(Z[N-k])) / 2i
+  for (u32 i = 0; i < size; ++i) {
+    re[i] = frame0[i] * hannWindow[i];
+    im[i] = frame1[i] * hannWindow[i];
+  }
+
+  forward(re, im);
+
+  for (u32 k = 0; k <= size / 2; ++k) {
+    const u32 n = (size - k) & (size - 1);
+    const float xr = (re[k] + re[n]) * 0.5f;
+    const float xi = (im[k] - im[n]) * 0.5f;
+    const float yr = (im[k] + im[n]) * 0.5f;
+    const float yi = (re[n] - re[k]) * 0.5f;
+    mag0[k] = sqrtf(xr * xr + xi * xi);
+    mag1[k] = sqrtf(yr * yr + yi * yi);
+  }
+}
+
+} // namespace rideau
@@ -0,0 +1,33 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include "utils.h"
+
+namespace rideau {
+
+// Radix-2 complex FFT of a fixed power-of-two size, with precomputed twiddles
+// and bit reversal.  Read-only after init, so one FFT can be shared by threads
+// as long as each brings its own buffers.
+struct FFT {
+  u32 size;
+  u32 log2Size;
+  float *cosTable; // size / 2 twiddles
+  float *sinTable;
+  u32 *bitReverse;
+  float *hannWindow;
+
+  void init(u32 fftSize);
+  void deinit();
+
+  // In place, unnormalized
+  void forward(float *re, float *im) const;
+
+  // Magnitudes of bins [0, size / 2] of two real frames at once, Hann windowed.
+  // re and im are scratch buffers of size floats.
+  void magnitudes2(const float *frame0, const float *frame1, float *mag0,
+                   float *mag1, float *re, float *im) const;
+};
+
+} // namespace rideau
+
+#endif
@@ -1,5 +1,7 @@
 #include "file_utils.h"
 
+#include <stdlib.h>
+
 namespace rideau {
 
 u32 readu32le(FILE *f) {
@@ -95,4 +97,33 @@ bool atFileEnd(FILE *f) {
     return false;
 }
 
+u8 *readFileContents(const char *filename, usize *size) {
+  ENSURE(filename != nullptr);
+  ENSURE(size != nullptr);
+
+  FILE *f = fopen(filename, "rb");
+  if (f == nullptr)
+    return nullptr;
+
+  fseek(f, 0, SEEK_END);
+  long fileSize = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (fileSize < 0) {
+    fclose(f);
+    return nullptr;
+  }
+
+  u8 *data = (u8 *)malloc(fileSize > 0 ? fileSize : 1);
+  ENSURE(data != nullptr);
+  size_t readSize = fread(data, sizeof(u8), fileSize, f);
+  fclose(f);
+  if (readSize != (size_t)fileSize) {
+    free(data);
+    return nullptr;
+  }
+
+  *size = fileSize;
+  return data;
+}
+
 }
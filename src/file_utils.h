@@ -19,6 +19,9 @@ void writeu8(FILE *f, u8 x);
 u8 readu8(FILE *f);
 bool atFileEnd(FILE *f);
 
+// Read a whole file into a malloc'd buffer; returns nullptr on failure
+u8 *readFileContents(const char *filename, usize *size);
+
 } // namespace rideau
 
 #endif
@@ -0,0 +1,103 @@
+#include "file_watcher.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace rideau {
+
+#ifdef __linux__
+
+bool FileWatcher::init() {
+  files.clear();
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot watch files: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void FileWatcher::deinit() {
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+  files.clear();
+}
+
+u32 FileWatcher::watch(const std::string &path) {
+  const usize slash = path.find_last_of('/');
+  const std::string directory =
+      slash == std::string::npos ? "." : path.substr(0, slash + 1);
+  const std::string name =
+      slash == std::string::npos ? path : path.substr(slash + 1);
+
+  // Watching the same directory again returns the same descriptor
+  int wd = -1;
+  if (fd >= 0) {
+    wd = inotify_add_watch(fd, directory.c_str(),
+                           IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
+      fprintf(stderr, "Cannot watch %s: %s\n", directory.c_str(),
+              strerror(errno));
+  }
+
+  files.push_back(WatchedFile{name, wd});
+  return files.size() - 1;
+}
+
+void FileWatcher::poll(std::vector<u32> *changed) {
+  ENSURE(changed != nullptr);
+  if (fd < 0)
+    return;
+
+  const usize firstChanged = changed->size();
+  alignas(struct inotify_event) char buffer[4096];
+  for (;;) {
+    const ssize_t size = read(fd, buffer, sizeof(buffer));
+    if (size <= 0)
+      break; // EAGAIN once drained
+
+    for (ssize_t offset = 0; offset < size;) {
+      const struct inotify_event *event =
+          (const struct inotify_event *)(buffer + offset);
+      offset += sizeof(struct inotify_event) + event->len;
+      if (event->len == 0)
+        continue;
+
+      for (u32 i = 0; i < files.size(); ++i) {
+        if (files[i].wd == event->wd && files[i].name == event->name &&
+            std::find(changed->begin() + firstChanged, changed->end(), i) ==
+                changed->end())
+          changed->push_back(i);
+      }
+    }
+  }
+}
+
+#else
+
+bool FileWatcher::init() {
+  fd = -1;
+  files.clear();
+  return false;
+}
+
+void FileWatcher::deinit() { files.clear(); }
+
+u32 FileWatcher::watch(const std::string &path) {
+  files.push_back(WatchedFile{path, -1});
+  return files.size() - 1;
+}
+
+void FileWatcher::poll(std::vector<u32> *changed) { UNUSED(changed); }
+
+#endif
+
+} // namespace rideau
@@ -0,0 +1,38 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include "utils.h"
+
+#include <string>
+#include <vector>
+
+namespace rideau {
+
+// Reports files written by other programs.  Watches the directories holding
+// the files rather than the files themselves, since tools often write a new
+// file and rename it over the old one.  Uses inotify on Linux; elsewhere,
+// nothing is ever reported.
+struct FileWatcher {
+  struct WatchedFile {
+    std::string name; // without directory
+    int wd;           // of the directory
+  };
+
+  int fd;
+  std::vector<WatchedFile> files;
+
+  // Returns false if changes can't be watched
+  bool init();
+  void deinit();
+
+  // Returns the index poll() reports path changes with
+  u32 watch(const std::string &path);
+
+  // Append the indices of the files changed since the last call, once each.
+  // Doesn't block.
+  void poll(std::vector<u32> *changed);
+};
+
+} // namespace rideau
+
+#endif
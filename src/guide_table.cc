@@ -0,0 +1,81 @@
+#include "guide_table.h"
+
+#include <algorithm>
+
+namespace rideau {
+
+void GuideTable::rebuild(const Track &track) {
+  const u32 n = track.triggers.size();
+  segments.assign(n, GuideSegment{0, 0, 0.0f});
+  refresh(track, 0, n);
+}
+
+void GuideTable::triggerInserted(const Track &track, u32 index) {
+  ASSERT(index <= segments.size());
+  segments.insert(segments.begin() + index, GuideSegment{0, 0, 0.0f});
+  refresh(track, index, index + 1);
+}
+
+void GuideTable::triggerRemoved(const Track &track, u32 index) {
+  ASSERT(index < segments.size());
+  segments.erase(segments.begin() + index);
+  refresh(track, index, index);
+}
+
+void GuideTable::triggerChanged(const Track &track, u32 index) {
+  ASSERT(index < segments.size());
+  refresh(track, index, index + 1);
+}
+
+// Recompute the segments of triggers [begin,end), and of every trigger between
+// the guides surrounding them.  Those two guides keep their outer offsets,
+// which an insertion or removal between them does not change.
+void GuideTable::refresh(const Track &track, u32 begin, u32 end) {
+  const std::vector<Trigger> &triggers = track.triggers;
+  const u32 n = triggers.size();
+  ENSURE(segments.size() == n);
+  if (n == 0)
+    return;
+
+  auto isGuide = [&](u32 i) { return triggers[i].type == Trigger::TrackGuide; };
+
+  u32 first = std::min(begin, n);
+  while (first > 0) {
+    --first;
+    if (isGuide(first))
+      break;
+  }
+  u32 last = std::min(end, n - 1);
+  while (last < n - 1 && !isGuide(last))
+    ++last;
+
+  const bool keepFirst = first < begin && isGuide(first);
+  const bool keepLast = last >= end && isGuide(last);
+
+  u32 prev = NO_GUIDE;
+  for (u32 i = first; i <= last; ++i) {
+    if (!(i == first && keepFirst))
+      segments[i].prevOffset = prev == NO_GUIDE ? 0 : i - prev;
+    if (isGuide(i))
+      prev = i;
+  }
+
+  u32 next = NO_GUIDE;
+  for (u32 i = last + 1; i-- > first;) {
+    GuideSegment &s = segments[i];
+    if (!(i == last && keepLast))
+      s.nextOffset = next == NO_GUIDE ? 0 : next - i;
+
+    s.r = 0.0f;
+    if (isGuide(i)) {
+      next = i;
+    } else if (s.prevOffset != 0 && s.nextOffset != 0) {
+      const u32 prevTick = triggers[i - s.prevOffset].tick;
+      const u32 nextTick = triggers[i + s.nextOffset].tick;
+      if (nextTick > prevTick)
+        s.r = float(triggers[i].tick - prevTick) / (nextTick - prevTick);
+    }
+  }
+}
+
+} // namespace rideau
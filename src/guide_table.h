@@ -0,0 +1,51 @@
+#ifndef GUIDE_TABLE_H
+#define GUIDE_TABLE_H
+
+#include "track.h"
+#include "utils.h"
+
+#include <vector>
+
+namespace rideau {
+
+// Where a trigger lies on the EMS track guide.  Guides are stored as offsets
+// from the trigger, so inserting or removing a trigger only invalidates the
+// segments around it.
+struct GuideSegment {
+  u32 prevOffset; // triggers back to the previous guide, 0 if none
+  u32 nextOffset; // triggers forward to the next guide, 0 if none
+  float r;        // position between the two guides, by tick
+};
+
+// Guide segment of every trigger of a track, kept in step with the trigger
+// list so that EMS layout costs O(visible) per frame.  Edits only rebuild the
+// segments between the guides surrounding them.
+struct GuideTable {
+  static const u32 NO_GUIDE = UINT32_MAX;
+
+  std::vector<GuideSegment> segments; // one per trigger
+
+  void rebuild(const Track &track);
+
+  // Call right after the trigger list changed at index
+  void triggerInserted(const Track &track, u32 index);
+  void triggerRemoved(const Track &track, u32 index);
+  void triggerChanged(const Track &track, u32 index);
+
+  // Index of the guide before or after trigger i, or NO_GUIDE
+  u32 prevGuide(u32 i) const {
+    const u32 offset = segments[i].prevOffset;
+    return offset == 0 ? NO_GUIDE : i - offset;
+  }
+  u32 nextGuide(u32 i) const {
+    const u32 offset = segments[i].nextOffset;
+    return offset == 0 ? NO_GUIDE : i + offset;
+  }
+
+private:
+  void refresh(const Track &track, u32 begin, u32 end);
+};
+
+} // namespace rideau
+
+#endif
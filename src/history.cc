@@ -0,0 +1,87 @@
+#include "history.h"
+
+namespace rideau {
+
+TriggerEdit TriggerEdit::insert(const Trigger &t) {
+  TriggerEdit e;
+  e.kind = Insert;
+  e.before = t;
+  e.after = t;
+  return e;
+}
+
+TriggerEdit TriggerEdit::remove(const Trigger &t) {
+  TriggerEdit e;
+  e.kind = Remove;
+  e.before = t;
+  e.after = t;
+  return e;
+}
+
+TriggerEdit TriggerEdit::change(const Trigger &before, const Trigger &after) {
+  ASSERT(before.id == after.id);
+
+  TriggerEdit e;
+  e.kind = Change;
+  e.before = before;
+  e.after = after;
+  return e;
+}
+
+TriggerEdit TriggerEdit::inverse() const {
+  switch (kind) {
+  case Insert:
+    return remove(after);
+  case Remove:
+    return insert(before);
+  case Change:
+    return change(after, before);
+  }
+  UNREACHABLE();
+  return *this;
+}
+
+void EditHistory::init() {
+  undoSteps.clear();
+  redoSteps.clear();
+}
+
+void EditHistory::push(EditStep &&step) {
+  if (step.empty())
+    return;
+
+  redoSteps.clear();
+  undoSteps.push_back(std::move(step));
+  if (undoSteps.size() > MAX_STEPS)
+    undoSteps.pop_front();
+}
+
+bool EditHistory::undo(EditStep *edits) {
+  ENSURE(edits != nullptr);
+  if (undoSteps.empty())
+    return false;
+
+  const EditStep &step = undoSteps.back();
+  edits->clear();
+  edits->reserve(step.size());
+  for (usize i = step.size(); i-- > 0;)
+    edits->push_back(step[i].inverse());
+
+  redoSteps.push_back(std::move(undoSteps.back()));
+  undoSteps.pop_back();
+  return true;
+}
+
+bool EditHistory::redo(EditStep *edits) {
+  ENSURE(edits != nullptr);
+  if (redoSteps.empty())
+    return false;
+
+  *edits = redoSteps.back();
+
+  undoSteps.push_back(std::move(redoSteps.back()));
+  redoSteps.pop_back();
+  return true;
+}
+
+} // namespace rideau
@@ -0,0 +1,56 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "track.h"
+#include "utils.h"
+
+#include <deque>
+#include <vector>
+
+namespace rideau {
+
+// Insertion, removal or replacement of one trigger.  Triggers are matched by
+// id and tick, so an edit stays valid however the track was sorted since.
+struct TriggerEdit {
+  enum Kind : u32 {
+    Insert,
+    Remove,
+    Change,
+  };
+
+  Kind kind;
+  Trigger before; // Remove and Change
+  Trigger after;  // Insert and Change
+
+  static TriggerEdit insert(const Trigger &t);
+  static TriggerEdit remove(const Trigger &t);
+  static TriggerEdit change(const Trigger &before, const Trigger &after);
+
+  TriggerEdit inverse() const;
+};
+
+// One undoable action.  It touches every trigger at most once.
+typedef std::vector<TriggerEdit> EditStep;
+
+// Undo and redo stacks of edit steps.  Steps only hold the triggers they
+// touched, so memory grows with the size of the edits rather than the track.
+struct EditHistory {
+  static const usize MAX_STEPS = 10000;
+
+  std::deque<EditStep> undoSteps;
+  std::vector<EditStep> redoSteps;
+
+  void init();
+
+  // Record a step that was just applied
+  void push(EditStep &&step);
+
+  // Move the last step over to the other stack, and give the edits to apply,
+  // in order.  Return false if there is nothing to undo or redo.
+  bool undo(EditStep *edits);
+  bool redo(EditStep *edits);
+};
+
+} // namespace rideau
+
+#endif
@@ -0,0 +1,257 @@
+#include "hitsounds.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace rideau {
+
+static void synthClick(Hitsound *sound, u32 sampleRate, float freq,
+                       float duration, float gain) {
+  sound->length = duration * sampleRate;
+  sound->samples = (float *)malloc(sound->length * sizeof(float));
+  ENSURE(sound->samples != nullptr);
+
+  const float attack = 0.001f;
+  for (u32 i = 0; i < sound->length; ++i) {
+    const float t = (float)i / sampleRate;
+    const float env =
+        std::min(t / attack, 1.0f) * expf(-t * 6.0f / duration);
+    sound->samples[i] = gain * env * sinf(2.0f * (float)M_PI * freq * t);
+  }
+}
+
+void HitsoundMixer::init(u32 sampleRate) {
+  const struct {
+    float freq;
+    float duration;
+    float gain;
+  } params[Trigger::Type::Count] = {
+      {1760.0f, 0.050f, 0.8f}, // Touch
+      {2637.0f, 0.060f, 0.7f}, // Slide
+      {1318.0f, 0.070f, 0.8f}, // Hold
+      {988.0f, 0.030f, 0.4f},  // Holdlet
+      {1568.0f, 0.050f, 0.7f}, // HoldEnd
+      {2637.0f, 0.060f, 0.7f}, // HoldEndSlide
+      {0.0f, 0.0f, 0.0f},      // TrackGuide is silent
+  };
+
+  for (u32 i = 0; i < Trigger::Type::Count; ++i) {
+    if (params[i].duration > 0.0f) {
+      synthClick(&sounds[i], sampleRate, params[i].freq, params[i].duration,
+                 params[i].gain);
+    } else {
+      sounds[i].samples = nullptr;
+      sounds[i].length = 0;
+    }
+  }
+
+  enabled = false;
+  volume = 0.5f;
+
+  events.clear();
+  eventFrames.clear();
+  framesPerTick = 0.0;
+  schedulePending = false;
+  scheduleVersion = 1;
+
+  for (int i = 0; i < 2; ++i) {
+    schedules[i].events = nullptr;
+    schedules[i].count = 0;
+    schedules[i].capacity = 0;
+    schedules[i].version = 0;
+  }
+  activeSchedule = 0;
+  readingSchedule = -1;
+
+  voiceCount = 0;
+  expectedFrame = 0;
+  nextEvent = 0;
+  lastVersion = ~0u;
+  jumped = false;
+}
+
+void HitsoundMixer::deinit() {
+  for (u32 i = 0; i < Trigger::Type::Count; ++i) {
+    free(sounds[i].samples);
+    sounds[i].samples = nullptr;
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    free(schedules[i].events);
+    schedules[i].events = nullptr;
+  }
+}
+
+static bool eventBefore(const HitsoundEvent &a, const HitsoundEvent &b) {
+  return a.frame < b.frame;
+}
+
+void HitsoundMixer::buildSchedule(const Track &track, usize framesCount) {
+  ASSERT(track.tickCount > 0);
+  framesPerTick = (double)framesCount / track.tickCount;
+
+  events.clear();
+  eventFrames.clear();
+  events.reserve(track.triggers.size());
+
+  for (const Trigger &t : track.triggers) {
+    HitsoundEvent e;
+    e.frame = t.tick * framesPerTick;
+    e.triggerId = t.id;
+    e.type = t.type;
+    events.push_back(e);
+    eventFrames[t.id] = e.frame;
+  }
+
+  std::stable_sort(events.begin(), events.end(), eventBefore);
+  schedulePending = true;
+}
+
+void HitsoundMixer::addTrigger(const Trigger &t) {
+  HitsoundEvent e;
+  e.frame = t.tick * framesPerTick;
+  e.triggerId = t.id;
+  e.type = t.type;
+
+  auto it = std::upper_bound(events.begin(), events.end(), e, eventBefore);
+  events.insert(it, e);
+  eventFrames[t.id] = e.frame;
+  schedulePending = true;
+}
+
+void HitsoundMixer::removeTrigger(u32 triggerId) {
+  auto frameIt = eventFrames.find(triggerId);
+  if (frameIt == eventFrames.end())
+    return;
+
+  HitsoundEvent key;
+  key.frame = frameIt->second;
+  auto range = std::equal_range(events.begin(), events.end(), key, eventBefore);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->triggerId == triggerId) {
+      events.erase(it);
+      break;
+    }
+  }
+
+  eventFrames.erase(frameIt);
+  schedulePending = true;
+}
+
+void HitsoundMixer::updateTrigger(const Trigger &t) {
+  removeTrigger(t.id);
+  addTrigger(t);
+}
+
+void HitsoundMixer::publish() {
+  if (!schedulePending)
+    return;
+
+  const s32 back = 1 - activeSchedule;
+  // The audio thread may still be reading the previous schedule; try again
+  // next frame rather than waiting for it.
+  if (readingSchedule == back)
+    return;
+
+  HitsoundSchedule *s = &schedules[back];
+  if (s->capacity < events.size()) {
+    const u32 capacity = std::max((u32)events.size(), s->capacity * 2);
+    s->events =
+        (HitsoundEvent *)realloc(s->events, capacity * sizeof(HitsoundEvent));
+    ENSURE(s->events != nullptr);
+    s->capacity = capacity;
+  }
+
+  if (!events.empty())
+    memcpy(s->events, events.data(), events.size() * sizeof(HitsoundEvent));
+  s->count = events.size();
+  s->version = scheduleVersion++;
+
+  activeSchedule = back;
+  schedulePending = false;
+}
+
+void HitsoundMixer::stopVoices() { voiceCount = 0; }
+
+void HitsoundMixer::jump() { jumped = true; }
+
+void HitsoundMixer::mix(float *out[2], u32 frameCount, usize startFrame,
+                        float speed) {
+  s32 idx;
+  do {
+    idx = activeSchedule;
+    readingSchedule = idx;
+  } while (activeSchedule != idx);
+  const HitsoundSchedule *schedule = &schedules[idx];
+
+  const bool seeked = !jumped && (startFrame + SEEK_SLACK < expectedFrame ||
+                                  startFrame > expectedFrame + SEEK_SLACK);
+  if (seeked)
+    stopVoices();
+
+  if (seeked || jumped || schedule->version != lastVersion) {
+    HitsoundEvent key;
+    key.frame = startFrame;
+    nextEvent = std::lower_bound(schedule->events,
+                                 schedule->events + schedule->count, key,
+                                 eventBefore) -
+                schedule->events;
+    lastVersion = schedule->version;
+    jumped = false;
+  }
+
+  const usize endFrame = startFrame + (usize)(frameCount * speed);
+  const bool isEnabled = enabled;
+
+  while (nextEvent < schedule->count &&
+         schedule->events[nextEvent].frame < endFrame) {
+    const HitsoundEvent &e = schedule->events[nextEvent++];
+    const Hitsound *sound = &sounds[e.type];
+    if (!isEnabled || sound->length == 0 || voiceCount == MAX_VOICES)
+      continue;
+
+    Voice &v = voices[voiceCount++];
+    v.sound = sound;
+    v.position =
+        e.frame > startFrame ? -(s32)((e.frame - startFrame) / speed) : 0;
+  }
+
+  readingSchedule = -1;
+  expectedFrame = endFrame;
+
+  const float gain = volume;
+  u32 v = 0;
+  while (v < voiceCount) {
+    Voice &voice = voices[v];
+
+    u32 i = 0;
+    if (voice.position < 0) {
+      i = -voice.position;
+      if (i >= frameCount) {
+        voice.position += frameCount;
+        ++v;
+        continue;
+      }
+      voice.position = 0;
+    }
+
+    const u32 n =
+        std::min(frameCount - i, voice.sound->length - voice.position);
+    const float *src = voice.sound->samples + voice.position;
+    for (u32 k = 0; k < n; ++k) {
+      const float x = src[k] * gain;
+      out[0][i + k] += x;
+      out[1][i + k] += x;
+    }
+    voice.position += n;
+
+    if ((u32)voice.position >= voice.sound->length)
+      voices[v] = voices[--voiceCount];
+    else
+      ++v;
+  }
+}
+
+} // namespace rideau
@@ -0,0 +1,92 @@
+#ifndef HITSOUNDS_H
+#define HITSOUNDS_H
+
+#include "track.h"
+#include "utils.h"
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+namespace rideau {
+
+struct Hitsound {
+  float *samples;
+  u32 length;
+};
+
+struct HitsoundEvent {
+  usize frame;
+  u32 triggerId;
+  Trigger::Type type;
+};
+
+// Snapshot of the events handed over to the audio thread
+struct HitsoundSchedule {
+  HitsoundEvent *events;
+  u32 count;
+  u32 capacity;
+  u32 version;
+};
+
+// Mixes a click per trigger on top of the song.  The main thread edits a
+// sorted event list and publishes it to one of two schedules; the audio thread
+// only ever reads the published schedule, without allocating or locking.
+struct HitsoundMixer {
+  static const u32 MAX_VOICES = 32;
+  // Position changes larger than this are treated as seeks
+  static const usize SEEK_SLACK = 1024;
+
+  struct Voice {
+    const Hitsound *sound;
+    s32 position; // negative until the voice starts
+  };
+
+  Hitsound sounds[Trigger::Type::Count];
+
+  std::atomic<bool> enabled;
+  std::atomic<float> volume;
+
+  // Main thread
+  std::vector<HitsoundEvent> events; // sorted by frame
+  std::unordered_map<u32, usize> eventFrames;
+  double framesPerTick;
+  bool schedulePending;
+  u32 scheduleVersion;
+
+  HitsoundSchedule schedules[2];
+  std::atomic<s32> activeSchedule;
+  std::atomic<s32> readingSchedule; // -1 when the audio thread is idle
+
+  // Audio thread
+  Voice voices[MAX_VOICES];
+  u32 voiceCount;
+  usize expectedFrame;
+  u32 nextEvent;
+  u32 lastVersion;
+  bool jumped;
+
+  void init(u32 sampleRate);
+  void deinit();
+
+  // Main thread
+  void buildSchedule(const Track &track, usize framesCount);
+  void addTrigger(const Trigger &t);
+  void removeTrigger(u32 triggerId);
+  void updateTrigger(const Trigger &t);
+  void publish();
+
+  // Audio thread: add hitsounds for frameCount output frames to out, starting
+  // at song frame startFrame and advancing by speed song frames per output
+  // frame
+  void mix(float *out[2], u32 frameCount, usize startFrame,
+           float speed = 1.0f);
+  void stopVoices();
+  // Audio thread: the song position jumped (e.g. looping), but let the voices
+  // ring
+  void jump();
+};
+
+} // namespace rideau
+
+#endif
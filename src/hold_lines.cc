@@ -0,0 +1,39 @@
+#include "hold_lines.h"
+
+#include <algorithm>
+
+namespace rideau {
+
+void HoldLines::init() {
+  segments.clear();
+  version = UINT64_MAX;
+}
+
+void HoldLines::update(const Track &track, u64 triggersVersion) {
+  if (version == triggersVersion)
+    return;
+  version = triggersVersion;
+
+  segments.clear();
+  const Trigger *start = nullptr;
+  for (const Trigger &t : track.triggers) {
+    const bool isStart = t.type == Trigger::Hold || t.type == Trigger::Holdlet;
+    const bool isEnd = t.type == Trigger::HoldEnd ||
+                       t.type == Trigger::HoldEndSlide ||
+                       t.type == Trigger::Holdlet;
+
+    if (isEnd && start != nullptr)
+      segments.push_back(HoldSegment{start->tick, t.tick, start->y, t.y});
+    if (isStart || isEnd)
+      start = isStart ? &t : nullptr;
+  }
+}
+
+u32 HoldLines::firstEndingAfter(u32 tick) const {
+  return std::lower_bound(
+             segments.begin(), segments.end(), tick,
+             [](const HoldSegment &s, u32 tick) { return s.endTick < tick; }) -
+         segments.begin();
+}
+
+} // namespace rideau
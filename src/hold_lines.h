@@ -0,0 +1,36 @@
+#ifndef HOLD_LINES_H
+#define HOLD_LINES_H
+
+#include "track.h"
+#include "utils.h"
+
+#include <vector>
+
+namespace rideau {
+
+// Line from a Hold or Holdlet to the next HoldEnd, HoldEndSlide or Holdlet
+struct HoldSegment {
+  u32 startTick;
+  u32 endTick;
+  s32 startY;
+  s32 endY;
+};
+
+// Hold lines of a BMS/FMS track, rebuilt only when the triggers change.
+// Segments follow each other, so they are sorted by both start and end tick.
+struct HoldLines {
+  std::vector<HoldSegment> segments;
+  u64 version;
+
+  void init();
+
+  // Rebuild if the triggers changed since the last call
+  void update(const Track &track, u64 triggersVersion);
+
+  // Index of the first segment ending at or after tick
+  u32 firstEndingAfter(u32 tick) const;
+};
+
+} // namespace rideau
+
+#endif
@@ -0,0 +1,556 @@
+#include "journal.h"
+
+#include "file_utils.h"
+#include "song_cache.h"
+#include "track_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace rideau {
+
+static const u32 JOURNAL_MAGIC = 0x314A4452; // "RDJ1"
+static const u32 JOURNAL_HEADER_SIZE = 3 * sizeof(u32);
+
+enum RecordKind : u32 {
+  EditsRecord,
+  HeaderRecord,
+  SnapshotRecord,
+};
+
+static std::string getJournalFilename(const std::string &triggerFile) {
+  return triggerFile + ".journal";
+}
+
+static u64 nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static bool hashFile(const std::string &filename, u64 *hash) {
+  usize size;
+  u8 *data = readFileContents(filename.c_str(), &size);
+  if (data == nullptr)
+    return false;
+  *hash = hashBytes(data, size);
+  free(data);
+  return true;
+}
+
+static bool writeAll(int fd, const u8 *data, usize size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+static void syncFile(int fd) {
+#ifdef __linux__
+  fdatasync(fd);
+#else
+  fsync(fd);
+#endif
+}
+
+static void putu32(std::vector<u8> *b, u32 x) {
+  b->push_back(x & 0xFF);
+  b->push_back((x >> 8) & 0xFF);
+  b->push_back((x >> 16) & 0xFF);
+  b->push_back(x >> 24);
+}
+
+static void putTrigger(std::vector<u8> *b, const Trigger &t) {
+  putu32(b, t.tick);
+  putu32(b, t.type);
+  putu32(b, t.x);
+  putu32(b, t.y);
+  putu32(b, t.angle);
+  putu32(b, t.flags);
+}
+
+static Trigger readTrigger(const u8 **p) {
+  Trigger t;
+  t.tick = readu32le(p);
+  t.type = Trigger::Type(readu32le(p));
+  t.x = (s32)readu32le(p);
+  t.y = (s32)readu32le(p);
+  t.angle = readu32le(p);
+  t.flags = Trigger::Flag(readu32le(p));
+  t.id = 0;
+  return t;
+}
+
+static void getHeaderFields(const Track &track,
+                            u32 fields[EditJournal::HEADER_FIELDS]) {
+  fields[0] = track.trackType;
+  fields[1] = track.tickCount;
+  fields[2] = track.featureZoneStart;
+  fields[3] = track.featureZoneEnd;
+  fields[4] = track.summonStart;
+  fields[5] = track.summonEnd;
+}
+
+static void putJournalHeader(std::vector<u8> *b, u64 baseHash) {
+  putu32(b, JOURNAL_MAGIC);
+  putu32(b, baseHash & 0xFFFFFFFF);
+  putu32(b, baseHash >> 32);
+}
+
+// Records start with their kind and size, and end with a check
+static usize beginRecord(std::vector<u8> *b, RecordKind kind) {
+  const usize start = b->size();
+  putu32(b, kind);
+  putu32(b, 0);
+  return start;
+}
+
+static void endRecord(std::vector<u8> *b, usize start) {
+  u8 *size = b->data() + start + sizeof(u32);
+  writeu32le(&size, b->size() - start - 2 * sizeof(u32));
+  putu32(b, (u32)hashBytes(b->data() + start, b->size() - start));
+}
+
+static void putHeaderRecord(std::vector<u8> *b,
+                            const u32 fields[EditJournal::HEADER_FIELDS]) {
+  const usize start = beginRecord(b, HeaderRecord);
+  for (u32 i = 0; i < EditJournal::HEADER_FIELDS; ++i)
+    putu32(b, fields[i]);
+  endRecord(b, start);
+}
+
+static void putSnapshotRecord(std::vector<u8> *b, const Track &track) {
+  // writeTrack sorts and fixes up its header, so give it a copy
+  Track copy = track;
+  const usize start = beginRecord(b, SnapshotRecord);
+  const usize rawSize = getTrackRawSize(copy);
+  b->resize(b->size() + rawSize);
+  writeTrack(copy, b->data() + b->size() - rawSize, rawSize);
+  endRecord(b, start);
+}
+
+// Write a whole journal, then move it over filename
+static bool writeJournal(const std::string &filename,
+                         const std::vector<u8> &contents) {
+  const std::string tmpFilename = filename + ".tmp";
+  const int fd = ::open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                        0666);
+  if (fd < 0)
+    return false;
+  bool ok = writeAll(fd, contents.data(), contents.size());
+  syncFile(fd);
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+    unlink(tmpFilename.c_str());
+    return false;
+  }
+  return true;
+}
+
+void EditJournal::init() {
+  triggerFile.clear();
+  filename.clear();
+  fd = -1;
+  pool = nullptr;
+  jobs = nullptr;
+  recordsCount = 0;
+  isCompacting = false;
+}
+
+bool EditJournal::open(const std::string &file, const Track &track,
+                       bool snapshot, ThreadPool *threadPool) {
+  ENSURE(threadPool != nullptr);
+  ENSURE(!isOpen());
+
+  triggerFile = file;
+  filename = getJournalFilename(triggerFile);
+  pool = threadPool;
+  jobs = new JournalJobs;
+  jobs->isSyncing = false;
+  jobs->isCompacting = false;
+  isCompacting = false;
+
+  reset(track, snapshot);
+  return isOpen();
+}
+
+void EditJournal::waitJobs() {
+  // Syncs take milliseconds, and compactions are about as cheap as a save
+  while (jobs->isSyncing.load(std::memory_order_acquire) ||
+         jobs->isCompacting.load(std::memory_order_acquire))
+    std::this_thread::yield();
+
+  if (isCompacting) {
+    unlink((filename + ".compact").c_str());
+    isCompacting = false;
+    pendingRecords.clear();
+  }
+}
+
+void EditJournal::close() {
+  if (jobs == nullptr)
+    return;
+  waitJobs();
+  delete jobs;
+  jobs = nullptr;
+
+  if (!isOpen())
+    return;
+  syncFile(fd);
+  ::close(fd);
+  fd = -1;
+
+  // Nothing to recover
+  if (recordsCount == 0)
+    unlink(filename.c_str());
+}
+
+void EditJournal::reset(const Track &track, bool snapshot) {
+  if (jobs == nullptr)
+    return;
+  waitJobs();
+  if (isOpen()) {
+    ::close(fd);
+    fd = -1;
+  }
+
+  if (!hashFile(triggerFile, &baseHash)) {
+    fprintf(stderr, "Cannot read %s, not journaling its edits\n",
+            triggerFile.c_str());
+    return;
+  }
+
+  getHeaderFields(track, header);
+  record.clear();
+  putJournalHeader(&record, baseHash);
+  if (snapshot)
+    putSnapshotRecord(&record, track);
+
+  if (!writeJournal(filename, record) ||
+      (fd = ::open(filename.c_str(), O_WRONLY | O_APPEND)) < 0) {
+    fprintf(stderr, "Cannot write %s, not journaling edits\n",
+            filename.c_str());
+    return;
+  }
+  size = record.size();
+  recordsCount = snapshot ? 1 : 0;
+  isDirty = false;
+  lastSyncMs = nowMs();
+}
+
+void EditJournal::append() {
+  if (!writeAll(fd, record.data(), record.size())) {
+    fprintf(stderr, "Cannot write %s, not journaling edits\n",
+            filename.c_str());
+    waitJobs();
+    ::close(fd);
+    fd = -1;
+    return;
+  }
+  size += record.size();
+  ++recordsCount;
+  isDirty = true;
+
+  // Compacted from the track as it was before
+  if (isCompacting)
+    pendingRecords.insert(pendingRecords.end(), record.begin(), record.end());
+}
+
+void EditJournal::appendEdits(const EditStep &edits) {
+  if (!isOpen() || edits.empty())
+    return;
+
+  record.clear();
+  const usize start = beginRecord(&record, EditsRecord);
+  putu32(&record, edits.size());
+  for (const TriggerEdit &e : edits) {
+    putu32(&record, e.kind);
+    if (e.kind != TriggerEdit::Insert)
+      putTrigger(&record, e.before);
+    if (e.kind != TriggerEdit::Remove)
+      putTrigger(&record, e.after);
+  }
+  endRecord(&record, start);
+  append();
+}
+
+void EditJournal::update(const Track &track, bool canCompact) {
+  if (!isOpen())
+    return;
+
+  u32 fields[HEADER_FIELDS];
+  getHeaderFields(track, fields);
+  if (!std::equal(fields, fields + HEADER_FIELDS, header)) {
+    std::copy(fields, fields + HEADER_FIELDS, header);
+    record.clear();
+    putHeaderRecord(&record, header);
+    append();
+    if (!isOpen())
+      return;
+  }
+
+  if (isCompacting)
+    finishCompaction();
+  else if (canCompact && size > MIN_COMPACT_SIZE &&
+           size > 2 * getTrackRawSize(track))
+    startCompaction(track);
+
+  const u64 now = nowMs();
+  if (isDirty && now - lastSyncMs >= SYNC_INTERVAL_MS &&
+      !jobs->isSyncing.load(std::memory_order_acquire)) {
+    isDirty = false;
+    lastSyncMs = now;
+    jobs->isSyncing.store(true, std::memory_order_relaxed);
+    JournalJobs *j = jobs;
+    const int f = fd;
+    pool->submit([j, f]() {
+      syncFile(f);
+      j->isSyncing.store(false, std::memory_order_release);
+    });
+  }
+}
+
+void EditJournal::startCompaction(const Track &track) {
+  isCompacting = true;
+  pendingRecords.clear();
+  jobs->isCompacting.store(true, std::memory_order_relaxed);
+
+  JournalJobs *j = jobs;
+  const std::string compactFilename = filename + ".compact";
+  const u64 hash = baseHash;
+  // The job gets its own copy, the editor keeps going
+  pool->submit([j, compactFilename, hash, track]() {
+    std::vector<u8> contents;
+    putJournalHeader(&contents, hash);
+    putSnapshotRecord(&contents, track);
+    j->compactOk = writeJournal(compactFilename, contents);
+    j->compactSize = contents.size();
+    j->isCompacting.store(false, std::memory_order_release);
+  });
+}
+
+void EditJournal::finishCompaction() {
+  // The sync job may still use the old file
+  if (jobs->isCompacting.load(std::memory_order_acquire) ||
+      jobs->isSyncing.load(std::memory_order_acquire))
+    return;
+  isCompacting = false;
+
+  const std::string compactFilename = filename + ".compact";
+  int compactFd = -1;
+  bool ok = jobs->compactOk &&
+            (compactFd = ::open(compactFilename.c_str(),
+                                O_WRONLY | O_APPEND)) >= 0 &&
+            writeAll(compactFd, pendingRecords.data(), pendingRecords.size());
+  if (ok) {
+    syncFile(compactFd);
+    ok = rename(compactFilename.c_str(), filename.c_str()) == 0;
+  }
+
+  if (!ok) {
+    // Keep appending to the long journal
+    fprintf(stderr, "Cannot compact %s\n", filename.c_str());
+    if (compactFd >= 0)
+      ::close(compactFd);
+    unlink(compactFilename.c_str());
+  } else {
+    ::close(fd);
+    fd = compactFd;
+    size = jobs->compactSize + pendingRecords.size();
+    isDirty = false;
+  }
+  pendingRecords.clear();
+}
+
+// Apply an edit made in another session, where triggers had other ids
+static bool replayEdit(Track &track, const TriggerEdit &e) {
+  if (e.kind != TriggerEdit::Insert) {
+    auto it = std::lower_bound(
+        track.triggers.begin(), track.triggers.end(), e.before.tick,
+        [](const Trigger &t, u32 tick) { return t.tick < tick; });
+    for (; it != track.triggers.end() && it->tick == e.before.tick; ++it) {
+      if (isSameTrigger(*it, e.before))
+        break;
+    }
+    if (it == track.triggers.end() || it->tick != e.before.tick)
+      return false;
+    track.triggers.erase(it);
+  }
+
+  if (e.kind != TriggerEdit::Remove) {
+    Trigger t = e.after;
+    t.id = genId();
+    track.triggers.insert(track.triggers.begin() +
+                              getTriggerInsertIndex(track, t.tick),
+                          t);
+  }
+  track.triggerCount = track.triggers.size();
+  return true;
+}
+
+// Returns false if the record doesn't apply to track
+static bool replayRecord(u32 kind, const u8 *payload, u32 payloadSize,
+                         Track *track) {
+  const u8 *p = payload;
+  const u8 *const end = payload + payloadSize;
+
+  switch (kind) {
+  case EditsRecord: {
+    if (payloadSize < sizeof(u32))
+      return false;
+    const u32 count = readu32le(&p);
+    const u32 triggerSize = 6 * sizeof(u32);
+    for (u32 i = 0; i < count; ++i) {
+      if (end - p < (ptrdiff_t)sizeof(u32))
+        return false;
+      TriggerEdit e;
+      e.kind = TriggerEdit::Kind(readu32le(&p));
+      const u32 triggersCount = e.kind == TriggerEdit::Change ? 2 : 1;
+      if (e.kind > TriggerEdit::Change ||
+          end - p < (ptrdiff_t)(triggersCount * triggerSize))
+        return false;
+      if (e.kind != TriggerEdit::Insert)
+        e.before = readTrigger(&p);
+      if (e.kind != TriggerEdit::Remove)
+        e.after = readTrigger(&p);
+      if (!replayEdit(*track, e))
+        return false;
+    }
+    return p == end;
+  }
+
+  case HeaderRecord: {
+    if (payloadSize != EditJournal::HEADER_FIELDS * sizeof(u32))
+      return false;
+    const u32 trackType = readu32le(&p);
+    if (trackType >= Track::Type::Count)
+      return false;
+    track->trackType = Track::Type(trackType);
+    track->tickCount = readu32le(&p);
+    track->tickEnd = track->tickCount;
+    track->featureZoneStart = readu32le(&p);
+    track->featureZoneEnd = readu32le(&p);
+    track->summonStart = readu32le(&p);
+    track->summonEnd = readu32le(&p);
+    return true;
+  }
+
+  case SnapshotRecord: {
+    Track snapshot;
+    if (!tryParseTrack(payload, payloadSize, &snapshot))
+      return false;
+    for (Trigger &t : snapshot.triggers)
+      t.id = genId();
+    sortTrack(snapshot);
+    *track = std::move(snapshot);
+    return true;
+  }
+  }
+
+  return false;
+}
+
+// Keep a journal that didn't replay whole out of the way of the next one,
+// which would replace it
+static void setJournalAside(const std::string &filename) {
+  const std::string failedFilename = filename + ".failed";
+  if (rename(filename.c_str(), failedFilename.c_str()) == 0)
+    fprintf(stderr, "Kept %s as %s, its edits are not all recovered\n",
+            filename.c_str(), failedFilename.c_str());
+  else
+    fprintf(stderr, "Cannot keep %s aside, its edits will be lost\n",
+            filename.c_str());
+}
+
+u32 replayJournal(const std::string &triggerFile, Track *track) {
+  ENSURE(track != nullptr);
+
+  const std::string filename = getJournalFilename(triggerFile);
+  struct stat journalStat, triggerStat;
+  if (stat(filename.c_str(), &journalStat) != 0 ||
+      stat(triggerFile.c_str(), &triggerStat) != 0)
+    return 0;
+  if (journalStat.st_mtime < triggerStat.st_mtime) {
+    fprintf(stderr, "Ignoring %s, older than the trigger file\n",
+            filename.c_str());
+    return 0;
+  }
+
+  usize size;
+  u8 *data = readFileContents(filename.c_str(), &size);
+  if (data == nullptr)
+    return 0;
+
+  const u8 *p = data;
+  u64 hash;
+  bool ok = size >= JOURNAL_HEADER_SIZE && readu32le(&p) == JOURNAL_MAGIC &&
+            hashFile(triggerFile, &hash);
+  if (ok) {
+    const u64 lo = readu32le(&p);
+    const u64 hi = readu32le(&p);
+    ok = (lo | hi << 32) == hash;
+  }
+  if (!ok) {
+    fprintf(stderr, "Ignoring %s, written for other contents\n",
+            filename.c_str());
+    free(data);
+    setJournalAside(filename);
+    return 0;
+  }
+
+  sortTrack(*track);
+
+  u32 replayedCount = 0;
+  bool isFailed = false; // short of a record torn by a crash
+  const u8 *const end = data + size;
+  while (p != end) {
+    // Kind, size, and check
+    const u8 *const start = p;
+    if (end - p < (ptrdiff_t)(3 * sizeof(u32))) {
+      fprintf(stderr, "%s ends with a partial record\n", filename.c_str());
+      break;
+    }
+    const u32 kind = readu32le(&p);
+    const u32 payloadSize = readu32le(&p);
+    if ((usize)(end - p) < payloadSize + sizeof(u32)) {
+      fprintf(stderr, "%s ends with a partial record\n", filename.c_str());
+      break;
+    }
+    const u8 *const payload = p;
+    p += payloadSize;
+    const u32 check = readu32le(&p);
+    if (check != (u32)hashBytes(start, p - start - sizeof(u32))) {
+      fprintf(stderr, "%s has a damaged record\n", filename.c_str());
+      isFailed = p != end;
+      break;
+    }
+
+    if (!replayRecord(kind, payload, payloadSize, track)) {
+      fprintf(stderr, "%s does not apply to the trigger file, stopping\n",
+              filename.c_str());
+      isFailed = true;
+      break;
+    }
+    ++replayedCount;
+  }
+
+  free(data);
+  if (isFailed)
+    setJournalAside(filename);
+  return replayedCount;
+}
+
+} // namespace rideau
@@ -0,0 +1,108 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "history.h"
+#include "thread_pool.h"
+#include "track.h"
+#include "utils.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace rideau {
+
+// Edit journal of a trigger file, kept next to it as FILE.journal.  Every
+// edit is appended as it happens, so a crash or a kill loses nothing, for a
+// few bytes per edit instead of a whole save.  Replaying the journal over the
+// file brings the edits back.
+//
+//    Offset   Size   Role
+//    --------------------------------------------------------
+//    00h      4      Magic ("RDJ1")
+//    04h      8      Hash of the trigger file the journal applies to
+//    0Ch      ...    Records
+//
+// Records are a u32 kind, a u32 payload size, the payload, and a u32 check
+// of all that, so that a record torn by a crash is dropped.  Kinds:
+//
+//    Edits     a TriggerEdit count, then each edit: kind, then the trigger
+//              before (Remove, Change) and the trigger after (Insert, Change)
+//    Header    track type, tick count, feature zone and summon bounds
+//    Snapshot  the whole track, as in trigger files but uncompressed
+//
+// Records are synced to disk in the background at most every second, and
+// the journal is compacted to a snapshot in the background once it outgrows
+// the track.
+
+// Shared with the background jobs, so it stays put when the journal moves
+struct JournalJobs {
+  std::atomic<bool> isSyncing;
+  std::atomic<bool> isCompacting;
+  bool compactOk;     // written by the compaction job before it's done
+  usize compactSize;  // same
+};
+
+struct EditJournal {
+  static const u32 SYNC_INTERVAL_MS = 1000;
+  static const usize MIN_COMPACT_SIZE = 64 * 1024;
+  static const u32 HEADER_FIELDS = 6;
+
+  std::string triggerFile;
+  std::string filename;
+  int fd; // -1 when closed
+  ThreadPool *pool;
+  JournalJobs *jobs;
+
+  u64 baseHash;
+  usize size;       // of the journal file
+  u32 recordsCount; // since the trigger file was last written
+  u32 header[HEADER_FIELDS];
+  bool isDirty; // written since the last sync
+  u64 lastSyncMs;
+  bool isCompacting;
+  std::vector<u8> record;         // being encoded
+  std::vector<u8> pendingRecords; // written while compacting
+
+  // Closed; appends do nothing
+  void init();
+
+  // Start journaling file, whose edits so far made track.  Any
+  // previous journal is replaced; with snapshot, the new one starts with
+  // track, e.g. when it was just replayed.
+  bool open(const std::string &file, const Track &track, bool snapshot,
+            ThreadPool *threadPool);
+  // Waits for the background jobs.  An empty journal is removed.
+  void close();
+
+  bool isOpen() const { return fd >= 0; }
+
+  void appendEdits(const EditStep &edits);
+
+  // Once per frame: record header changes, sync and compact when due.
+  // Without canCompact, e.g. while a live edit will only be recorded when it
+  // ends, no compaction starts: its snapshot would already hold the edit.
+  void update(const Track &track, bool canCompact);
+
+  // The trigger file was written or read again, and track is what's in the
+  // editor now: start over from the file.  Without snapshot, track must be
+  // what the file holds.
+  void reset(const Track &track, bool snapshot);
+
+private:
+  void append();
+  void startCompaction(const Track &track);
+  void finishCompaction();
+  void waitJobs();
+};
+
+// Apply the journal of triggerFile to track, freshly parsed from it.  A
+// journal older than the file is ignored.  One written for other contents,
+// or with records that don't apply, is kept as FILE.journal.failed, and
+// reported, rather than replaced by the next journal.  Returns the number of
+// records replayed.
+u32 replayJournal(const std::string &triggerFile, Track *track);
+
+} // namespace rideau
+
+#endif
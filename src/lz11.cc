@@ -3,6 +3,7 @@
 #include "file_utils.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
 namespace rideau {
 
@@ -20,50 +21,76 @@ u32 getLZ11RawSize(FILE *f) {
 }
 
 void decompressLZ11(FILE *src, u8 *dst, u32 dstSize) {
-  u32 size = getLZ11RawSize(src);
-  ENSURE(dstSize >= size);
+  const bool ok = tryDecompressLZ11(src, dst, dstSize);
+  ENSURE(ok);
+}
+
+bool tryDecompressLZ11(FILE *src, u8 *dst, u32 dstSize) {
+  ENSURE(src != nullptr);
+  ENSURE(dst != nullptr);
+
+  if (fseek(src, 0, SEEK_SET) != 0)
+    return false;
+
+  // Every byte read may hit the end of a truncated file
+  bool ok = true;
+  auto next = [&]() -> u8 {
+    const int c = fgetc(src);
+    ok = ok && c != EOF;
+    return c;
+  };
+
+  const u8 type = next();
+  u32 size = next();
+  size |= next() << 8;
+  size |= next() << 16;
+  if (!ok || type != 0x11 || size > dstSize)
+    return false;
 
   u8 *out = dst;
 
   const u8 *fin = out + size;
-  while (out < fin) {
-    u8 flags = readu8(src);
+  while (out < fin && ok) {
+    u8 flags = next();
 
-    for (u8 bit = 0; bit < 8; ++bit) {
+    for (u8 bit = 0; bit < 8 && ok; ++bit) {
       if (out >= fin)
         break;
 
       if ((flags & 0x80) == 0) {
-        *out++ = readu8(src);
+        *out++ = next();
       } else {
-        const u8 x = readu8(src);
+        const u8 x = next();
         const u8 hi = x >> 4;
         const u8 lo = x & 0xF;
 
-        u16 len;
-        u16 disp;
+        u32 len;
+        u32 disp;
 
         if (hi == 1) {
-          const u8 b0 = readu8(src);
-          const u8 b1 = readu8(src);
-          const u8 b2 = readu8(src);
+          const u8 b0 = next();
+          const u8 b1 = next();
+          const u8 b2 = next();
 
           len = ((lo << 12) | (b0 << 4) | (b1 >> 4)) + 0x111;
           disp = (((b1 & 0xF) << 8) | b2) + 1;
         } else if (hi == 0) {
-          const u8 b0 = readu8(src);
-          const u8 b1 = readu8(src);
+          const u8 b0 = next();
+          const u8 b1 = next();
 
           len = ((lo << 4) | (b0 >> 4)) + 0x11;
           disp = (((b0 & 0xF) << 8) | b1) + 1;
         } else {
-          const u8 b0 = readu8(src);
+          const u8 b0 = next();
 
           len = hi + 1;
           disp = ((lo << 8) | b0) + 1;
         }
 
-        for (u16 i = 0; i < len; ++i) {
+        if (!ok || disp > (usize)(out - dst) || len > (usize)(fin - out))
+          return false;
+
+        for (u32 i = 0; i < len; ++i) {
           *out = *(out - disp);
           out++;
         }
@@ -72,6 +99,35 @@ void decompressLZ11(FILE *src, u8 *dst, u32 dstSize) {
       flags <<= 1;
     }
   }
+
+  return ok;
+}
+
+u8 *readLZ11File(const char *filename, u32 *rawSize) {
+  ENSURE(filename != nullptr);
+  ENSURE(rawSize != nullptr);
+
+  FILE *f = fopen(filename, "rb");
+  if (f == nullptr)
+    return nullptr;
+
+  u8 header[4];
+  if (fread(header, 1, 4, f) != 4 || header[0] != 0x11) {
+    fclose(f);
+    return nullptr;
+  }
+
+  *rawSize = header[1] | header[2] << 8 | header[3] << 16;
+  u8 *raw = (u8 *)malloc(*rawSize > 0 ? *rawSize : 1);
+  ENSURE(raw != nullptr);
+  const bool ok = tryDecompressLZ11(f, raw, *rawSize);
+  fclose(f);
+
+  if (!ok) {
+    free(raw);
+    return nullptr;
+  }
+  return raw;
 }
 
 void compressLZ11(const u8 *src, u32 srcSize, FILE *dst) {
@@ -9,6 +9,13 @@ namespace rideau {
 
 u32 getLZ11RawSize(FILE *f);
 void decompressLZ11(FILE *src, u8 *dst, u32 dstSize);
+// Returns false instead of asserting if src is not LZ11, is truncated, or
+// refers outside of what it decompresses to, or if that doesn't fit in
+// dstSize
+bool tryDecompressLZ11(FILE *src, u8 *dst, u32 dstSize);
+// Decompress a whole file into a malloc'd buffer; nullptr on failure, as
+// with tryDecompressLZ11
+u8 *readLZ11File(const char *filename, u32 *rawSize);
 void compressLZ11(const u8 *src, u32 srcSize, FILE *dst);
 
 } // namespace rideau
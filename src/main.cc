@@ -9,17 +9,34 @@
 #include "imgui_impl_opengl3.h"
 #include "imgui_internal.h"
 
-#include "brstm.h"
 #include <soundio/soundio.h>
 
-#include "lz11.h"
+#include "audio_sink.h"
+#include "file_watcher.h"
+#include "guide_table.h"
+#include "history.h"
+#include "hold_lines.h"
+#include "journal.h"
+#include "onsets.h"
+#include "playback.h"
+#include "profiler.h"
+#include "render_scheduler.h"
+#include "selection.h"
+#include "simulator.h"
+#include "song.h"
+#include "spectrogram.h"
 #include "track.h"
+#include "track_file.h"
+#include "trigger_glyphs.h"
+#include "waveform.h"
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string>
+#include <string.h>
 #include <unistd.h>
 #include <vector>
 
@@ -40,217 +57,306 @@ static void glfw_error_callback(int error, const char *description) {
   fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
-static u32 g_idCounter = 1; // 0 is not assigned
-u32 genId() { return g_idCounter++; }
+// Shared by the main loop and the audio callback
+static Profiler g_profiler;
+static const char *const PROFILER_TRACE_FILE = "rideau-trace.json";
 
-void parseTrackFile(const char *filename, Track *track) {
-  ENSURE(filename != nullptr);
+// One difficulty of the song: a trigger file, and the editing state derived
+// from its triggers
+struct TrackDocument {
+  Track track;
+  std::string filename;
+  GuideTable guides;
+  HoldLines holdLines;
+  EditHistory history;
+  EditJournal journal;
+  TriggerSelection selection;
+  bool shouldSortTriggers;
+  bool trackModified;
+  bool changedOnDisk; // by another program, while there were unsaved edits
+  u64 triggersVersion; // bumped on every change to the triggers
+
+  // Call once track is filled in
+  void init(const std::string &triggerFile) {
+    filename = triggerFile;
+    sortTrack(track);
+    guides.rebuild(track);
+    holdLines.init();
+    history.init();
+    journal.init();
+    selection.init();
+    shouldSortTriggers = false;
+    trackModified = false;
+    changedOnDisk = false;
+    triggersVersion = 0;
+  }
+};
 
-  FILE *f = fopen(filename, "rb");
-  ENSURE(f != nullptr);
+// Editing session of a song.  The song, its analyses, the playback and the
+// glyphs are shared by all the difficulties; edits go to the active one.
+struct Editor {
+  Song song;
+  Playback playback;
+  WaveformPyramid waveform;
+  OnsetAnalysis onsets;
+  SpectrogramCache spectrogram;
+  TriggerGlyphs glyphs;
 
-  usize rawSize = getLZ11RawSize(f);
-  ENSURE(rawSize > 0);
-  u8 *raw = (u8 *)malloc(rawSize);
-  ENSURE(raw != nullptr);
-  decompressLZ11(f, raw, rawSize);
+  std::vector<TrackDocument> documents;
+  u32 activeDocument;
 
-  int ret = fclose(f);
-  ENSURE(ret == 0);
+  bool isSeeking;
 
-  parseTrack(raw, rawSize, track);
+  float estimatedCurrentFrame;
+  float audioLatency;
 
-  for (u32 i = 0; i < track->triggerCount; ++i)
-    track->triggers[i].id = genId();
+  // Triggers edited in place by a slider, as they were when it was grabbed
+  std::vector<Trigger> liveEditBefore; // sorted by id
+  bool isLiveEditing;
 
-  free(raw);
-}
+  EditStep editScratch;
+  std::vector<Trigger> insertScratch;
+  TriggerSelection removeScratch;
+
+  GLuint waveformTexture;
+  bool isHeadless; // no GL context, the spectrogram can't be uploaded
+
+  // Takes ownership of loadedSong
+  void init(const Song &loadedSong) {
+    waveformTexture = 0;
+    isHeadless = false;
+    documents.clear();
+    activeDocument = 0;
+    removeScratch.init();
+    isLiveEditing = false;
+    isSeeking = false;
+    estimatedCurrentFrame = 0;
+    audioLatency = 0.0f;
 
-void printTrackStats(Track &track) {
-  printf("%s\n%d ticks\n%d--%d feature zone\n%d--%d summon\n",
-         TRACK_TYPE_NAMES[track.trackType], track.tickCount,
-         track.featureZoneStart, track.featureZoneEnd, track.summonStart,
-         track.summonEnd);
+    song = loadedSong;
+    playback.init(song.samples, song.framesCount, song.sampleRate);
+    waveform.init(song.samples, song.framesCount);
+    onsets.init();
+  }
 
-  u32 triggerTypeCount[Trigger::Type::Count];
+  TrackDocument &doc() { return documents[activeDocument]; }
+  const TrackDocument &doc() const { return documents[activeDocument]; }
 
-  for (u32 i = 0; i < Trigger::Type::Count; ++i)
-    triggerTypeCount[i] = 0;
+  void switchDocument(u32 index) {
+    ENSURE(index < documents.size());
+    if (index == activeDocument)
+      return;
 
-  for (u32 i = 0; i < track.triggerCount; ++i) {
-    triggerTypeCount[track.triggers[i].type]++;
+    endLiveEdit(doc().track);
+    activeDocument = index;
+    playback.hitsounds.buildSchedule(doc().track, playback.framesCount);
   }
 
-  printf("%d triggers\n", track.triggerCount);
-  for (u32 i = 0; i < Trigger::Type::Count; ++i) {
-    printf("  %3d %s\n", triggerTypeCount[i], TRIGGER_TYPE_NAMES[i]);
+  bool isTriggerSelected(u32 triggerId) const {
+    return doc().selection.contains(triggerId);
   }
-}
 
-void writeTrackFile(Track &track, const char *filename) {
-  FILE *dst = fopen(filename, "wb");
-  ENSURE(dst != nullptr);
-
-  u32 rawSize = getTrackRawSize(track);
-  u8 *raw = (u8 *)malloc(rawSize);
-  ENSURE(raw != nullptr);
-  writeTrack(track, raw, rawSize);
+  void selectTrigger(u32 triggerId, bool append) {
+    if (!append)
+      doc().selection.clear();
+    doc().selection.add(triggerId);
+  }
 
-  compressLZ11(raw, rawSize, dst);
+  void unselectTrigger(u32 triggerId) { doc().selection.remove(triggerId); }
 
-  free(raw);
+  void unselectAllTriggers() { doc().selection.clear(); }
 
-  int ret = fclose(dst);
-  ENSURE(ret == 0);
-}
+  void markTriggersChanged() {
+    TrackDocument &d = doc();
+    ++d.triggersVersion;
+    d.trackModified = true;
+  }
 
-void resampleCubic(const s16 *samples, size_t sampleCount,
-                   float *resampledBuffer, u32 inputFreq, u32 outputFreq) {
-  const double ratio = (double)inputFreq / outputFreq;
-  double mu = 0.0;
-  float s[4] = {0, 0, 0, 0};
-
-  for (size_t i = 0; i < sampleCount; ++i) {
-    float sample = std::clamp((float)samples[i] / 32768.0f, -1.0f, 1.0f);
-
-    s[0] = s[1];
-    s[1] = s[2];
-    s[2] = s[3];
-    s[3] = sample;
-
-    while (mu <= 1.0) {
-      double A = s[3] - s[2] - s[0] + s[1];
-      double B = s[0] - s[1] - A;
-      double C = s[2] - s[0];
-      double D = s[1];
-
-      *resampledBuffer++ =
-          std::clamp(A * mu * mu * mu + B * mu * mu + C * mu + D, -1.0, 1.0);
-      mu += ratio;
-    }
+  void sortTriggers(Track &track) {
+    TrackDocument &d = doc();
+    if (!d.shouldSortTriggers)
+      return;
 
-    mu -= 1.0;
+    sortTrack(track);
+    d.guides.rebuild(track);
+    ++d.triggersVersion;
+    d.shouldSortTriggers = false;
   }
-}
 
-struct Editor {
-  std::atomic<bool> isAudioPlaying;
-  std::atomic<usize> currentFrame;
-  std::atomic<float> audioVolume;
+  void applyEdit(Track &track, const TriggerEdit &e) {
+    HitsoundMixer &hitsounds = playback.hitsounds;
 
-  std::vector<u32> selectedTriggers;
-  bool isSeeking;
-  bool shouldSortTriggers;
-  bool trackModified;
+    if (e.kind != TriggerEdit::Insert) {
+      const u32 index = findTrigger(track, e.before.tick, e.before.id);
+      ENSURE(index < track.triggerCount);
 
-  float estimatedCurrentFrame;
-  float audioLatency;
+      if (e.kind == TriggerEdit::Change && e.after.tick == e.before.tick) {
+        track.triggers[index] = e.after;
+        doc().guides.triggerChanged(track, index);
+        hitsounds.updateTrigger(e.after);
+        return;
+      }
 
-  u32 sampleRate;
-  float *samples[2];
-  usize framesCount;
+      track.triggers.erase(track.triggers.begin() + index);
+      track.triggerCount--;
+      doc().guides.triggerRemoved(track, index);
+      hitsounds.removeTrigger(e.before.id);
 
-  GLuint waveformTexture;
+      if (e.kind == TriggerEdit::Remove) {
+        doc().selection.remove(e.before.id);
+        return;
+      }
+    }
 
-  void init(Brstm *brstm) {
-    selectedTriggers.clear();
-    isSeeking = false;
-    shouldSortTriggers = false;
-    isAudioPlaying = false;
-    audioVolume = 0.5f;
-    currentFrame = 0;
-    estimatedCurrentFrame = 0;
-    trackModified = false;
+    const u32 index = getTriggerInsertIndex(track, e.after.tick);
+    track.triggers.insert(track.triggers.begin() + index, e.after);
+    track.triggerCount++;
+    doc().guides.triggerInserted(track, index);
+    hitsounds.addTrigger(e.after);
+  }
 
-    // Resample to 48000Hz float for greater backend compatibility (JACK at
-    // least doesn't want anything else)
-    sampleRate = 48000;
-    framesCount = brstm->total_samples * sampleRate / brstm->sample_rate;
-    ENSURE(brstm->num_channels == 2);
-    for (int c = 0; c < 2; ++c) {
-      samples[c] = (float *)malloc(framesCount * sizeof(float));
-      ENSURE(samples[c] != nullptr);
-      resampleCubic(brstm->PCM_samples[c], brstm->total_samples, samples[c],
-                    brstm->sample_rate, sampleRate);
+  // Apply edits to the track, keeping it sorted, and the guide table, hitsound
+  // schedule and selection in step.  A single edit is applied in place; larger
+  // steps take one pass over the triggers and rebuild the rest once.
+  void applyEdits(Track &track, const EditStep &edits) {
+    if (edits.empty())
+      return;
+
+    sortTriggers(track);
+    markTriggersChanged();
+    doc().journal.appendEdits(edits);
+
+    if (edits.size() == 1) {
+      applyEdit(track, edits[0]);
+      return;
+    }
+
+    removeScratch.clear();
+    insertScratch.clear();
+    for (const TriggerEdit &e : edits) {
+      if (e.kind != TriggerEdit::Insert)
+        removeScratch.add(e.before.id);
+      if (e.kind != TriggerEdit::Remove)
+        insertScratch.push_back(e.after);
+      else
+        doc().selection.remove(e.before.id);
     }
+
+    const auto byTick = [](const Trigger &a, const Trigger &b) {
+      return a.tick < b.tick;
+    };
+
+    auto end = std::remove_if(
+        track.triggers.begin(), track.triggers.end(),
+        [&](const Trigger &t) { return removeScratch.contains(t.id); });
+    track.triggers.erase(end, track.triggers.end());
+
+    std::stable_sort(insertScratch.begin(), insertScratch.end(), byTick);
+    const usize kept = track.triggers.size();
+    track.triggers.insert(track.triggers.end(), insertScratch.begin(),
+                          insertScratch.end());
+    std::inplace_merge(track.triggers.begin(), track.triggers.begin() + kept,
+                       track.triggers.end(), byTick);
+    track.triggerCount = track.triggers.size();
+
+    doc().guides.rebuild(track);
+    playback.hitsounds.buildSchedule(track, playback.framesCount);
   }
 
-  bool isTriggerSelected(u32 triggerId) const {
-    return std::find(selectedTriggers.begin(), selectedTriggers.end(),
-                     triggerId) != selectedTriggers.end();
+  // Apply a step and record it for undo
+  void edit(Track &track, EditStep &&step) {
+    applyEdits(track, step);
+    doc().history.push(std::move(step));
   }
 
-  void selectTrigger(u32 triggerId, bool append) {
-    if (!append)
-      selectedTriggers.clear();
-    selectedTriggers.push_back(triggerId);
+  void undo(Track &track) {
+    endLiveEdit(track);
+    if (doc().history.undo(&editScratch))
+      applyEdits(track, editScratch);
   }
 
-  void unselectTrigger(u32 triggerId) {
-    auto it =
-        std::find(selectedTriggers.begin(), selectedTriggers.end(), triggerId);
-    if (it != selectedTriggers.end())
-      selectedTriggers.erase(it);
+  void redo(Track &track) {
+    endLiveEdit(track);
+    if (doc().history.redo(&editScratch))
+      applyEdits(track, editScratch);
   }
 
-  void unselectAllTriggers() { selectedTriggers.clear(); }
+  // Sliders edit the selected triggers in place while dragged, and are
+  // recorded as a single step when released
+  void beginLiveEdit(const Track &track) {
+    if (isLiveEditing)
+      return;
+    isLiveEditing = true;
+
+    liveEditBefore.clear();
+    for (const Trigger &t : track.triggers) {
+      if (doc().selection.contains(t.id))
+        liveEditBefore.push_back(t);
+    }
+    std::sort(liveEditBefore.begin(), liveEditBefore.end(),
+              [](const Trigger &a, const Trigger &b) { return a.id < b.id; });
+  }
+
+  void endLiveEdit(const Track &track) {
+    if (!isLiveEditing)
+      return;
+    isLiveEditing = false;
+
+    EditStep step;
+    for (const Trigger &t : track.triggers) {
+      if (!doc().selection.contains(t.id))
+        continue;
+
+      auto before = std::lower_bound(
+          liveEditBefore.begin(), liveEditBefore.end(), t.id,
+          [](const Trigger &a, u32 id) { return a.id < id; });
+      if (before == liveEditBefore.end() || before->id != t.id)
+        continue;
+
+      if (before->tick != t.tick || before->type != t.type ||
+          before->x != t.x || before->y != t.y || before->angle != t.angle ||
+          before->flags != t.flags)
+        step.push_back(TriggerEdit::change(*before, t));
+    }
+    doc().journal.appendEdits(step);
+    doc().history.push(std::move(step));
+  }
 
   void initWaveformTexture() {
     const u32 texWidth = 32;
-    const u32 texHeight = 8192;
+    const u32 texHeight = song.waveformRows;
     u8 *texData = (u8 *)malloc(texWidth * texHeight * 3);
     ENSURE(texData != nullptr);
     u8 *pData = texData;
 
     {
-      ASSERT(texWidth < framesCount);
-      const double texelPerFrame = (double)texHeight / framesCount;
-      double t = 0;
-      size_t frameIdx = 0;
-
       const u8 bgColor[3] = {44, 51, 56};
       const u8 waveformColor[3] = {77, 124, 160};
 
+      // Every row is a span of waveform over background: copy from prefilled
+      // rows rather than writing texels one by one
+      u8 bgRow[texWidth * 3];
+      u8 waveformRow[texWidth * 3];
+      for (u32 x = 0; x < texWidth; ++x) {
+        memcpy(bgRow + x * 3, bgColor, 3);
+        memcpy(waveformRow + x * 3, waveformColor, 3);
+      }
+
       for (u32 y = 0; y < texHeight; ++y) {
-        float minSample = +1.0f;
-        float maxSample = -1.0f;
-        while (t < 1.0) {
-          if (frameIdx < framesCount) {
-            const float left = samples[0][frameIdx];
-            const float right = samples[1][frameIdx++];
-            const float sample = std::clamp((left + right) / 2.0f, -1.0f, 1.0f);
-            minSample = std::min(minSample, sample);
-            maxSample = std::max(maxSample, sample);
-          } else {
-            minSample = maxSample = 0;
-            break;
-          }
-          t += texelPerFrame;
-        }
-        t -= 1.0;
+        const float minSample = song.waveform[2 * y];
+        const float maxSample = song.waveform[2 * y + 1];
 
         u32 lineStart = (minSample + 1.0f) / 2.0f * texWidth;
         u32 lineEnd = (maxSample + 1.0f) / 2.0f * texWidth;
-
-        u32 x = 0;
-        while (x < lineStart) {
-          *pData++ = bgColor[0];
-          *pData++ = bgColor[1];
-          *pData++ = bgColor[2];
-          ++x;
-        }
-        while (x < lineEnd) {
-          *pData++ = waveformColor[0];
-          *pData++ = waveformColor[1];
-          *pData++ = waveformColor[2];
-          ++x;
-        }
-        while (x < texWidth) {
-          *pData++ = bgColor[0];
-          *pData++ = bgColor[1];
-          *pData++ = bgColor[2];
-          ++x;
-        }
+        lineEnd = std::min(lineEnd, texWidth);
+        lineStart = std::min(lineStart, lineEnd);
+
+        memcpy(pData, bgRow, lineStart * 3);
+        memcpy(pData + lineStart * 3, waveformRow + lineStart * 3,
+               (lineEnd - lineStart) * 3);
+        memcpy(pData + lineEnd * 3, bgRow + lineEnd * 3,
+               (texWidth - lineEnd) * 3);
+        pData += texWidth * 3;
       }
     }
 
@@ -268,77 +374,309 @@ struct Editor {
   }
 
   void deinit() {
-    for (int i = 0; i < 2; ++i) {
-      free(samples[i]);
-      samples[i] = nullptr;
-    }
+    spectrogram.deinit();
+    waveform.deinit();
+    playback.deinit();
+    freeSong(&song);
 
     glDeleteTextures(1, &waveformTexture);
   }
 
+  // Fix tickCount to the song length.  Returns whether track changed.
+  bool fixTickCount(Track &track) const {
+    return rideau::fixTickCount(track, playback.framesCount,
+                                playback.sampleRate);
+  }
+
+  // Reduce the waveform lane and detect onsets in the background
+  void analyzeSong(ThreadPool *pool) {
+    waveform.build(pool);
+    const float ticksPerFrame =
+        (float)doc().track.tickCount / playback.framesCount;
+    pool->submit([this, pool, ticksPerFrame] {
+      onsets.analyze(song.samples, song.framesCount, song.sampleRate,
+                     ticksPerFrame, pool);
+    });
+  }
+
+  // Swap in the song decoded again, keeping the position, volume, speed and
+  // hitsounds.  Call with the audio sink closed; takes ownership of newSong.
+  void replaceSong(const Song &newSong, ThreadPool *pool) {
+    // Jobs read the old samples
+    pool->waitIdle();
+
+    const usize frame = playback.currentFrame;
+    const float volume = playback.volume;
+    const float speed = playback.speed;
+    const bool hitsoundsEnabled = playback.hitsounds.enabled;
+
+    spectrogram.deinit();
+    waveform.deinit();
+    playback.deinit();
+    freeSong(&song);
+
+    song = newSong;
+    playback.init(song.samples, song.framesCount, song.sampleRate);
+    playback.volume = volume;
+    playback.speed = speed;
+    playback.hitsounds.enabled = hitsoundsEnabled;
+    waveform.init(song.samples, song.framesCount);
+    onsets.init();
+
+    for (TrackDocument &d : documents) {
+      if (fixTickCount(d.track)) {
+        ++d.triggersVersion;
+        d.trackModified = true;
+      }
+    }
+    playback.hitsounds.buildSchedule(doc().track, playback.framesCount);
+    seekTo(std::min(frame, song.framesCount));
+
+    if (!isHeadless) {
+      glDeleteTextures(1, &waveformTexture);
+      initWaveformTexture();
+      spectrogram.init(song.samples, song.framesCount, song.sampleRate, pool);
+    }
+    analyzeSong(pool);
+  }
+
+  // Read a document's file again after another program wrote it.  Triggers
+  // that didn't change keep their ids, and so their selection.  Unsaved edits
+  // are kept, and the document flagged, unless force is set.
+  void reloadDocument(u32 index, bool force) {
+    TrackDocument &d = documents[index];
+
+    // Being replaced: the rename is reported next
+    if (access(d.filename.c_str(), R_OK) != 0)
+      return;
+
+    // Whatever another program left there, e.g. half a save
+    Track reloaded;
+    u32 triggerIndex;
+    const char *error = "not a trigger file";
+    if (tryParseTrackFile(d.filename.c_str(), &reloaded))
+      error = findTrackError(reloaded, &triggerIndex);
+    if (error != nullptr) {
+      fprintf(stderr, "Cannot reload %s, keeping the current track: %s\n",
+              d.filename.c_str(), error);
+      return;
+    }
+    sortTrack(reloaded);
+    const bool tickCountFixed = fixTickCount(reloaded);
+
+    // Our own save, or changed back
+    if (isSameTrack(reloaded, d.track)) {
+      d.changedOnDisk = false;
+      return;
+    }
+
+    if (d.trackModified && !force) {
+      if (!d.changedOnDisk) {
+        fprintf(stderr, "%s changed on disk, keeping unsaved edits\n",
+                d.filename.c_str());
+        // The journal applies to the old contents: start over from ours
+        d.journal.reset(d.track, true);
+      }
+      d.changedOnDisk = true;
+      return;
+    }
+
+    if (index == activeDocument)
+      endLiveEdit(d.track);
+
+    // Match unchanged triggers tick by tick
+    std::vector<Trigger> previous = d.track.triggers;
+    std::stable_sort(
+        previous.begin(), previous.end(),
+        [](const Trigger &a, const Trigger &b) { return a.tick < b.tick; });
+    std::vector<bool> matched(previous.size(), false);
+    usize first = 0;
+    for (Trigger &t : reloaded.triggers) {
+      while (first < previous.size() && previous[first].tick < t.tick)
+        ++first;
+      for (usize i = first;
+           i < previous.size() && previous[i].tick == t.tick; ++i) {
+        if (!matched[i] && isSameTrigger(previous[i], t)) {
+          t.id = previous[i].id;
+          matched[i] = true;
+          break;
+        }
+      }
+    }
+
+    TriggerSelection selection;
+    selection.init();
+    for (const Trigger &t : reloaded.triggers) {
+      if (d.selection.contains(t.id))
+        selection.add(t.id);
+    }
+
+    d.track = std::move(reloaded);
+    d.selection = std::move(selection);
+    d.guides.rebuild(d.track);
+    d.history.init();
+    d.journal.reset(d.track, false);
+    d.shouldSortTriggers = false;
+    d.trackModified = tickCountFixed;
+    d.changedOnDisk = false;
+    ++d.triggersVersion;
+
+    if (index == activeDocument)
+      playback.hitsounds.buildSchedule(d.track, playback.framesCount);
+    printf("Reloaded %s\n", d.filename.c_str());
+  }
+
+  void saveDocument() {
+    TrackDocument &d = doc();
+
+    // Save anyway, charts are often saved half done
+    Simulation simulation;
+    simulateTrack(d.track, &simulation);
+    for (const SimulationIssue &issue : simulation.issues)
+      fprintf(stderr, "%s: trigger at tick %u: %s\n", d.filename.c_str(),
+              d.track.triggers[issue.triggerIndex].tick, issue.reason);
+
+    writeTrackFile(d.track, d.filename.c_str());
+    d.trackModified = false;
+    d.journal.reset(d.track, false);
+  }
+
   void seekTo(usize frame) {
-    currentFrame = frame;
-    estimatedCurrentFrame = frame - audioLatency * sampleRate;
+    playback.currentFrame = frame;
+    estimatedCurrentFrame =
+        frame - audioLatency * playback.sampleRate * playback.speed;
   }
 
   void togglePause() {
-    isAudioPlaying = !isAudioPlaying;
-    if (isAudioPlaying && currentFrame >= framesCount)
+    playback.isPlaying = !playback.isPlaying;
+    if (playback.isPlaying && playback.currentFrame >= playback.framesCount)
       seekTo(0);
   }
+
+  void setLoopPoint(bool isEnd) {
+    const usize frame =
+        std::clamp(estimatedCurrentFrame, 0.0f, (float)playback.framesCount);
+    if (isEnd)
+      playback.loopEnd = frame;
+    else
+      playback.loopStart = frame;
+
+    if (playback.loopStart > playback.loopEnd) {
+      const usize start = playback.loopEnd;
+      playback.loopEnd = playback.loopStart.load();
+      playback.loopStart = start;
+    }
+  }
 };
 
-u8 parseBRSTM(const char *filename, Brstm *brstm) {
-  ENSURE(filename != nullptr);
-  ENSURE(brstm != nullptr);
+void audioCallback(struct SoundIoOutStream *outstream, int frame_count_min,
+                   int frame_count_max);
+void audioUnderflowCallback(struct SoundIoOutStream *outstream);
+
+// Plays through the default libsoundio output device
+struct SoundIoAudioSink : AudioSink {
+  struct SoundIo *soundio = nullptr;
+  struct SoundIoDevice *device = nullptr;
+  struct SoundIoOutStream *outstream = nullptr;
+
+  float mixBuffer[2][MIX_CHUNK_FRAMES]; // used by the audio thread only
+
+  bool open(Playback *p) override {
+    ENSURE(p != nullptr);
+    playback = p;
+
+    int err;
+    soundio = soundio_create();
+    if (!soundio) {
+      fprintf(stderr, "out of memory\n");
+      return false;
+    }
 
-  brstm_init(brstm);
+    if ((err = soundio_connect(soundio))) {
+      fprintf(stderr, "error connecting: %s\n", soundio_strerror(err));
+      return false;
+    }
 
-  u8 *raw;
-  {
-    FILE *f = fopen(filename, "rb");
-    ENSURE(f != nullptr);
+    soundio_flush_events(soundio);
 
-    int ret = fseek(f, 0, SEEK_END);
-    ENSURE(ret == 0);
-    long fileSize = ftell(f);
-    ENSURE(fileSize > 0);
+    int default_out_device_index = soundio_default_output_device_index(soundio);
+    if (default_out_device_index < 0) {
+      fprintf(stderr, "no output device found\n");
+      return false;
+    }
 
-    raw = (u8 *)malloc(fileSize);
-    ENSURE(raw != nullptr);
+    device = soundio_get_output_device(soundio, default_out_device_index);
+    if (!device) {
+      fprintf(stderr, "out of memory\n");
+      return false;
+    }
 
-    ret = fseek(f, 0, SEEK_SET);
-    ENSURE(ret == 0);
-    size_t readSize = fread(raw, sizeof(u8), fileSize, f);
-    ENSURE(readSize == (size_t)fileSize);
+    outstream = soundio_outstream_create(device);
+    outstream->sample_rate = playback->sampleRate;
+    outstream->format = SoundIoFormatFloat32LE;
+    outstream->software_latency = 0.100;
+    outstream->write_callback = audioCallback;
+    outstream->underflow_callback = audioUnderflowCallback;
+    outstream->userdata = this;
+
+    if (!soundio_device_supports_format(device, outstream->format) ||
+        !soundio_device_supports_sample_rate(device, outstream->sample_rate)) {
+      fprintf(stderr, "output device doesn't support %uHz float32\n",
+              playback->sampleRate);
+      return false;
+    }
+
+    if ((err = soundio_outstream_open(outstream))) {
+      fprintf(stderr, "unable to open device: %s\n", soundio_strerror(err));
+      return false;
+    }
 
-    ret = fclose(f);
-    ENSURE(ret == 0);
+    if (outstream->layout_error)
+      fprintf(stderr, "unable to set channel layout: %s\n",
+              soundio_strerror(outstream->layout_error));
+
+    if ((err = soundio_outstream_start(outstream))) {
+      fprintf(stderr, "unable to start device: %s\n", soundio_strerror(err));
+      return false;
+    }
+
+    return true;
   }
 
-  u8 ret = brstm_read(brstm, raw, 0, 1);
-  free(raw);
+  void close() override {
+    if (outstream)
+      soundio_outstream_destroy(outstream);
+    if (device)
+      soundio_device_unref(device);
+    if (soundio)
+      soundio_destroy(soundio);
+    outstream = nullptr;
+    device = nullptr;
+    soundio = nullptr;
+  }
 
-  return ret;
-}
+  bool isRealtime() const override { return true; }
+  float latency() const override { return outstream->software_latency; }
+};
 
 void audioCallback(struct SoundIoOutStream *outstream, int frame_count_min,
                    int frame_count_max) {
   UNUSED(frame_count_min);
+  ProfileZone zone(g_profiler, Profiler::AudioThread,
+                   Profiler::AudioCallback);
+
+  const auto callbackStart = std::chrono::steady_clock::now();
 
   const struct SoundIoChannelLayout *layout = &outstream->layout;
-  Editor *editor = (Editor *)outstream->userdata;
-  const bool isPlaying = editor->isAudioPlaying;
+  SoundIoAudioSink *sink = (SoundIoAudioSink *)outstream->userdata;
+  Playback *playback = sink->playback;
   struct SoundIoChannelArea *areas;
   int frames_left = frame_count_max;
   int err;
 
-  const usize framesCount = editor->framesCount;
-  usize currentFrame = editor->currentFrame;
-  float **inputSamples = editor->samples;
-  const float volume = editor->audioVolume;
+  float *mix[2] = {sink->mixBuffer[0], sink->mixBuffer[1]};
 
-  while (frames_left > 0 && currentFrame < framesCount) {
+  while (frames_left > 0) {
     int frame_count = frames_left;
 
     err = soundio_outstream_begin_write(outstream, &areas, &frame_count);
@@ -347,23 +685,18 @@ void audioCallback(struct SoundIoOutStream *outstream, int frame_count_min,
     if (!frame_count)
       break;
 
-    for (int frame = 0; frame < frame_count; ++frame) {
+    for (int offset = 0; offset < frame_count; offset += MIX_CHUNK_FRAMES) {
+      const u32 chunkFrames =
+          std::min((u32)(frame_count - offset), MIX_CHUNK_FRAMES);
+
+      renderPlayback(playback, mix, chunkFrames);
+
       for (int channel = 0; channel < layout->channel_count; ++channel) {
-        float sample;
-        if (isPlaying) {
-          sample = inputSamples[channel][currentFrame];
-          sample *= volume;
-        } else {
-          sample = 0;
-        }
-        float *ptr =
-            (float *)(areas[channel].ptr + areas[channel].step * frame);
-        *ptr = sample;
-      }
-      if (isPlaying) {
-        currentFrame++;
-        if (currentFrame == framesCount) {
-          editor->isAudioPlaying = false;
+        const float *src = mix[channel % 2];
+        for (u32 i = 0; i < chunkFrames; ++i) {
+          float *ptr = (float *)(areas[channel].ptr +
+                                 areas[channel].step * (offset + i));
+          *ptr = src[i];
         }
       }
     }
@@ -374,82 +707,14 @@ void audioCallback(struct SoundIoOutStream *outstream, int frame_count_min,
     frames_left -= frame_count;
   }
 
-  editor->currentFrame = currentFrame;
+  const std::chrono::duration<float, std::micro> elapsedUs =
+      std::chrono::steady_clock::now() - callbackStart;
+  playback->measureLoad(elapsedUs.count(), frame_count_max - frames_left);
 }
 
-struct AudioStuff {
-  struct SoundIo *soundio;
-  struct SoundIoDevice *device;
-  struct SoundIoOutStream *outstream;
-};
-
-int initAudio(int sampleRate, Editor *editor, AudioStuff &audio) {
-  ENSURE(editor != nullptr);
-
-  int err;
-  struct SoundIo *soundio = soundio_create();
-  if (!soundio) {
-    fprintf(stderr, "out of memory\n");
-    return 1;
-  }
-
-  if ((err = soundio_connect(soundio))) {
-    fprintf(stderr, "error connecting: %s", soundio_strerror(err));
-    return 1;
-  }
-
-  soundio_flush_events(soundio);
-
-  int default_out_device_index = soundio_default_output_device_index(soundio);
-  if (default_out_device_index < 0) {
-    fprintf(stderr, "no output device found");
-    return 1;
-  }
-
-  struct SoundIoDevice *device =
-      soundio_get_output_device(soundio, default_out_device_index);
-  if (!device) {
-    fprintf(stderr, "out of memory");
-    return 1;
-  }
-
-  struct SoundIoOutStream *outstream = soundio_outstream_create(device);
-  outstream->sample_rate = sampleRate;
-  outstream->format = SoundIoFormatFloat32LE;
-  outstream->software_latency = 0.100;
-  outstream->write_callback = audioCallback;
-  outstream->userdata = editor;
-
-  ENSURE(soundio_device_supports_format(device, outstream->format));
-  ENSURE(soundio_device_supports_sample_rate(device, outstream->sample_rate));
-
-  if ((err = soundio_outstream_open(outstream))) {
-    fprintf(stderr, "unable to open device: %s", soundio_strerror(err));
-    return 1;
-  }
-
-  editor->audioLatency = outstream->software_latency;
-
-  if (outstream->layout_error)
-    fprintf(stderr, "unable to set channel layout: %s\n",
-            soundio_strerror(outstream->layout_error));
-
-  if ((err = soundio_outstream_start(outstream))) {
-    fprintf(stderr, "unable to start device: %s", soundio_strerror(err));
-    return 1;
-  }
-
-  audio.outstream = outstream;
-  audio.device = device;
-  audio.soundio = soundio;
-
-  return 0;
-}
-
-void deinitAudio(AudioStuff &audio) {
-  soundio_outstream_destroy(audio.outstream);
-  soundio_device_unref(audio.device);
-  soundio_destroy(audio.soundio);
+void audioUnderflowCallback(struct SoundIoOutStream *outstream) {
+  SoundIoAudioSink *sink = (SoundIoAudioSink *)outstream->userdata;
+  sink->playback->underflows++;
 }
 
 enum KeyState {
@@ -471,7 +736,9 @@ static void clearKeys() {
 static void updateKeys(GLFWwindow *window) {
   const int usefulKeys[] = {GLFW_KEY_ESCAPE, GLFW_KEY_SPACE,
                             GLFW_KEY_LEFT_SHIFT, GLFW_KEY_LEFT_CONTROL,
-                            GLFW_KEY_S};
+                            GLFW_KEY_S, GLFW_KEY_Y, GLFW_KEY_Z,
+                            GLFW_KEY_F3, GLFW_KEY_F4,
+                            GLFW_KEY_1, GLFW_KEY_2, GLFW_KEY_3};
 
   for (size_t i = 0; i < ARRAY_SIZE(usefulKeys); ++i) {
     int key = usefulKeys[i];
@@ -499,9 +766,9 @@ static KeyState getKey(int key) {
 }
 
 void drawTrack(Track &track, Editor &editor) {
+  Playback &playback = editor.playback;
 
   const float triggerRadius = 10.0f;
-  const float scaleX = 4.0f;
   const ImColor touchTriggerColor(0.8f, 0.2f, 0.2f);
   const ImColor touchTriggerColorTransparent(0.8f, 0.2f, 0.2f, 0.5f);
   const ImColor slideTriggerColor(0.8f, 0.8f, 0.2f);
@@ -510,9 +777,14 @@ void drawTrack(Track &track, Editor &editor) {
   const ImColor holdLineColor(0.15f, 0.5f, 0.15f);
   const ImColor featureZoneColor(0.2f, 0.3f, 0.7f, 0.2f);
   const ImColor summonColor(0.7f, 0.6f, 0.2f, 0.2f);
+  const ImColor loopColor(0.9f, 0.9f, 0.9f, 0.15f);
   const ImColor trackGuideColor(0.9f, 0.9f, 0.9f);
   const ImColor currentlyPlayingColor(1.0f, 1.0f, 1.0f);
   const ImColor unknownColor(0.8f, 0.2f, 0.8f);
+  const ImColor waveformColor(77, 124, 160);
+  const ImColor waveformRmsColor(120, 170, 210);
+  const ImColor beatGridColor(0.9f, 0.9f, 0.9f, 0.12f);
+  const ImColor onsetColor(1.0f, 0.6f, 0.2f);
 
   // Audio scrub zone
   {
@@ -551,10 +823,20 @@ void drawTrack(Track &track, Editor &editor) {
             ImVec2(windowWidth - track.summonEnd * pixelsPerTick, windowHeight),
         summonColor);
 
+    // Loop region
+    if (playback.hasLoopRegion()) {
+      const float framesToPixels = windowWidth / (float)playback.framesCount;
+      drawList->AddRectFilled(
+          orig + ImVec2(windowWidth - playback.loopStart * framesToPixels, 0),
+          orig + ImVec2(windowWidth - playback.loopEnd * framesToPixels,
+                        windowHeight),
+          loopColor);
+    }
+
     // Cursor
     {
       const float scrubPos =
-          (1.0f - ((float)editor.estimatedCurrentFrame / editor.framesCount)) *
+          (1.0f - (editor.estimatedCurrentFrame / playback.framesCount)) *
           windowWidth;
       const int x = roundf(scrubPos);
 
@@ -566,7 +848,7 @@ void drawTrack(Track &track, Editor &editor) {
     if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(0)) {
       ImVec2 mouseRelPos = ImGui::GetMousePos() - orig;
       const usize seekFrame =
-          (1.0f - (mouseRelPos.x / windowWidth)) * editor.framesCount;
+          (1.0f - (mouseRelPos.x / windowWidth)) * playback.framesCount;
       editor.seekTo(seekFrame);
       editor.isSeeking = true;
     }
@@ -574,10 +856,11 @@ void drawTrack(Track &track, Editor &editor) {
     ImGui::EndChild();
   }
 
-  const float ticksPerFrame = (float)track.tickCount / editor.framesCount;
+  const float ticksPerFrame = (float)track.tickCount / playback.framesCount;
   const float currentTick = editor.estimatedCurrentFrame * ticksPerFrame;
 
   if (track.isEMS()) {
+    ProfileZone zone(g_profiler, Profiler::MainThread, Profiler::DrawTrackEms);
     static float scale = 0.5f;
     ImGui::SliderFloat("Scale", &scale, -2.0f, 2.0f);
 
@@ -597,6 +880,10 @@ void drawTrack(Track &track, Editor &editor) {
     ImGui::PopStyleColor();
     ImGui::PopStyleVar();
 
+    // The view scrolls by ticks
+    if (playback.isPlaying || editor.isSeeking)
+      ImGui::SetScrollX(currentTick);
+
     ImDrawList *drawList = ImGui::GetWindowDrawList();
 
     const ImGuiWindow *window = ImGui::GetCurrentWindow();
@@ -611,14 +898,31 @@ void drawTrack(Track &track, Editor &editor) {
 
     orig.x += currentScrollTick;
 
+    TriggerGlyphs &glyphs = editor.glyphs;
+    const GuideTable &guides = editor.doc().guides;
     ImVec2 prevHoldTriggerPos;
     bool hasPrevHoldTrigger = false;
 
-    for (u32 i = 0; i < track.triggerCount; ++i) {
+    // Triggers are sorted by tick and guides come from the guide table, so
+    // only the visible triggers are visited
+    const auto byTick = [](const Trigger &t, u32 tick) {
+      return t.tick < tick;
+    };
+    const u32 firstVisible =
+        std::lower_bound(track.triggers.begin(), track.triggers.end(),
+                         tickStart, byTick) -
+        track.triggers.begin();
+    const auto guidePos = [&](u32 guide) {
+      ENSURE(guide != GuideTable::NO_GUIDE);
+      const Trigger &g = track.triggers[guide];
+      return ImVec2(orig.x + 200 + g.x, orig.y + 100 - g.y);
+    };
+
+    for (u32 i = firstVisible; i < track.triggerCount; ++i) {
       const Trigger &t = track.triggers[i];
 
-      if (t.tick < tickStart || t.tick > tickEnd)
-        continue;
+      if (t.tick > tickEnd)
+        break;
 
       ImColor col;
       if (t.type == Trigger::Touch)
@@ -639,61 +943,40 @@ void drawTrack(Track &track, Editor &editor) {
         triggerX = t.x;
         triggerY = t.y;
       } else {
-        Trigger *prevTrackGuide = nullptr;
-        for (int j = i - 1; j >= 0; --j) {
-          if (track.triggers[j].type == Trigger::TrackGuide) {
-            prevTrackGuide = &track.triggers[j];
-            break;
-          }
-        }
-        ENSURE(prevTrackGuide != nullptr);
-
-        Trigger *nextTrackGuide = nullptr;
-        for (u32 j = i + 1; j < track.triggerCount; ++j) {
-          if (track.triggers[j].type == Trigger::TrackGuide) {
-            nextTrackGuide = &track.triggers[j];
-            break;
-          }
-        }
-        ENSURE(nextTrackGuide != nullptr);
-
-        const float r = float(t.tick - prevTrackGuide->tick) /
-                        (nextTrackGuide->tick - prevTrackGuide->tick);
-        triggerX = ImLerp(prevTrackGuide->x, nextTrackGuide->x, r);
-        triggerY = ImLerp(prevTrackGuide->y, nextTrackGuide->y, r);
+        const u32 prevGuide = guides.prevGuide(i);
+        const u32 nextGuide = guides.nextGuide(i);
+        ENSURE(prevGuide != GuideTable::NO_GUIDE);
+        ENSURE(nextGuide != GuideTable::NO_GUIDE);
+
+        const Trigger &prevTrackGuide = track.triggers[prevGuide];
+        const Trigger &nextTrackGuide = track.triggers[nextGuide];
+        const float r = guides.segments[i].r;
+        triggerX = ImLerp(prevTrackGuide.x, nextTrackGuide.x, r);
+        triggerY = ImLerp(prevTrackGuide.y, nextTrackGuide.y, r);
       }
 
       const int posy = orig.y + 100 - triggerY;
       const int posx = orig.x + 200 + triggerX;
 
       // Draw track guide
-      if (t.type == Trigger::TrackGuide) {
-        Trigger *prevTrackGuide = nullptr;
-        for (int j = i - 1; j >= 0; --j) {
-          if (track.triggers[j].type == Trigger::TrackGuide) {
-            prevTrackGuide = &track.triggers[j];
-            break;
-          }
-        }
-        if (prevTrackGuide != nullptr) {
-          const ImVec2 prev = ImVec2(orig.x + 200 + prevTrackGuide->x,
-                                     orig.y + 100 - prevTrackGuide->y);
-          const ImVec2 pos = ImVec2(posx, posy);
-
-          if (prevTrackGuide->flags & Trigger::Flag::CurveInward ||
-              prevTrackGuide->flags & Trigger::Flag::CurveOutward) {
-            const ImVec2 v0 = prev;
-            const ImVec2 v1 = pos;
-            const ImVec2 normal =
-                ImRotate((v1 - v0), cosf(IM_PI / 2), sinf(IM_PI / 2));
-            const float reverse =
-                prevTrackGuide->flags & Trigger::Flag::CurveInward ? -1.0f
-                                                                   : 1.0f;
-            const ImVec2 cp = v0 + (v1 - v0) / 2 + (normal * scale * reverse);
-            drawList->AddBezierQuadratic(v0, cp, v1, trackGuideColor, 1.0f, 0);
-          } else {
-            drawList->AddLine(prev, pos, trackGuideColor, 1.0f);
-          }
+      const u32 prevGuide = guides.prevGuide(i);
+      if (t.type == Trigger::TrackGuide && prevGuide != GuideTable::NO_GUIDE) {
+        const Trigger &prevTrackGuide = track.triggers[prevGuide];
+        const ImVec2 prev = guidePos(prevGuide);
+        const ImVec2 pos = ImVec2(posx, posy);
+
+        if (prevTrackGuide.flags & Trigger::Flag::CurveInward ||
+            prevTrackGuide.flags & Trigger::Flag::CurveOutward) {
+          const ImVec2 v0 = prev;
+          const ImVec2 v1 = pos;
+          const ImVec2 normal =
+              ImRotate((v1 - v0), cosf(IM_PI / 2), sinf(IM_PI / 2));
+          const float reverse =
+              prevTrackGuide.flags & Trigger::Flag::CurveInward ? -1.0f : 1.0f;
+          const ImVec2 cp = v0 + (v1 - v0) / 2 + (normal * scale * reverse);
+          drawList->AddBezierQuadratic(v0, cp, v1, trackGuideColor, 1.0f, 0);
+        } else {
+          drawList->AddLine(prev, pos, trackGuideColor, 1.0f);
         }
       }
 
@@ -701,8 +984,8 @@ void drawTrack(Track &track, Editor &editor) {
       if (hasPrevHoldTrigger && !hideTriggers &&
           (t.type == Trigger::HoldEnd || t.type == Trigger::HoldEndSlide ||
            t.type == Trigger::Holdlet)) {
-        drawList->AddLine(prevHoldTriggerPos, ImVec2(posx, posy), holdLineColor,
-                          10.0f);
+        glyphs.addLine(prevHoldTriggerPos, ImVec2(posx, posy), 10.0f,
+                       holdLineColor);
       }
       if (t.type == Trigger::Hold || t.type == Trigger::HoldEnd ||
           t.type == Trigger::HoldEndSlide || t.type == Trigger::Holdlet) {
@@ -717,35 +1000,27 @@ void drawTrack(Track &track, Editor &editor) {
       else if (t.type == Trigger::TrackGuide)
         radius = 3.0f;
 
+      const ImVec2 pos = ImVec2(posx, posy);
       if (t.type == Trigger::TrackGuide) {
-        drawList->AddCircleFilled(ImVec2(posx, posy), radius, col);
+        glyphs.add(TriggerGlyphs::Dot, pos, col);
       } else {
         if (hideTriggers)
           continue;
 
-        if (t.type == Trigger::Holdlet || t.type == Trigger::HoldEnd ||
-            t.type == Trigger::HoldEndSlide)
-          drawList->AddCircleFilled(ImVec2(posx, posy), radius, col);
+        if (t.type == Trigger::Holdlet)
+          glyphs.add(TriggerGlyphs::SmallDisc, pos, col);
+        else if (t.type == Trigger::HoldEnd || t.type == Trigger::HoldEndSlide)
+          glyphs.add(TriggerGlyphs::Disc, pos, col);
         else
-          drawList->AddCircle(ImVec2(posx, posy), radius, col, 0, 8.0f);
+          glyphs.add(TriggerGlyphs::Ring, pos, col);
       }
 
       // Draw slide direction
       // FIXME: in EMS, angle is automatic unless the absolute angle flag is
       // set
       if (t.type == Trigger::Slide || t.type == Trigger::HoldEndSlide) {
-        Trigger *nextTrackGuide = nullptr;
-        for (u32 j = i + 1; j < track.triggerCount; ++j) {
-          if (track.triggers[j].type == Trigger::TrackGuide) {
-            nextTrackGuide = &track.triggers[j];
-            break;
-          }
-        }
-        ENSURE(nextTrackGuide != nullptr);
-
-        const ImVec2 vec = ImVec2(orig.x + 200 + nextTrackGuide->x,
-                                  orig.y + 100 - nextTrackGuide->y) -
-                           ImVec2(posx, posy);
+        const ImVec2 vec =
+            guidePos(guides.nextGuide(i)) - ImVec2(posx, posy);
 
         float a;
         if (t.flags & Trigger::Flag::AbsoluteAngle) {
@@ -755,8 +1030,8 @@ void drawTrack(Track &track, Editor &editor) {
         }
         const ImVec2 center = ImVec2(posx, posy);
         const ImVec2 dir = ImRotate(ImVec2(12.0f, 0.0f), cosf(a), sinf(a));
-        drawList->AddCircleFilled(center + dir, 5.0f,
-                                  ImColor(1.0f, 1.0f, 1.0f));
+        glyphs.add(TriggerGlyphs::SmallDisc, center + dir,
+                   ImColor(1.0f, 1.0f, 1.0f));
       }
 
       // Tooltip
@@ -781,10 +1056,39 @@ void drawTrack(Track &track, Editor &editor) {
       }
     }
 
+    glyphs.flush(drawList);
     ImGui::EndChild();
   } else {
+    ProfileZone zone(g_profiler, Profiler::MainThread, Profiler::DrawTrackBms);
+    const float snapDistance = 8.0f; // pixels
+    static bool showBeatGrid = true;
+    static bool showOnsets = true;
+    static bool snapToOnsets = false;
+    static bool showSpectrogram = true;
+    const bool hasOnsets = editor.onsets.isReady;
+
+    ImGui::Checkbox("Beat grid", &showBeatGrid);
+    ImGui::SameLine();
+    ImGui::Checkbox("Onsets", &showOnsets);
+    ImGui::SameLine();
+    ImGui::Checkbox("Snap", &snapToOnsets);
+    ImGui::SameLine();
+    ImGui::Checkbox("Spectrogram", &showSpectrogram);
+    ImGui::SameLine();
+    if (hasOnsets)
+      ImGui::Text("%.1f BPM, %zu onsets (%.0fms)", editor.onsets.bpm,
+                  editor.onsets.onsets.size(), editor.onsets.analysisMs);
+    else
+      ImGui::TextDisabled("Analyzing...");
+
+    // Pixels per tick
+    static float scaleX = 4.0f;
+    const float prevScaleX = scaleX;
+    ImGui::SliderFloat("Zoom", &scaleX, 0.25f, 32.0f, "%.2f",
+                       ImGuiSliderFlags_Logarithmic);
+
     const int windowWidth = ImGui::GetWindowContentRegionWidth();
-    const int windowHeight = 400;
+    const int windowHeight = 560;
     const int contentWidth = track.tickCount * scaleX;
 
     ImGui::PushStyleVar(ImGuiStyleVar_ScrollbarSize, 30.0f);
@@ -792,9 +1096,17 @@ void drawTrack(Track &track, Editor &editor) {
     ImGui::SetNextWindowContentSize(ImVec2(contentWidth, 0));
 
     static bool scrollFuse = true;
+    static float scrollX = 0.0f;
     if (scrollFuse) {
       ImGui::SetNextWindowScroll(ImVec2(contentWidth, 0));
       scrollFuse = false;
+    } else if (scaleX != prevScaleX) {
+      // Zoom around the center of the view
+      const float prevContentWidth = track.tickCount * prevScaleX;
+      const float centerTick =
+          (prevContentWidth - (scrollX + windowWidth / 2.0f)) / prevScaleX;
+      ImGui::SetNextWindowScroll(ImVec2(
+          contentWidth - centerTick * scaleX - windowWidth / 2.0f, 0));
     }
 
     ImGui::BeginChild("Track", ImVec2(windowWidth, windowHeight), false,
@@ -803,19 +1115,114 @@ void drawTrack(Track &track, Editor &editor) {
     ImGui::PopStyleColor();
     ImGui::PopStyleVar();
 
-    if (editor.isAudioPlaying || editor.isSeeking) {
+    if (playback.isPlaying || editor.isSeeking) {
       const float currentTickScreenOffset = windowWidth * 3.0f / 4.0f;
       ImGui::SetScrollX(contentWidth - currentTick * scaleX -
                         currentTickScreenOffset);
     }
 
+    scrollX = ImGui::GetScrollX();
+
     ImDrawList *drawList = ImGui::GetWindowDrawList();
 
     const ImGuiWindow *window = ImGui::GetCurrentWindow();
     const ImVec2 orig = window->DC.CursorPos;
 
-    ImVec2 prevHoldTriggerPos;
-    float prevHoldTriggerTick;
+    // Waveform lane, one column per visible pixel
+    {
+      const float laneCenter = orig.y + 345.0f;
+      const float laneHalfHeight = 45.0f;
+      const float framesPerTick = 1.0f / ticksPerFrame;
+      const int visibleEnd =
+          std::min((int)(scrollX + ImGui::GetWindowWidth()), contentWidth);
+
+      for (int px = scrollX; px < visibleEnd; ++px) {
+        // Ticks grow to the left
+        const float tickBegin =
+            std::max((contentWidth - px - 1) / scaleX, 0.0f);
+        const float tickEnd = (contentWidth - px) / scaleX;
+        const WaveformBucket b = editor.waveform.query(
+            tickBegin * framesPerTick, tickEnd * framesPerTick);
+        if (b.min > b.max)
+          continue;
+
+        const float rms = sqrtf(b.meanSquare);
+        const float x = orig.x + px;
+        drawList->AddRectFilled(
+            ImVec2(x, laneCenter - b.max * laneHalfHeight),
+            ImVec2(x + 1, laneCenter - b.min * laneHalfHeight + 1),
+            waveformColor);
+        drawList->AddRectFilled(
+            ImVec2(x, laneCenter - rms * laneHalfHeight),
+            ImVec2(x + 1, laneCenter + rms * laneHalfHeight), waveformRmsColor);
+      }
+    }
+
+    // Spectrogram strip, from cached tiles of the closest zoom
+    if (showSpectrogram && !editor.isHeadless) {
+      const float top = orig.y + 396.0f;
+      const float framesPerTick = 1.0f / ticksPerFrame;
+      const u32 zoom = SpectrogramCache::zoomFor(framesPerTick / scaleX);
+      const usize tileFrames = SpectrogramCache::tileFrames(zoom);
+      const float visibleFrameEnd = std::min(
+          (contentWidth - scrollX) / scaleX * framesPerTick,
+          (float)playback.framesCount);
+      const float visibleFrameBegin = std::max(
+          (contentWidth - scrollX - ImGui::GetWindowWidth()) / scaleX *
+              framesPerTick,
+          0.0f);
+
+      for (s64 index = visibleFrameBegin / tileFrames;
+           (float)index * tileFrames < visibleFrameEnd; ++index) {
+        const u32 texture = editor.spectrogram.getTile(zoom, index);
+        if (texture == 0)
+          continue;
+
+        // Later frames are further left
+        const float frameBegin = (float)index * tileFrames;
+        const float xBegin =
+            orig.x + contentWidth - frameBegin * ticksPerFrame * scaleX;
+        const float xEnd = orig.x + contentWidth -
+                           (frameBegin + tileFrames) * ticksPerFrame * scaleX;
+        drawList->AddImage((ImTextureID)(intptr_t)texture, ImVec2(xEnd, top),
+                           ImVec2(xBegin, top + SpectrogramCache::ROWS),
+                           ImVec2(1, 0), ImVec2(0, 1));
+      }
+    }
+
+    // Beat grid and onsets
+    if (hasOnsets) {
+      const float visibleTickEnd = (contentWidth - scrollX) / scaleX;
+      const float visibleTickBegin =
+          (contentWidth - scrollX - ImGui::GetWindowWidth()) / scaleX;
+
+      if (showBeatGrid) {
+        const std::vector<float> &beats = editor.onsets.beatTicks;
+        auto beat =
+            std::lower_bound(beats.begin(), beats.end(), visibleTickBegin);
+        for (; beat != beats.end() && *beat <= visibleTickEnd; ++beat) {
+          const float x = roundf(orig.x + contentWidth - *beat * scaleX);
+          drawList->AddLine(ImVec2(x, orig.y),
+                            ImVec2(x, orig.y + windowHeight), beatGridColor);
+        }
+      }
+
+      if (showOnsets) {
+        const std::vector<OnsetCandidate> &onsets = editor.onsets.onsets;
+        auto onset = std::lower_bound(
+            onsets.begin(), onsets.end(), visibleTickBegin,
+            [](const OnsetCandidate &c, float t) { return c.tick < t; });
+        for (; onset != onsets.end() && onset->tick <= visibleTickEnd;
+             ++onset) {
+          const float x = orig.x + contentWidth - onset->tick * scaleX;
+          ImColor c = onsetColor;
+          c.Value.w = 0.3f + 0.7f * onset->strength;
+          drawList->AddTriangleFilled(ImVec2(x - 4.0f, orig.y),
+                                      ImVec2(x + 4.0f, orig.y),
+                                      ImVec2(x, orig.y + 8.0f), c);
+        }
+      }
+    }
 
     // Feature zone
     drawList->AddRectFilled(
@@ -830,6 +1237,16 @@ void drawTrack(Track &track, Editor &editor) {
         orig + ImVec2(contentWidth - track.summonEnd * scaleX, windowHeight),
         summonColor);
 
+    // Loop region
+    if (playback.hasLoopRegion()) {
+      const float loopStartTick = playback.loopStart * ticksPerFrame;
+      const float loopEndTick = playback.loopEnd * ticksPerFrame;
+      drawList->AddRectFilled(
+          orig + ImVec2(contentWidth - loopStartTick * scaleX, 0),
+          orig + ImVec2(contentWidth - loopEndTick * scaleX, windowHeight),
+          loopColor);
+    }
+
     const int laneHeight = track.isBMS() ? 60 : 1;
     bool mouseOverTrigger = false;
 
@@ -842,8 +1259,49 @@ void drawTrack(Track &track, Editor &editor) {
         tickAtScrollEnd > slack ? tickAtScrollEnd - slack : 0;
     const u32 cullTickMax = tickAtScrollBegin + slack;
 
-    for (u32 i = 0; i < track.triggerCount; ++i) {
+    TriggerGlyphs &glyphs = editor.glyphs;
+    const auto tickPos = [&](u32 tick, s32 y) {
+      return ImVec2((int)(orig.x + contentWidth - (tick * scaleX)),
+                    (int)(orig.y + 100 + y * laneHeight));
+    };
+
+    // Hold lines crossing the view, from the cached segments
+    {
+      HoldLines &holdLines = editor.doc().holdLines;
+      holdLines.update(track, editor.doc().triggersVersion);
+      for (u32 s = holdLines.firstEndingAfter(cullTickMin);
+           s < holdLines.segments.size(); ++s) {
+        const HoldSegment &h = holdLines.segments[s];
+        if (h.startTick > cullTickMax)
+          break;
+
+        ImColor c = holdLineColor;
+        if (playback.isPlaying && currentTick > h.startTick &&
+            currentTick < h.endTick)
+          c = currentlyPlayingColor;
+
+        glyphs.addLine(tickPos(h.startTick, h.startY),
+                       tickPos(h.endTick, h.endY), 10.0f, c);
+      }
+    }
+
+    // Triggers are sorted by tick, start at the first one in view
+    const auto byTick = [](const Trigger &t, u32 tick) {
+      return t.tick < tick;
+    };
+    const u32 firstVisible =
+        std::lower_bound(track.triggers.begin(), track.triggers.end(),
+                         cullTickMin, byTick) -
+        track.triggers.begin();
+
+    for (u32 i = firstVisible; i < track.triggerCount; ++i) {
       const Trigger &t = track.triggers[i];
+      if (t.tick > cullTickMax)
+        break;
+
+      const ImVec2 pos = tickPos(t.tick, t.y);
+      const int posx = pos.x;
+      const int posy = pos.y;
 
       ImColor col;
       if (t.type == Trigger::Touch)
@@ -857,65 +1315,30 @@ void drawTrack(Track &track, Editor &editor) {
         col = unknownColor;
 
       // Highlight
-      if (editor.isAudioPlaying && fabs((float)t.tick - currentTick) < 4.0f) {
+      if (playback.isPlaying && fabs((float)t.tick - currentTick) < 4.0f) {
         col = currentlyPlayingColor;
       }
 
-      const int posy = orig.y + 100 + t.y * laneHeight;
-      const int posx = orig.x + contentWidth - (t.tick * scaleX);
-
-      // Draw line from previous hold trigger
-      if (t.type == Trigger::HoldEnd || t.type == Trigger::HoldEndSlide ||
-          t.type == Trigger::Holdlet) {
-
-        ImColor c = holdLineColor;
-        if (editor.isAudioPlaying && currentTick > prevHoldTriggerTick &&
-            currentTick < t.tick)
-          c = currentlyPlayingColor;
-
-        drawList->AddLine(prevHoldTriggerPos - ImVec2(0.5f, 0.5f),
-                          ImVec2(posx, posy) - ImVec2(0.5f, 0.5f), c, 10.0f);
-      }
-      if (t.type == Trigger::Hold || t.type == Trigger::Holdlet) {
-        prevHoldTriggerPos = ImVec2(posx, posy);
-        prevHoldTriggerTick = t.tick;
-      }
-
-      // Cull out of view triggers
-      if (t.tick > cullTickMax || t.tick < cullTickMin)
-        continue;
-
       // Draw trigger circle
       float radius = triggerRadius;
       if (t.type == Trigger::Holdlet)
         radius /= 2.0f;
 
-      if (t.type == Trigger::Holdlet || t.type == Trigger::HoldEnd ||
-          t.type == Trigger::HoldEndSlide)
-        drawList->AddCircleFilled(ImVec2(posx, posy), radius, col);
+      if (t.type == Trigger::Holdlet)
+        glyphs.add(TriggerGlyphs::SmallDisc, pos, col);
+      else if (t.type == Trigger::HoldEnd || t.type == Trigger::HoldEndSlide)
+        glyphs.add(TriggerGlyphs::Disc, pos, col);
       else
-        drawList->AddCircle(ImVec2(posx, posy), radius, col, 0, 8.0f);
+        glyphs.add(TriggerGlyphs::Ring, pos, col);
 
       if (editor.isTriggerSelected(t.id))
-        drawList->AddCircle(ImVec2(posx, posy), radius * 2,
-                            ImColor(1.0f, 1.0f, 1.0f), 0, 2.0f);
+        glyphs.add(t.type == Trigger::Holdlet ? TriggerGlyphs::SmallSelection
+                                              : TriggerGlyphs::Selection,
+                   pos, ImColor(1.0f, 1.0f, 1.0f));
 
       // Draw slide arrow
-      if (t.type == Trigger::Slide || t.type == Trigger::HoldEndSlide) {
-        const float a = (t.angle + 180.0f) * 2.0f * IM_PI / 360.0f;
-        const ImVec2 center = ImVec2(posx, posy);
-        const ImVec2 dir = ImRotate(ImVec2(0, 12.0f), cosf(a), sinf(a));
-        const ImVec2 head0 = ImRotate(ImVec2(-6.0f, 12.0f), cosf(a), sinf(a));
-        const ImVec2 head1 =
-            ImRotate(ImVec2(0.0f, 12.0f + 10.0f), cosf(a), sinf(a));
-        const ImVec2 head2 = ImRotate(ImVec2(+6.0f, 12.0f), cosf(a), sinf(a));
-
-        drawList->AddLine(center - ImVec2(0.5f, 0.5f),
-                          center + dir - ImVec2(0.5f, 0.5f),
-                          slideTriggerArrowColor, 3.0f);
-        drawList->AddTriangleFilled(center + head0, center + head1,
-                                    center + head2, slideTriggerArrowColor);
-      }
+      if (t.type == Trigger::Slide || t.type == Trigger::HoldEndSlide)
+        glyphs.addArrow(pos, t.angle + 180, slideTriggerArrowColor);
 
       // Tooltip
       const ImRect bb(posx - radius, posy - radius, posx + radius,
@@ -938,11 +1361,7 @@ void drawTrack(Track &track, Editor &editor) {
 
         if (ImGui::IsMouseClicked(1)) {
           // Remove trigger
-          if (editor.isTriggerSelected(t.id))
-            editor.unselectTrigger(t.id);
-          track.triggers.erase(track.triggers.begin() + i);
-          track.triggerCount--;
-          editor.trackModified = true;
+          editor.edit(track, {TriggerEdit::remove(t)});
         }
       }
     }
@@ -954,10 +1373,15 @@ void drawTrack(Track &track, Editor &editor) {
       int nearestLane = ((mouseRelPos.y - 100.0f) / (float)laneHeight) + 0.5f;
       nearestLane = ImClamp(nearestLane, 0, 3);
       ImVec2 overlayPos = ImVec2(mouseRelPos.x, nearestLane * laneHeight + 100);
-      drawList->AddCircle(orig + overlayPos, triggerRadius,
-                          touchTriggerColorTransparent, 0, 8.0f);
-
       int newTick = (contentWidth - overlayPos.x) / scaleX;
+      if (snapToOnsets && hasOnsets) {
+        newTick = editor.onsets.snapTick((contentWidth - overlayPos.x) / scaleX,
+                                         snapDistance / scaleX);
+        overlayPos.x = contentWidth - newTick * scaleX;
+      }
+
+      glyphs.add(TriggerGlyphs::Ring, orig + overlayPos,
+                 touchTriggerColorTransparent);
 
       ImGui::BeginTooltip();
       ImGui::Text("%d", newTick);
@@ -974,20 +1398,18 @@ void drawTrack(Track &track, Editor &editor) {
         t.flags = Trigger::Flag::None;
         t.id = genId();
 
-        track.triggers.push_back(t);
-        track.triggerCount++;
-
-        editor.trackModified = true;
-        editor.shouldSortTriggers = true;
+        editor.edit(track, {TriggerEdit::insert(t)});
         editor.selectTrigger(t.id, false);
       }
     }
 
+    glyphs.flush(drawList);
+
     // Draw currently playing tick
     {
       const ImColor playingColor = ImColor(1.0f, 1.0f, 1.0f);
       const ImColor pausedColor = ImColor(0.5f, 0.5f, 0.5f);
-      const ImColor color = editor.isAudioPlaying ? playingColor : pausedColor;
+      const ImColor color = playback.isPlaying ? playingColor : pausedColor;
       const float tickPos = contentWidth - currentTick * scaleX;
       const int x = roundf(tickPos);
 
@@ -999,71 +1421,263 @@ void drawTrack(Track &track, Editor &editor) {
   }
 }
 
+// Decode the music again after another program wrote it
+static void reloadSong(Editor &editor, AudioSink *audioSink,
+                       const char *musicFile, ThreadPool *pool) {
+  Song song;
+  if (!loadSong(musicFile, pool, &song)) {
+    fprintf(stderr, "Cannot reload %s, keeping the previous music\n",
+            musicFile);
+    return;
+  }
+
+  audioSink->close();
+  editor.replaceSong(song, pool);
+  if (audioSink->open(&editor.playback))
+    editor.audioLatency = audioSink->latency();
+  else
+    fprintf(stderr, "Cannot reopen the audio output\n");
+  printf("Reloaded %s\n", musicFile);
+}
+
+// Draws the active track over a scripted sweep of the playhead, without a
+// window or GPU, and prints the CPU time and geometry of each frame
+static void benchmarkDrawTrack(Editor &editor, const char *name) {
+  const u32 warmupFrames = 2;
+  const u32 frames = 300;
+  const ImVec2 displaySize(1600, 900);
+  Track &track = editor.doc().track;
+
+  float totalMs = 0.0f;
+  float maxMs = 0.0f;
+  u64 totalVertices = 0;
+  u64 totalCommands = 0;
+
+  for (u32 frame = 0; frame < warmupFrames + frames; ++frame) {
+    // Scroll from the start to the end of the song, as a seek would
+    const u32 step = frame < warmupFrames ? 0 : frame - warmupFrames;
+    editor.estimatedCurrentFrame =
+        (float)step * editor.playback.framesCount / frames;
+    editor.isSeeking = true;
+
+    const auto frameStart = std::chrono::steady_clock::now();
+
+    ImGui::GetIO().DisplaySize = displaySize;
+    ImGui::GetIO().DeltaTime = 1.0f / 60.0f;
+    ImGui::NewFrame();
+    ImGui::SetNextWindowPos(ImVec2(0, 0));
+    ImGui::SetNextWindowSize(displaySize);
+    ImGui::Begin("Main", nullptr,
+                 ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize |
+                     ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoCollapse |
+                     ImGuiWindowFlags_NoBringToFrontOnFocus);
+    drawTrack(track, editor);
+    ImGui::End();
+    ImGui::Render();
+
+    const std::chrono::duration<float, std::milli> frameMs =
+        std::chrono::steady_clock::now() - frameStart;
+
+    if (frame < warmupFrames)
+      continue;
+
+    const ImDrawData *drawData = ImGui::GetDrawData();
+    u32 commands = 0;
+    for (int i = 0; i < drawData->CmdListsCount; ++i)
+      commands += drawData->CmdLists[i]->CmdBuffer.Size;
+
+    totalMs += frameMs.count();
+    maxMs = std::max(maxMs, frameMs.count());
+    totalVertices += drawData->TotalVtxCount;
+    totalCommands += commands;
+  }
+  editor.isSeeking = false;
+
+  printf("%-10s %-3s %7u triggers %8.3fms avg %8.3fms max %8.0f vertices "
+         "%6.1f draw cmds\n",
+         name, TRACK_TYPE_NAMES[track.trackType], track.triggerCount,
+         totalMs / frames, maxMs, (double)totalVertices / frames,
+         (double)totalCommands / frames);
+}
+
+// Benchmarks the loaded tracks, then synthetic tracks of each type and of
+// increasing size over the same song
+static void benchmarkTracks(Editor &editor) {
+  ImGui::CreateContext();
+  ImGuiIO &io = ImGui::GetIO();
+  io.IniFilename = nullptr;
+  // Stand in for the OpenGL backend, so that frames are built as they are on
+  // screen: draw lists past 64K vertices use vertex offsets, and the atlas is
+  // built once, glyphs included, and bound to a texture
+  io.BackendRendererName = "rideau_headless";
+  io.BackendFlags |= ImGuiBackendFlags_RendererHasVtxOffset;
+  editor.glyphs.init(io.Fonts);
+  io.Fonts->SetTexID((ImTextureID)(intptr_t)1);
+  editor.isHeadless = true;
+
+  const u32 loadedCount = editor.documents.size();
+  const u32 tickCount = editor.doc().track.tickCount;
+  for (u32 i = 0; i < loadedCount; ++i) {
+    editor.switchDocument(i);
+    benchmarkDrawTrack(editor, "loaded");
+  }
+
+  const u32 sizes[] = {1000, 10000, 100000};
+  const Track::Type types[] = {Track::FMS, Track::BMS, Track::EMS};
+  for (usize t = 0; t < ARRAY_SIZE(types); ++t) {
+    for (usize s = 0; s < ARRAY_SIZE(sizes); ++s) {
+      // Replace the previous synthetic track
+      editor.switchDocument(0);
+      editor.documents.resize(loadedCount);
+      editor.documents.emplace_back();
+
+      TrackDocument &synthetic = editor.documents.back();
+      generateTrack(types[t], tickCount, sizes[s], &synthetic.track);
+      for (Trigger &trigger : synthetic.track.triggers)
+        trigger.id = genId();
+      checkTrack(synthetic.track);
+      synthetic.init("");
+
+      editor.switchDocument(loadedCount);
+      benchmarkDrawTrack(editor, "synthetic");
+    }
+  }
+
+  ImGui::DestroyContext();
+}
+
 } // namespace rideau
 
 int main(int argc, char *argv[]) {
   using namespace rideau;
 
   int opt;
-  bool batchMode = false;
+  bool benchmarkMode = false;
+
+  // Headless tools live in rideau-cli
+  const char *const usage = "Usage: %s [-B] TRIGGER_FILE... MUSIC_FILE\n";
 
-  while ((opt = getopt(argc, argv, "b")) != -1) {
+  while ((opt = getopt(argc, argv, "B")) != -1) {
     switch (opt) {
-    case 'b':
-      batchMode = true;
+    case 'B':
+      benchmarkMode = true;
       break;
     default:
-      fprintf(stderr, "Usage: %s [-b] TRIGGER_FILE MUSIC_FILE\n", argv[0]);
+      fprintf(stderr, usage, argv[0]);
       exit(EXIT_FAILURE);
     }
   }
 
   if (argc - optind < 2) {
-    fprintf(stderr, "Usage: %s [-b] TRIGGER_FILE MUSIC_FILE\n", argv[0]);
+    fprintf(stderr, usage, argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  const char *const triggerFile = argv[optind];
-  const char *const musicFile = argv[optind + 1];
+  ThreadPool threadPool;
+  threadPool.init();
 
-  Brstm brstm;
+  // A lone triggerNNN file brings the other difficulties of its folder along
+  std::vector<std::string> triggerFiles;
+  if (argc - optind == 2)
+    triggerFiles = findDifficultyFiles(argv[optind]);
+  else
+    triggerFiles.assign(argv + optind, argv + argc - 1);
+  const char *const musicFile = argv[argc - 1];
+
+  Song song;
   {
-    u8 ret = parseBRSTM(musicFile, &brstm);
-    ENSURE(ret < 128);
+    bool ok = loadSong(musicFile, &threadPool, &song);
+    ENSURE(ok);
   }
 
   Editor editor;
-  editor.init(&brstm);
+  editor.init(song);
+  Playback &playback = editor.playback;
+
+  editor.documents.resize(triggerFiles.size());
+  std::vector<bool> recovered(triggerFiles.size(), false);
+  for (u32 i = 0; i < triggerFiles.size(); ++i) {
+    TrackDocument &d = editor.documents[i];
+    parseTrackFile(triggerFiles[i].c_str(), &d.track);
+    checkTrack(d.track);
+
+    // Bring back the edits of a session that ended without a save
+    recovered[i] = replayJournal(triggerFiles[i], &d.track) > 0;
+    d.init(triggerFiles[i]);
+    if (recovered[i]) {
+      printf("Recovered unsaved edits of %s\n", d.filename.c_str());
+      d.trackModified = true;
+    }
 
-  AudioStuff audioStuff;
+    // Start on the file named on the command line
+    if (triggerFiles[i] == argv[optind])
+      editor.activeDocument = i;
+  }
 
-  {
-    int ret = initAudio(editor.sampleRate, &editor, audioStuff);
-    ENSURE(ret == 0);
+  for (TrackDocument &d : editor.documents) {
+    if (editor.fixTickCount(d.track))
+      d.trackModified = true;
   }
 
-  Track track;
-  parseTrackFile(triggerFile, &track);
-  checkTrack(track);
+  playback.hitsounds.buildSchedule(editor.doc().track, playback.framesCount);
+
+  // Analyze the song while the window opens
+  editor.analyzeSong(&threadPool);
 
-  if (batchMode) {
-    printTrackStats(track);
+  // Time drawing headlessly, with the waveform and onsets ready
+  if (benchmarkMode) {
+    threadPool.waitIdle();
+    g_profiler.init();
+    benchmarkTracks(editor);
+    g_profiler.deinit();
+    threadPool.deinit();
     return 0;
   }
 
-  // Fix tickCount to 59.825 TPS
-  const u32 newTickCount =
-      59.825f * ((float)editor.framesCount / editor.sampleRate);
-  if (track.tickCount != newTickCount) {
-    track.tickCount = newTickCount;
-    track.tickEnd = track.tickCount;
-    editor.trackModified = true;
+  g_profiler.init();
+
+  // Watch the open files, by index of document, then the music
+  FileWatcher watcher;
+  watcher.init();
+  for (const TrackDocument &d : editor.documents)
+    watcher.watch(d.filename);
+  const u32 musicWatch = watcher.watch(musicFile);
+  std::vector<u32> changedFiles;
+
+  // Journal edits from now on; recovered edits start the new journals
+  for (u32 i = 0; i < editor.documents.size(); ++i) {
+    TrackDocument &d = editor.documents[i];
+    d.journal.open(d.filename, d.track, recovered[i], &threadPool);
   }
 
+  // Init audio, or play silently if there's no usable device
+  SoundIoAudioSink soundioSink;
+  NullAudioSink nullSink;
+  AudioSink *audioSink = &soundioSink;
+  if (!soundioSink.open(&playback)) {
+    soundioSink.close();
+    fprintf(stderr, "No audio output, playing silently\n");
+    audioSink = &nullSink;
+    audioSink->open(&playback);
+  }
+  editor.audioLatency = audioSink->latency();
+
+  // Undo the above, on quit or when the window can't open
+  const auto closeSession = [&]() {
+    audioSink->close();
+    for (TrackDocument &d : editor.documents)
+      d.journal.close();
+    watcher.deinit();
+    g_profiler.deinit();
+    threadPool.deinit();
+  };
+
   // Init video
   glfwSetErrorCallback(glfw_error_callback);
-  if (!glfwInit())
+  if (!glfwInit()) {
+    closeSession();
     return 1;
+  }
 
   // GL 3.0 + GLSL 130
   const char *glsl_version = "#version 130";
@@ -1080,17 +1694,25 @@ int main(int argc, char *argv[]) {
 
   GLFWwindow *window = glfwCreateWindow(window_width, window_height,
                                         window_title, nullptr, nullptr);
-  if (window == nullptr)
+  if (window == nullptr) {
+    glfwTerminate();
+    closeSession();
     return 1;
+  }
   glfwMakeContextCurrent(window);
   glfwSwapInterval(1); // Enable vsync
 
   if (gladLoadGL() == 0) {
     fprintf(stderr, "Failed to initialize OpenGL loader!\n");
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    closeSession();
     return 1;
   }
 
   ImGui::CreateContext();
+  // Trigger sprites go in the font atlas, before the backend uploads it
+  editor.glyphs.init(ImGui::GetIO().Fonts);
   ImVec4 clear_color = ImVec4(0.f, 0.f, 0.f, 0.f);
 
   // Setup Platform/Renderer bindings
@@ -1103,6 +1725,8 @@ int main(int argc, char *argv[]) {
   glfwMakeContextCurrent(window);
 
   editor.initWaveformTexture();
+  editor.spectrogram.init(editor.song.samples, editor.song.framesCount,
+                          editor.song.sampleRate, &threadPool);
 
   // Input
   glfwSetInputMode(window, GLFW_STICKY_KEYS, GLFW_TRUE);
@@ -1110,10 +1734,20 @@ int main(int argc, char *argv[]) {
 
   auto lastLoopTime = std::chrono::high_resolution_clock::now();
 
+  RenderScheduler scheduler;
+  scheduler.init();
+  RenderScheduler::Activity activity = RenderScheduler::Animating;
+  bool showProfiler = false;
+  // Switches happen between frames, so that a frame sees a single track
+  u32 requestedDocument = editor.activeDocument;
+
   while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
+    scheduler.waitForFrame(window, activity);
 
-    updateKeys(window);
+    g_profiler.collect();
+
+    editor.switchDocument(requestedDocument);
+    Track &track = editor.doc().track;
 
     auto loopTime = std::chrono::high_resolution_clock::now();
     std::chrono::duration<float, std::micro> loopDtUs =
@@ -1121,7 +1755,14 @@ int main(int argc, char *argv[]) {
     lastLoopTime = loopTime;
     u32 loopUs = static_cast<u32>(loopDtUs.count());
 
+    // Without an audio device, advance the playback in real time
+    if (!audioSink->isRealtime())
+      audioSink->pump((u64)loopUs * playback.sampleRate / 1000000);
+
     {
+      ProfileZone zone(g_profiler, Profiler::MainThread, Profiler::Input);
+      updateKeys(window);
+
       if (getKey(GLFW_KEY_ESCAPE) == DOWN)
         glfwSetWindowShouldClose(window, GLFW_TRUE);
 
@@ -1130,24 +1771,68 @@ int main(int argc, char *argv[]) {
 
       if (getKey(GLFW_KEY_S) == PRESSED &&
           getKey(GLFW_KEY_LEFT_CONTROL) == DOWN) {
-        writeTrackFile(track, triggerFile);
-        editor.trackModified = false;
+        editor.saveDocument();
+      }
+
+      if (getKey(GLFW_KEY_LEFT_CONTROL) == DOWN) {
+        for (u32 i = 0; i < editor.documents.size() && i < 3; ++i) {
+          if (getKey(GLFW_KEY_1 + i) == PRESSED)
+            requestedDocument = i;
+        }
+
+        const bool shift = getKey(GLFW_KEY_LEFT_SHIFT) == DOWN;
+        if (getKey(GLFW_KEY_Z) == PRESSED && !shift)
+          editor.undo(track);
+        else if (getKey(GLFW_KEY_Y) == PRESSED ||
+                 (getKey(GLFW_KEY_Z) == PRESSED && shift))
+          editor.redo(track);
       }
+
+      if (getKey(GLFW_KEY_F3) == PRESSED)
+        showProfiler = !showProfiler;
+      if (getKey(GLFW_KEY_F4) == PRESSED &&
+          g_profiler.writeTrace(PROFILER_TRACE_FILE))
+        printf("Wrote profiler trace to %s\n", PROFILER_TRACE_FILE);
     }
 
-    if (editor.isAudioPlaying) {
+    if (playback.isPlaying) {
       const float usToSec = 1e-6f;
-      editor.estimatedCurrentFrame += loopUs * usToSec * editor.sampleRate;
+      const float prevFrame = editor.estimatedCurrentFrame;
+      editor.estimatedCurrentFrame +=
+          loopUs * usToSec * playback.sampleRate * playback.speed;
+
+      // Follow the audio thread around the loop region
+      if (playback.hasLoopRegion() && prevFrame < playback.loopEnd &&
+          editor.estimatedCurrentFrame >= playback.loopEnd)
+        editor.estimatedCurrentFrame -= playback.loopEnd - playback.loopStart;
     }
 
-    if (editor.shouldSortTriggers) {
-      // Keep the triggers sorted by increasing tick
-      std::sort(track.triggers.begin(), track.triggers.end(),
-                [&](Trigger &a, Trigger &b) { return a.tick < b.tick; });
+    {
+      ProfileZone zone(g_profiler, Profiler::MainThread,
+                       Profiler::SortTriggers);
+      editor.sortTriggers(track);
     }
+
+    // Pick up files written by other programs
+    changedFiles.clear();
+    watcher.poll(&changedFiles);
+    for (u32 file : changedFiles) {
+      if (file == musicWatch)
+        reloadSong(editor, audioSink, musicFile, &threadPool);
+      else
+        editor.reloadDocument(file, false);
+    }
+
+    // Record header changes, sync and compact the journals
+    for (TrackDocument &d : editor.documents)
+      d.journal.update(d.track, !editor.isLiveEditing);
+
     if (editor.isSeeking)
       editor.isSeeking = false;
 
+    // Hand the edited hitsound schedule over to the audio thread
+    playback.hitsounds.publish();
+
     // Draw
     int display_w, display_h;
     glfwGetFramebufferSize(window, &display_w, &display_h);
@@ -1173,6 +1858,24 @@ int main(int argc, char *argv[]) {
 
       const ImColor headerColor = ImColor(0.6f, 0.8f, 1.0f);
 
+      // Difficulties, when there's more than one
+      if (editor.documents.size() > 1) {
+        for (u32 i = 0; i < editor.documents.size(); ++i) {
+          const TrackDocument &d = editor.documents[i];
+          const usize slash = d.filename.find_last_of('/');
+          const char *name = d.filename.c_str() +
+                             (slash == std::string::npos ? 0 : slash + 1);
+
+          char label[256];
+          snprintf(label, sizeof(label), "%s%s##difficulty%u", name,
+                   d.trackModified ? " *" : "", i);
+          if (i > 0)
+            ImGui::SameLine();
+          if (ImGui::RadioButton(label, i == editor.activeDocument))
+            requestedDocument = i;
+        }
+      }
+
       {
         ImGui::BeginGroup();
         ImGui::TextColored(headerColor, "Track info");
@@ -1183,21 +1886,21 @@ int main(int argc, char *argv[]) {
         ImGui::PushStyleColor(ImGuiCol_Text, (ImVec4)ImColor(0.5f, 1.0f, 0.5f));
         if (ImGui::RadioButton("FMS", track.isFMS())) {
           track.trackType = Track::Type::FMS;
-          editor.trackModified = true;
+          editor.doc().trackModified = true;
         }
         ImGui::PopStyleColor();
         ImGui::SameLine();
         ImGui::PushStyleColor(ImGuiCol_Text, (ImVec4)ImColor(1.0f, 0.5f, 0.5f));
         if (ImGui::RadioButton("BMS", track.isBMS())) {
           track.trackType = Track::Type::BMS;
-          editor.trackModified = true;
+          editor.doc().trackModified = true;
         }
         ImGui::SameLine();
         ImGui::PopStyleColor();
         ImGui::PushStyleColor(ImGuiCol_Text, (ImVec4)ImColor(0.3f, 0.7f, 1.0f));
         if (ImGui::RadioButton("EMS", track.isEMS())) {
           track.trackType = Track::Type::EMS;
-          editor.trackModified = true;
+          editor.doc().trackModified = true;
         }
         ImGui::PopStyleColor();
 
@@ -1208,7 +1911,8 @@ int main(int argc, char *argv[]) {
         ImGui::Text("%d", track.tickCount);
 
         const float ticksPerSecond =
-            track.tickCount / ((float)editor.framesCount / editor.sampleRate);
+            track.tickCount /
+            ((float)playback.framesCount / playback.sampleRate);
         ImGui::SameLine();
         ImGui::Text("TPS: %.3f", ticksPerSecond);
 
@@ -1218,13 +1922,13 @@ int main(int argc, char *argv[]) {
         if (ImGui::SliderInt("##featureZoneStart",
                              (int *)&track.featureZoneStart, track.tickStart,
                              track.featureZoneEnd)) {
-          editor.trackModified = true;
+          editor.doc().trackModified = true;
         }
         ImGui::SameLine();
         ImGui::SetNextItemWidth(100.0f);
         if (ImGui::SliderInt("##featureZoneEnd", (int *)&track.featureZoneEnd,
                              track.featureZoneStart, track.tickEnd)) {
-          editor.trackModified = true;
+          editor.doc().trackModified = true;
         }
 
         ImGui::Text("Summon: ");
@@ -1232,13 +1936,13 @@ int main(int argc, char *argv[]) {
         ImGui::SetNextItemWidth(100.0f);
         if (ImGui::SliderInt("##summonStart", (int *)&track.summonStart,
                              track.tickStart, track.summonEnd)) {
-          editor.trackModified = true;
+          editor.doc().trackModified = true;
         }
         ImGui::SameLine();
         ImGui::SetNextItemWidth(100.0f);
         if (ImGui::SliderInt("##summonEnd", (int *)&track.summonEnd,
                              track.summonStart, track.tickEnd)) {
-          editor.trackModified = true;
+          editor.doc().trackModified = true;
         }
 
         ImGui::EndGroup();
@@ -1251,7 +1955,7 @@ int main(int argc, char *argv[]) {
         ImGui::BeginGroup();
         ImGui::TextColored(headerColor, "Trigger info");
 
-        if (editor.selectedTriggers.empty()) {
+        if (editor.doc().selection.empty()) {
           ImGui::Text("Select a trigger to edit it");
 
           if (ImGui::Button("Select all")) {
@@ -1259,11 +1963,8 @@ int main(int argc, char *argv[]) {
               editor.selectTrigger(track.triggers[i].id, true);
           }
 
-        } else if (editor.selectedTriggers.size() > 1) {
-          ImGui::Text("%zu triggers selected", editor.selectedTriggers.size());
-
-          std::vector<u32> toErase;
-          toErase.reserve(editor.selectedTriggers.size());
+        } else if (editor.doc().selection.size() > 1) {
+          ImGui::Text("%zu triggers selected", editor.doc().selection.size());
 
           Trigger *rep = nullptr;
           for (u32 i = 0; i < track.triggers.size(); ++i) {
@@ -1273,31 +1974,57 @@ int main(int argc, char *argv[]) {
             }
           }
 
+          ASSERT(rep != nullptr);
+
+          // Bulk edits are one step, applied in a single pass over the
+          // triggers
           if (ImGui::Button("Delete selected")) {
-            for (u32 i = 0; i < track.triggers.size();) {
-              if (editor.isTriggerSelected(track.triggers[i].id)) {
-                track.triggers.erase(track.triggers.begin() + i);
-                track.triggerCount--;
-              } else {
-                ++i;
-              }
+            EditStep step;
+            step.reserve(editor.doc().selection.size());
+            for (const Trigger &t : track.triggers) {
+              if (editor.isTriggerSelected(t.id))
+                step.push_back(TriggerEdit::remove(t));
             }
-            editor.trackModified = true;
+            editor.edit(track, std::move(step));
             editor.unselectAllTriggers();
+            rep = nullptr;
           }
 
-          ImGui::SetNextItemWidth(100.0f);
-          if (ImGui::SliderInt("Lane", &rep->y, 0, 3)) {
-            for (u32 i = 0; i < track.triggers.size(); ++i) {
-              if (editor.isTriggerSelected(track.triggers[i].id)) {
-                track.triggers[i].y = rep->y;
+          for (u32 i = 0; i < Trigger::Type::TrackGuide && rep != nullptr;
+               ++i) {
+            if (i > 0)
+              ImGui::SameLine();
+            if (ImGui::RadioButton(TRIGGER_TYPE_NAMES[i], rep->type == i)) {
+              EditStep step;
+              for (const Trigger &t : track.triggers) {
+                if (editor.isTriggerSelected(t.id) && t.type != i) {
+                  Trigger after = t;
+                  after.type = (Trigger::Type)i;
+                  step.push_back(TriggerEdit::change(t, after));
+                }
               }
+              editor.edit(track, std::move(step));
+              rep = nullptr;
             }
-            editor.trackModified = true;
+          }
+
+          if (rep != nullptr) {
+            ImGui::SetNextItemWidth(100.0f);
+            int lane = rep->y;
+            if (ImGui::SliderInt("Lane", &lane, 0, 3)) {
+              editor.beginLiveEdit(track);
+              for (Trigger &t : track.triggers) {
+                if (editor.isTriggerSelected(t.id))
+                  t.y = lane;
+              }
+              editor.markTriggersChanged();
+            }
+            if (ImGui::IsItemDeactivated())
+              editor.endLiveEdit(track);
           }
 
         } else {
-          ASSERT(editor.selectedTriggers.size() == 1);
+          ASSERT(editor.doc().selection.size() == 1);
 
           Trigger *t = nullptr;
           u32 selectedTriggerIndex;
@@ -1310,36 +2037,60 @@ int main(int argc, char *argv[]) {
           }
           ASSERT(t != nullptr);
 
+          bool edited = false;
           if (ImGui::Button("Delete")) {
-            editor.unselectTrigger(t->id);
-            track.triggers.erase(track.triggers.begin() + selectedTriggerIndex);
-            track.triggerCount--;
-            editor.trackModified = true;
+            editor.edit(track, {TriggerEdit::remove(*t)});
+            edited = true;
           }
 
-          for (u32 i = 0; i < Trigger::Type::TrackGuide; ++i) {
+          for (u32 i = 0; i < Trigger::Type::TrackGuide && !edited; ++i) {
             if (i > 0)
               ImGui::SameLine();
             if (ImGui::RadioButton(TRIGGER_TYPE_NAMES[i], t->type == i)) {
-              t->type = (Trigger::Type)i;
-              editor.trackModified = true;
+              Trigger after = *t;
+              after.type = (Trigger::Type)i;
+              editor.edit(track, {TriggerEdit::change(*t, after)});
+              edited = true;
             }
           }
 
-          if (ImGui::SliderInt("Tick", (int *)&t->tick, track.tickStart,
-                               track.tickEnd)) {
-            editor.shouldSortTriggers = true;
-            editor.trackModified = true;
-          }
-          ImGui::SetNextItemWidth(100.0f);
-          if (ImGui::SliderInt("Lane", &t->y, 0, 3)) {
-            editor.trackModified = true;
-          }
-          if (t->type == Trigger::Slide || t->type == Trigger::HoldEndSlide) {
-            ImGui::SameLine();
+          // Sliders edit the trigger in place, and are recorded when released
+          if (!edited) {
+            int tick = t->tick;
+            if (ImGui::SliderInt("Tick", &tick, track.tickStart,
+                                 track.tickEnd)) {
+              editor.beginLiveEdit(track);
+              t->tick = tick;
+              playback.hitsounds.updateTrigger(*t);
+              editor.doc().guides.triggerChanged(track, selectedTriggerIndex);
+              editor.doc().shouldSortTriggers = true;
+              editor.markTriggersChanged();
+            }
+            if (ImGui::IsItemDeactivated())
+              editor.endLiveEdit(track);
+
             ImGui::SetNextItemWidth(100.0f);
-            if (ImGui::SliderInt("Angle", (int *)&t->angle, 0, 360)) {
-              editor.trackModified = true;
+            int lane = t->y;
+            if (ImGui::SliderInt("Lane", &lane, 0, 3)) {
+              editor.beginLiveEdit(track);
+              t->y = lane;
+              editor.markTriggersChanged();
+            }
+            if (ImGui::IsItemDeactivated())
+              editor.endLiveEdit(track);
+
+            if (t->type == Trigger::Slide ||
+                t->type == Trigger::HoldEndSlide) {
+              ImGui::SameLine();
+              ImGui::SetNextItemWidth(100.0f);
+              int angle = t->angle;
+              if (ImGui::SliderInt("Angle", &angle, 0, 360)) {
+                editor.beginLiveEdit(track);
+                t->angle = angle;
+                editor.markTriggersChanged();
+              }
+              if (ImGui::IsItemDeactivated())
+                editor.endLiveEdit(track);
             }
           }
         }
@@ -1350,7 +2101,7 @@ int main(int argc, char *argv[]) {
       {
         ImGui::BeginGroup();
 
-        const bool colorButton = editor.trackModified;
+        const bool colorButton = editor.doc().trackModified;
         if (colorButton) {
           ImGui::PushStyleColor(ImGuiCol_Button,
                                 (ImVec4)ImColor::HSV(0, 0.6f, 0.6f));
@@ -1360,23 +2111,81 @@ int main(int argc, char *argv[]) {
                                 (ImVec4)ImColor::HSV(0, 0.8f, 0.8f));
         }
         if (ImGui::Button("Save track")) {
-          writeTrackFile(track, triggerFile);
-          editor.trackModified = false;
+          editor.saveDocument();
         }
         if (colorButton)
           ImGui::PopStyleColor(3);
 
+        if (editor.doc().changedOnDisk) {
+          ImGui::SameLine();
+          if (ImGui::Button("Reload from disk"))
+            editor.reloadDocument(editor.activeDocument, true);
+          else if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Changed by another program; discards edits");
+        }
+
         ImGui::SameLine();
 
-        const char *playLabel = editor.isAudioPlaying ? "Pause" : "Play";
+        const char *playLabel = playback.isPlaying ? "Pause" : "Play";
         if (ImGui::Button(playLabel))
           editor.togglePause();
 
         ImGui::SameLine();
         ImGui::SetNextItemWidth(150.0f);
-        float volumeDb = 10 * log10f(editor.audioVolume);
+        float volumeDb = 10 * log10f(playback.volume);
         if (ImGui::SliderFloat("Volume", &volumeDb, -50.0f, 0.0f)) {
-          editor.audioVolume = powf(10.0f, volumeDb / 10.0f);
+          playback.volume = powf(10.0f, volumeDb / 10.0f);
+        }
+
+        ImGui::SameLine();
+        bool hitsoundsEnabled = playback.hitsounds.enabled;
+        if (ImGui::Checkbox("Hitsounds", &hitsoundsEnabled))
+          playback.hitsounds.enabled = hitsoundsEnabled;
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(150.0f);
+        float hitsoundsDb = 10 * log10f(playback.hitsounds.volume);
+        if (ImGui::SliderFloat("##hitsoundsVolume", &hitsoundsDb, -50.0f,
+                               0.0f)) {
+          playback.hitsounds.volume = powf(10.0f, hitsoundsDb / 10.0f);
+        }
+
+        // Practice mode
+        ImGui::SetNextItemWidth(150.0f);
+        float speed = playback.speed;
+        if (ImGui::SliderFloat("Speed", &speed, 0.25f, 1.5f, "%.2fx"))
+          playback.speed = speed;
+        ImGui::SameLine();
+        if (ImGui::Button("1x"))
+          playback.speed = 1.0f;
+
+        ImGui::SameLine();
+        if (ImGui::Button("Set A"))
+          editor.setLoopPoint(false);
+        ImGui::SameLine();
+        if (ImGui::Button("Set B"))
+          editor.setLoopPoint(true);
+        ImGui::SameLine();
+        bool isLooping = playback.isLooping;
+        if (ImGui::Checkbox("Loop A-B", &isLooping)) {
+          playback.isLooping = isLooping;
+          if (playback.hasLoopRegion() &&
+              (editor.estimatedCurrentFrame < playback.loopStart ||
+               editor.estimatedCurrentFrame >= playback.loopEnd))
+            editor.seekTo(playback.loopStart);
+        }
+        ImGui::SameLine();
+        ImGui::Text("%.3fs-%.3fs",
+                    (float)playback.loopStart / playback.sampleRate,
+                    (float)playback.loopEnd / playback.sampleRate);
+
+        ImGui::SameLine();
+        ImGui::Text("DSP %3.0f%% (peak %3.0f%%) xruns %u",
+                    playback.load * 100.0f, playback.loadPeak * 100.0f,
+                    playback.underflows.load());
+        ImGui::SameLine();
+        if (ImGui::SmallButton("Reset")) {
+          playback.loadPeak = 0.0f;
+          playback.underflows = 0;
         }
 
         ImGui::EndGroup();
@@ -1387,11 +2196,29 @@ int main(int argc, char *argv[]) {
       ImGui::End();
     }
 
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    if (showProfiler)
+      g_profiler.drawOverlay(&showProfiler);
+
+    {
+      ProfileZone zone(g_profiler, Profiler::MainThread, Profiler::ImGuiRender);
+      ImGui::Render();
+      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
 
     // Swap
-    glfwSwapBuffers(window);
+    {
+      ProfileZone zone(g_profiler, Profiler::MainThread, Profiler::Swap);
+      glfwSwapBuffers(window);
+    }
+
+    if (playback.isPlaying || editor.isSeeking || editor.isLiveEditing ||
+        ImGui::IsAnyMouseDown())
+      activity = RenderScheduler::Animating;
+    else if (!editor.waveform.isComplete || !editor.onsets.isReady ||
+             editor.spectrogram.isBusy())
+      activity = RenderScheduler::Background;
+    else
+      activity = RenderScheduler::Idle;
   }
 
   ImGui_ImplOpenGL3_Shutdown();
@@ -1401,9 +2228,7 @@ int main(int argc, char *argv[]) {
   glfwDestroyWindow(window);
   glfwTerminate();
 
-  deinitAudio(audioStuff);
-
-  brstm_close(&brstm);
+  closeSession();
 
   return 0;
 }
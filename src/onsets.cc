@@ -0,0 +1,339 @@
+#include "onsets.h"
+
+#include "fft.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace rideau {
+
+// Envelope frames per analysis job
+static const u32 FRAMES_PER_JOB = 256;
+
+// Peak picking, in envelope frames
+static const u32 PEAK_PRE_MAX = 3;
+static const u32 PEAK_POST_MAX = 1;
+static const u32 PEAK_PRE_AVG = 10;
+static const u32 PEAK_POST_AVG = 7;
+static const u32 PEAK_MIN_DISTANCE = 3;
+static const float PEAK_DELTA = 0.05f;
+
+static const float MIN_BPM = 60.0f;
+static const float MAX_BPM = 200.0f;
+static const float PREFERRED_BPM = 120.0f;
+
+// ln(x) for x >= 1, to about 1e-4: exponent from the float bits, plus a
+// polynomial for the mantissa.  logf dominates the flux otherwise.
+static inline float fastLog(float x) {
+  u32 bits;
+  memcpy(&bits, &x, sizeof(bits));
+  const float exponent = (float)((s32)(bits >> 23) - 127);
+  bits = (bits & 0x7FFFFF) | 0x3F800000;
+  float m;
+  memcpy(&m, &bits, sizeof(m));
+  const float log2m =
+      -1.7417939f +
+      (2.8212026f + (-1.4699568f + (0.44717955f - 0.056570851f * m) * m) * m) *
+          m;
+  return (exponent + log2m) * 0.69314718f;
+}
+
+void OnsetAnalysis::init() {
+  onsets.clear();
+  beatTicks.clear();
+  bpm = 0.0f;
+  analysisMs = 0.0f;
+  isReady = false;
+}
+
+// Half-wave rectified log magnitude increase for envelope frames
+// [first, last), computed two frames per FFT
+static void computeFlux(const FFT &fft, const float *mono, usize monoCount,
+                        usize first, usize last, float *flux) {
+  const u32 N = OnsetAnalysis::FFT_SIZE;
+  const u32 bins = N / 2 + 1;
+
+  float *buffer = (float *)malloc((6 * N + 3 * bins) * sizeof(float));
+  ENSURE(buffer != nullptr);
+  float *frames[2] = {buffer, buffer + N};
+  float *re = buffer + 2 * N;
+  float *im = buffer + 3 * N;
+  float *mags[3] = {buffer + 4 * N, buffer + 4 * N + bins,
+                    buffer + 4 * N + 2 * bins};
+
+  auto loadFrame = [&](s64 f, float *dst) {
+    const s64 start = f * (s64)OnsetAnalysis::HOP;
+    for (u32 i = 0; i < N; ++i) {
+      const s64 idx = start + i;
+      dst[i] = (idx >= 0 && (usize)idx < monoCount) ? mono[idx] : 0.0f;
+    }
+  };
+  auto logCompress = [&](float *mag) {
+    for (u32 k = 0; k < bins; ++k)
+      mag[k] = fastLog(1.0f + 10.0f * mag[k]);
+  };
+
+  auto diff = [&](const float *cur, const float *prev) {
+    float sum = 0.0f;
+    for (u32 k = 0; k < bins; ++k)
+      sum += std::max(cur[k] - prev[k], 0.0f);
+    return sum;
+  };
+
+  // Frame first - 1 is only there to diff against
+  float *prev = mags[0];
+  float *a = mags[1];
+  float *b = mags[2];
+  loadFrame((s64)first - 1, frames[0]);
+  loadFrame(first, frames[1]);
+  fft.magnitudes2(frames[0], frames[1], prev, a, re, im);
+  logCompress(prev);
+  logCompress(a);
+  flux[first] = diff(a, prev);
+  std::swap(prev, a);
+
+  for (usize f = first + 1; f < last; f += 2) {
+    loadFrame(f, frames[0]);
+    loadFrame(f + 1, frames[1]);
+    fft.magnitudes2(frames[0], frames[1], a, b, re, im);
+    logCompress(a);
+    logCompress(b);
+
+    flux[f] = diff(a, prev);
+    if (f + 1 < last)
+      flux[f + 1] = diff(b, a);
+    std::swap(prev, b);
+  }
+
+  free(buffer);
+}
+
+static std::vector<usize> pickPeaks(const std::vector<float> &env) {
+  std::vector<usize> peaks;
+  const usize count = env.size();
+  usize lastPeak = 0;
+  bool hasPeak = false;
+
+  for (usize i = 0; i < count; ++i) {
+    const usize maxBegin = i >= PEAK_PRE_MAX ? i - PEAK_PRE_MAX : 0;
+    const usize maxEnd = std::min(i + PEAK_POST_MAX + 1, count);
+    bool isMax = true;
+    for (usize j = maxBegin; j < maxEnd && isMax; ++j)
+      isMax = env[j] <= env[i];
+    if (!isMax)
+      continue;
+
+    const usize avgBegin = i >= PEAK_PRE_AVG ? i - PEAK_PRE_AVG : 0;
+    const usize avgEnd = std::min(i + PEAK_POST_AVG + 1, count);
+    float avg = 0.0f;
+    for (usize j = avgBegin; j < avgEnd; ++j)
+      avg += env[j];
+    avg /= avgEnd - avgBegin;
+    if (env[i] < avg + PEAK_DELTA)
+      continue;
+
+    if (hasPeak && i - lastPeak < PEAK_MIN_DISTANCE)
+      continue;
+
+    peaks.push_back(i);
+    lastPeak = i;
+    hasPeak = true;
+  }
+
+  return peaks;
+}
+
+// Beat period in envelope frames, from the autocorrelation of the envelope
+// weighted towards PREFERRED_BPM
+static float estimatePeriod(const std::vector<float> &env, float framesPerSec) {
+  const usize minLag = framesPerSec * 60.0f / MAX_BPM;
+  const usize maxLag = framesPerSec * 60.0f / MIN_BPM + 1;
+  const float preferredLag = framesPerSec * 60.0f / PREFERRED_BPM;
+  if (env.size() <= maxLag + 1)
+    return preferredLag;
+
+  std::vector<float> scores(maxLag + 2, 0.0f);
+  for (usize lag = minLag - 1; lag <= maxLag + 1; ++lag) {
+    float r = 0.0f;
+    for (usize i = lag; i < env.size(); ++i)
+      r += env[i] * env[i - lag];
+    const float octaves = log2f(lag / preferredLag);
+    scores[lag] = r / (env.size() - lag) * expf(-0.5f * octaves * octaves);
+  }
+
+  usize best = minLag;
+  for (usize lag = minLag; lag <= maxLag; ++lag)
+    if (scores[lag] > scores[best])
+      best = lag;
+
+  // Parabolic interpolation for a fractional period
+  const float a = scores[best - 1];
+  const float b = scores[best];
+  const float c = scores[best + 1];
+  const float d = a - 2.0f * b + c;
+  const float shift = d < 0.0f ? 0.5f * (a - c) / d : 0.0f;
+  return best + std::clamp(shift, -0.5f, 0.5f);
+}
+
+static float estimatePhase(const std::vector<float> &env, float period) {
+  float bestPhase = 0.0f;
+  float bestScore = -1.0f;
+  for (float phase = 0.0f; phase < period; phase += 1.0f) {
+    float score = 0.0f;
+    for (float t = phase; t + 0.5f < env.size(); t += period)
+      score += env[(usize)(t + 0.5f)];
+    if (score > bestScore) {
+      bestScore = score;
+      bestPhase = phase;
+    }
+  }
+  return bestPhase;
+}
+
+// Least squares fit of the grid to the strong onsets near its beats.  Small
+// period errors add up over a song: onsets that drifted too far from the grid
+// are left out at first, and come back as the fit improves.
+static void refineGrid(const std::vector<usize> &peaks,
+                       const std::vector<float> &env, float *period,
+                       float *phase) {
+  const float minStrength = 0.3f;
+  for (int pass = 0; pass < 4; ++pass) {
+    double n = 0, sk = 0, sp = 0, skk = 0, skp = 0;
+    for (usize p : peaks) {
+      if (env[p] < minStrength)
+        continue;
+      const float k = roundf((p - *phase) / *period);
+      if (fabsf(p - (*phase + k * *period)) > *period / 4.0f)
+        continue;
+      n += 1;
+      sk += k;
+      sp += p;
+      skk += k * k;
+      skp += k * p;
+    }
+
+    const double det = n * skk - sk * sk;
+    if (n < 8 || det <= 0)
+      return;
+    *period = (n * skp - sk * sp) / det;
+    *phase = (sp - *period * sk) / n;
+  }
+
+  // First beat in range
+  *phase = fmodf(*phase, *period);
+  if (*phase < 0.0f)
+    *phase += *period;
+}
+
+void OnsetAnalysis::analyze(const float *const samples[2], usize framesCount,
+                            u32 sampleRate, float ticksPerFrame,
+                            ThreadPool *pool) {
+  ENSURE(pool != nullptr);
+  auto start = std::chrono::steady_clock::now();
+
+  // Decimated mono mix, then the flux envelope in parallel chunks of frames.
+  // Averaging pairs is a poor lowpass, but aliasing barely moves the flux.
+  const usize monoCount = framesCount / DECIMATION;
+  float *mono = (float *)malloc(monoCount * sizeof(float));
+  ENSURE(mono != nullptr);
+  const usize monoJobSamples = 1 << 18;
+  pool->parallelFor(
+      (monoCount + monoJobSamples - 1) / monoJobSamples, [&](usize job) {
+        const usize first = job * monoJobSamples;
+        const usize last = std::min(first + monoJobSamples, monoCount);
+        const float scale = 0.5f / DECIMATION;
+        for (usize i = first; i < last; ++i) {
+          float sum = 0.0f;
+          for (u32 d = 0; d < DECIMATION; ++d)
+            sum += samples[0][i * DECIMATION + d] +
+                   samples[1][i * DECIMATION + d];
+          mono[i] = sum * scale;
+        }
+      });
+
+  FFT fft;
+  fft.init(FFT_SIZE);
+
+  const usize envCount = monoCount / HOP + 1;
+  std::vector<float> env(envCount, 0.0f);
+  pool->parallelFor((envCount + FRAMES_PER_JOB - 1) / FRAMES_PER_JOB,
+                    [&](usize job) {
+                      const usize first = job * FRAMES_PER_JOB;
+                      const usize last =
+                          std::min(first + FRAMES_PER_JOB, envCount);
+                      computeFlux(fft, mono, monoCount, first, last,
+                                  env.data());
+                    });
+
+  fft.deinit();
+  free(mono);
+
+  const float envMax = *std::max_element(env.begin(), env.end());
+  if (envMax > 0.0f)
+    for (float &e : env)
+      e /= envMax;
+
+  // Envelope frame f is centered on mono sample f * HOP + FFT_SIZE / 2
+  auto envToTick = [&](float f) {
+    return (f * HOP + FFT_SIZE / 2) * DECIMATION * ticksPerFrame;
+  };
+
+  const std::vector<usize> peaks = pickPeaks(env);
+  onsets.clear();
+  for (usize peak : peaks) {
+    const OnsetCandidate c = {(u32)(envToTick(peak) + 0.5f), env[peak]};
+    if (!onsets.empty() && onsets.back().tick == c.tick)
+      onsets.back().strength = std::max(onsets.back().strength, c.strength);
+    else
+      onsets.push_back(c);
+  }
+
+  const float framesPerSec = (float)sampleRate / DECIMATION / HOP;
+  float period = estimatePeriod(env, framesPerSec);
+  float phase = estimatePhase(env, period);
+  refineGrid(peaks, env, &period, &phase);
+  bpm = framesPerSec * 60.0f / period;
+
+  beatTicks.clear();
+  for (float f = phase; f < envCount; f += period)
+    beatTicks.push_back(envToTick(f));
+
+  analysisMs = std::chrono::duration<float, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+  isReady.store(true, std::memory_order_release);
+}
+
+u32 OnsetAnalysis::snapTick(float tick, float maxDistance) const {
+  auto onset = std::lower_bound(
+      onsets.begin(), onsets.end(), tick,
+      [](const OnsetCandidate &c, float t) { return c.tick < t; });
+  float best = tick;
+  float bestDistance = maxDistance;
+  if (onset != onsets.end() && onset->tick - tick <= bestDistance) {
+    best = onset->tick;
+    bestDistance = onset->tick - tick;
+  }
+  if (onset != onsets.begin() && tick - (onset - 1)->tick <= bestDistance) {
+    best = (onset - 1)->tick;
+    bestDistance = tick - best;
+  }
+  if (best != tick || beatTicks.size() < 2)
+    return best + 0.5f;
+
+  // Quarter beats between the surrounding beats
+  auto beat = std::upper_bound(beatTicks.begin(), beatTicks.end(), tick);
+  if (beat == beatTicks.begin() || beat == beatTicks.end())
+    return tick + 0.5f;
+  const float prev = *(beat - 1);
+  const float step = (*beat - prev) / 4.0f;
+  const float snapped = prev + roundf((tick - prev) / step) * step;
+  if (fabsf(snapped - tick) <= maxDistance)
+    return snapped + 0.5f;
+  return tick + 0.5f;
+}
+
+} // namespace rideau
@@ -0,0 +1,50 @@
+#ifndef ONSETS_H
+#define ONSETS_H
+
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <atomic>
+#include <vector>
+
+namespace rideau {
+
+struct OnsetCandidate {
+  u32 tick;
+  float strength; // [0,1]
+};
+
+// Onsets and beat grid of a song, for suggesting and snapping triggers.
+//
+// The song is cut into STFT frames; spectral flux of the log magnitudes gives
+// an onset envelope, whose local peaks above a moving average are onsets.
+// Tempo is the autocorrelation peak of the envelope, and the grid phase the
+// offset that lands most beats on high envelope values.
+struct OnsetAnalysis {
+  // Analysis runs on the song downmixed and decimated by DECIMATION, with
+  // frames of FFT_SIZE every HOP samples (10.7ms at 48kHz)
+  static const u32 DECIMATION = 2;
+  static const u32 FFT_SIZE = 512;
+  static const u32 HOP = 256;
+
+  std::vector<OnsetCandidate> onsets; // sorted by tick
+  std::vector<float> beatTicks;
+  float bpm;
+  float analysisMs;
+
+  // Set once the fields above are written; read them only after that
+  std::atomic<bool> isReady;
+
+  void init();
+
+  void analyze(const float *const samples[2], usize framesCount,
+               u32 sampleRate, float ticksPerFrame, ThreadPool *pool);
+
+  // Nearest onset within maxDistance ticks of tick, else the nearest quarter
+  // beat within maxDistance, else tick itself
+  u32 snapTick(float tick, float maxDistance) const;
+};
+
+} // namespace rideau
+
+#endif
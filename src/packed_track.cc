@@ -0,0 +1,122 @@
+#include "packed_track.h"
+
+#include "file_utils.h"
+
+namespace rideau {
+
+bool packTrack(const Track &track, PackedTrack *packed) {
+  ENSURE(packed != nullptr);
+
+  packed->trackType = track.trackType;
+  packed->tickCount = track.tickCount;
+  packed->tickStart = track.tickStart;
+  packed->tickEnd = track.tickEnd;
+  packed->featureZoneStart = track.featureZoneStart;
+  packed->featureZoneEnd = track.featureZoneEnd;
+  packed->summonStart = track.summonStart;
+  packed->summonEnd = track.summonEnd;
+  packed->summonTrigger = track.summonTrigger;
+  packed->triggerCount = track.triggerCount;
+
+  std::vector<PackedTrigger> &triggers = packed->triggers.packed;
+  triggers.resize(track.triggers.size());
+  for (usize i = 0; i < track.triggers.size(); ++i) {
+    if (!packTrigger(track.triggers[i], &triggers[i]))
+      return false;
+  }
+  return true;
+}
+
+void unpackTrack(const PackedTrack &packed, Track *track) {
+  ENSURE(track != nullptr);
+
+  track->trackType = packed.trackType;
+  track->tickCount = packed.tickCount;
+  track->tickStart = packed.tickStart;
+  track->tickEnd = packed.tickEnd;
+  track->featureZoneStart = packed.featureZoneStart;
+  track->featureZoneEnd = packed.featureZoneEnd;
+  track->summonStart = packed.summonStart;
+  track->summonEnd = packed.summonEnd;
+  track->summonTrigger = packed.summonTrigger;
+  track->triggerCount = packed.triggerCount;
+
+  track->triggers.reserve(packed.triggers.size());
+  track->triggers.assign(packed.triggers.begin(), packed.triggers.end());
+}
+
+bool parsePackedTrack(const u8 *raw, u32 rawSize, PackedTrack *track) {
+  ENSURE(raw != nullptr);
+  ENSURE(track != nullptr);
+
+  if (!isParsableTrack(raw, rawSize))
+    return false;
+
+  const u8 *r = raw;
+
+  track->trackType = Track::Type(readu32le(&r));
+  track->tickCount = readu32le(&r);
+  track->tickStart = readu32le(&r);
+  track->tickEnd = readu32le(&r);
+  track->featureZoneStart = readu32le(&r);
+  track->featureZoneEnd = readu32le(&r);
+  track->summonStart = readu32le(&r);
+  track->summonEnd = readu32le(&r);
+  track->summonTrigger = readu32le(&r);
+  track->triggerCount = readu32le(&r);
+
+  std::vector<PackedTrigger> &triggers = track->triggers.packed;
+  triggers.resize(track->triggerCount);
+  for (PackedTrigger &p : triggers) {
+    Trigger t;
+    t.tick = readu32le(&r);
+    t.type = Trigger::Type(readu32le(&r));
+    t.x = (s32)readu32le(&r);
+    t.y = (s32)readu32le(&r);
+    t.angle = readu32le(&r);
+    t.flags = Trigger::Flag(readu32le(&r));
+    t.id = 0;
+    if (!packTrigger(t, &p))
+      return false;
+  }
+
+  ASSERT((r - raw) == rawSize);
+  return true;
+}
+
+usize getTrackRawSize(const PackedTrack &track) {
+  return 10 * sizeof(u32) + track.triggers.size() * 6 * sizeof(u32);
+}
+
+void writePackedTrack(const PackedTrack &track, u8 *raw, u32 rawSize) {
+  ENSURE(raw != nullptr);
+  ENSURE(rawSize >= getTrackRawSize(track));
+
+  u8 *r = raw;
+
+  writeu32le(&r, track.trackType);
+  writeu32le(&r, track.tickCount);
+  writeu32le(&r, track.tickStart);
+  writeu32le(&r, track.tickEnd);
+  writeu32le(&r, track.featureZoneStart);
+  writeu32le(&r, track.featureZoneEnd);
+  writeu32le(&r, track.summonStart);
+  writeu32le(&r, track.summonEnd);
+  writeu32le(&r, track.summonTrigger);
+  writeu32le(&r, track.triggerCount);
+
+  ASSERT(track.triggers.size() == track.triggerCount);
+
+  for (const Trigger t : track.triggers) {
+    writeu32le(&r, t.tick);
+    writeu32le(&r, t.type);
+    writeu32le(&r, t.x);
+    writeu32le(&r, t.y);
+    writeu32le(&r, t.angle);
+    writeu32le(&r, t.flags);
+  }
+
+  ASSERT((usize)(r - raw) == getTrackRawSize(track));
+}
+
+} // namespace rideau
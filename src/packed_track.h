@@ -0,0 +1,165 @@
+#ifndef PACKED_TRACK_H
+#define PACKED_TRACK_H
+
+#include "track.h"
+#include "utils.h"
+
+#include <iterator>
+#include <vector>
+
+namespace rideau {
+
+// Trigger in 16 bytes instead of 28, for tools that hold many tracks at once.
+// Every field of a valid trigger fits; flags are squeezed into the low bits.
+struct PackedTrigger {
+  u32 tick;
+  u32 id;
+  s16 x;
+  s16 y;
+  u16 angle;
+  u8 type;
+  u8 flags; // Flag bits
+
+  enum Flag : u8 {
+    AbsoluteAngle = 1 << 0,
+    CurveInward = 1 << 1,
+    CurveOutward = 1 << 2,
+  };
+};
+
+static_assert(sizeof(PackedTrigger) == 16);
+
+// Returns false if a field of t doesn't fit
+inline bool packTrigger(const Trigger &t, PackedTrigger *p) {
+  const u32 knownFlags = Trigger::AbsoluteAngle | Trigger::CurveInward |
+                         Trigger::CurveOutward;
+  if (t.x < INT16_MIN || t.x > INT16_MAX || t.y < INT16_MIN ||
+      t.y > INT16_MAX || t.angle > UINT16_MAX || t.type > UINT8_MAX ||
+      (t.flags & ~knownFlags) != 0)
+    return false;
+
+  p->tick = t.tick;
+  p->id = t.id;
+  p->x = t.x;
+  p->y = t.y;
+  p->angle = t.angle;
+  p->type = t.type;
+  p->flags = 0;
+  if (t.flags & Trigger::AbsoluteAngle)
+    p->flags |= PackedTrigger::AbsoluteAngle;
+  if (t.flags & Trigger::CurveInward)
+    p->flags |= PackedTrigger::CurveInward;
+  if (t.flags & Trigger::CurveOutward)
+    p->flags |= PackedTrigger::CurveOutward;
+  return true;
+}
+
+inline Trigger unpackTrigger(const PackedTrigger &p) {
+  Trigger t;
+  t.tick = p.tick;
+  t.type = Trigger::Type(p.type);
+  t.x = p.x;
+  t.y = p.y;
+  t.angle = p.angle;
+  u32 flags = Trigger::None;
+  if (p.flags & PackedTrigger::AbsoluteAngle)
+    flags |= Trigger::AbsoluteAngle;
+  if (p.flags & PackedTrigger::CurveInward)
+    flags |= Trigger::CurveInward;
+  if (p.flags & PackedTrigger::CurveOutward)
+    flags |= Trigger::CurveOutward;
+  t.flags = Trigger::Flag(flags);
+  t.id = p.id;
+  return t;
+}
+
+// Read-only view of packed triggers as Triggers, like the trigger vector of a
+// Track, so that code over tracks works on both
+struct PackedTriggers {
+  // Triggers are unpacked on the fly and returned by value, which only input
+  // iterators may do; the arithmetic is there for index math
+  struct Iterator {
+    typedef std::input_iterator_tag iterator_category;
+    typedef Trigger value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef void pointer;
+    typedef Trigger reference;
+
+    const PackedTrigger *p;
+
+    Trigger operator*() const { return unpackTrigger(*p); }
+    Trigger operator[](difference_type n) const { return unpackTrigger(p[n]); }
+    Iterator &operator++() {
+      ++p;
+      return *this;
+    }
+    Iterator operator++(int) { return Iterator{p++}; }
+    Iterator &operator--() {
+      --p;
+      return *this;
+    }
+    Iterator operator--(int) { return Iterator{p--}; }
+    Iterator &operator+=(difference_type n) {
+      p += n;
+      return *this;
+    }
+    Iterator &operator-=(difference_type n) {
+      p -= n;
+      return *this;
+    }
+    Iterator operator+(difference_type n) const { return Iterator{p + n}; }
+    Iterator operator-(difference_type n) const { return Iterator{p - n}; }
+    difference_type operator-(const Iterator &o) const { return p - o.p; }
+    bool operator==(const Iterator &o) const { return p == o.p; }
+    bool operator!=(const Iterator &o) const { return p != o.p; }
+    bool operator<(const Iterator &o) const { return p < o.p; }
+    bool operator>(const Iterator &o) const { return p > o.p; }
+    bool operator<=(const Iterator &o) const { return p <= o.p; }
+    bool operator>=(const Iterator &o) const { return p >= o.p; }
+  };
+
+  std::vector<PackedTrigger> packed;
+
+  usize size() const { return packed.size(); }
+  bool empty() const { return packed.empty(); }
+  Trigger operator[](usize i) const { return unpackTrigger(packed[i]); }
+  Iterator begin() const { return Iterator{packed.data()}; }
+  Iterator end() const { return Iterator{packed.data() + packed.size()}; }
+};
+
+// Track with packed triggers.  Same header as Track.
+struct PackedTrack {
+  Track::Type trackType;
+  u32 tickCount;
+  u32 tickStart;
+  u32 tickEnd;
+  u32 featureZoneStart;
+  u32 featureZoneEnd;
+  u32 summonStart;
+  u32 summonEnd;
+  u32 summonTrigger;
+  u32 triggerCount;
+
+  PackedTriggers triggers;
+
+  bool isBMS() const { return trackType == Track::BMS; }
+  bool isFMS() const { return trackType == Track::FMS; }
+  bool isEMS() const { return trackType == Track::EMS; }
+};
+
+// Lossless conversions.  Return false, leaving packed incomplete, if a
+// trigger doesn't fit.
+bool packTrack(const Track &track, PackedTrack *packed);
+void unpackTrack(const PackedTrack &packed, Track *track);
+
+// Straight from and to uncompressed trigger data, without going through a
+// Track.  Parsing returns false on malformed data or triggers that don't
+// fit, rather than asserting; ids are 0.  Writing stores the track as is,
+// so parsing then writing gives back the same bytes.
+bool parsePackedTrack(const u8 *raw, u32 rawSize, PackedTrack *track);
+usize getTrackRawSize(const PackedTrack &track);
+void writePackedTrack(const PackedTrack &track, u8 *raw, u32 rawSize);
+
+} // namespace rideau
+
+#endif
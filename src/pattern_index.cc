@@ -0,0 +1,572 @@
+#include "pattern_index.h"
+
+#include "file_utils.h"
+#include "packed_track.h"
+#include "track_file.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace rideau {
+
+static const u32 INDEX_MAGIC = 0x49504452; // "RDPI"
+static const u32 INDEX_VERSION = 1;
+
+static const u32 TOKEN_BITS = 12;
+static const u32 LANE_COUNT = 8;
+static const u32 ANGLE_COUNT = 8;
+static const u32 ALL_TYPES = (1 << Trigger::TrackGuide) - 1;
+static const u32 ALL_LANES = (1 << LANE_COUNT) - 1;
+static const u32 ALL_ANGLES = (1 << ANGLE_COUNT) - 1;
+
+static const char *const TYPE_KEYWORDS[] = {
+    "touch", "slide", "hold", "holdlet", "end", "endslide"};
+
+static u32 getGapBucket(u32 gap) {
+  u32 b = 0;
+  while (b < ARRAY_SIZE(TICK_BUCKETS) && gap > TICK_BUCKETS[b])
+    ++b;
+  return b;
+}
+
+static u32 getLane(Track::Type trackType, s32 y) {
+  if (trackType == Track::BMS)
+    return std::min((u32)std::max(y, 0), LANE_COUNT - 1);
+  if (trackType == Track::FMS)
+    return std::min((u32)std::max(y, 0) / 21, LANE_COUNT - 1);
+  return 0;
+}
+
+static u32 getAngleBucket(u32 degrees) {
+  return (degrees % 360 + 22) / 45 % ANGLE_COUNT;
+}
+
+u16 getPatternToken(Track::Type trackType, const Trigger &t, u32 gap) {
+  return (t.type & 7) | getLane(trackType, t.y) << 3 |
+         getAngleBucket(t.angle) << 6 | getGapBucket(gap) << 9;
+}
+
+static u32 tokenType(u16 token) { return token & 7; }
+static u32 tokenLane(u16 token) { return (token >> 3) & 7; }
+static u32 tokenAngle(u16 token) { return (token >> 6) & 7; }
+static u32 tokenGapBucket(u16 token) { return (token >> 9) & 7; }
+
+static u64 getTrigramKey(u16 a, u16 b, u16 c) {
+  return (u64)a << (2 * TOKEN_BITS) | (u64)b << TOKEN_BITS | c;
+}
+
+void buildPatternIndex(const std::vector<std::string> &files, ThreadPool *pool,
+                       PatternIndex *index) {
+  ENSURE(pool != nullptr);
+  ENSURE(index != nullptr);
+
+  // Tokenize every file on its own
+  struct Tokenized {
+    bool ok;
+    Track::Type trackType;
+    std::vector<u16> tokens;
+    std::vector<u32> ticks;
+  };
+  std::vector<Tokenized> tokenized(files.size());
+  pool->parallelFor(files.size(), [&](usize i) {
+    Tokenized &out = tokenized[i];
+    PackedTrack track;
+    out.ok = parsePackedTrackFile(files[i].c_str(), &track);
+    if (!out.ok)
+      return;
+    out.trackType = track.trackType;
+
+    std::vector<Trigger> triggers;
+    triggers.reserve(track.triggerCount);
+    for (const Trigger t : track.triggers) {
+      if (t.type != Trigger::TrackGuide)
+        triggers.push_back(t);
+    }
+    std::stable_sort(
+        triggers.begin(), triggers.end(),
+        [](const Trigger &a, const Trigger &b) { return a.tick < b.tick; });
+
+    u32 previousTick = 0;
+    for (const Trigger &t : triggers) {
+      out.tokens.push_back(
+          getPatternToken(track.trackType, t, t.tick - previousTick));
+      out.ticks.push_back(t.tick);
+      previousTick = t.tick;
+    }
+  });
+
+  index->tracks.clear();
+  index->tokens.clear();
+  index->ticks.clear();
+  for (usize i = 0; i < files.size(); ++i) {
+    const Tokenized &t = tokenized[i];
+    if (!t.ok) {
+      fprintf(stderr, "%s: cannot read trigger file\n", files[i].c_str());
+      continue;
+    }
+    index->tracks.push_back(PatternIndex::IndexedTrack{
+        files[i], t.trackType, (u32)index->tokens.size(),
+        (u32)t.tokens.size()});
+    index->tokens.insert(index->tokens.end(), t.tokens.begin(),
+                         t.tokens.end());
+    index->ticks.insert(index->ticks.end(), t.ticks.begin(), t.ticks.end());
+  }
+
+  // Group trigram occurrences by key, within tracks only
+  struct Occurrence {
+    u64 key;
+    u32 position;
+  };
+  std::vector<Occurrence> occurrences;
+  occurrences.reserve(index->tokens.size());
+  for (const PatternIndex::IndexedTrack &track : index->tracks) {
+    for (u32 p = track.first; p + 2 < track.first + track.count; ++p) {
+      const u16 *t = &index->tokens[p];
+      occurrences.push_back(Occurrence{getTrigramKey(t[0], t[1], t[2]), p});
+    }
+  }
+  std::sort(occurrences.begin(), occurrences.end(),
+            [](const Occurrence &a, const Occurrence &b) {
+              return a.key != b.key ? a.key < b.key
+                                    : a.position < b.position;
+            });
+
+  index->trigrams.clear();
+  index->positions.resize(occurrences.size());
+  for (usize i = 0; i < occurrences.size(); ++i) {
+    if (i == 0 || occurrences[i].key != occurrences[i - 1].key)
+      index->trigrams.push_back(
+          PatternIndex::Trigram{occurrences[i].key, (u32)i, 0});
+    ++index->trigrams.back().count;
+    index->positions[i] = occurrences[i].position;
+  }
+}
+
+static void writeu64le(FILE *f, u64 x) {
+  writeu32le(f, x & 0xFFFFFFFF);
+  writeu32le(f, x >> 32);
+}
+
+bool writePatternIndex(const PatternIndex &index, const char *filename) {
+  // Write then rename, so a concurrent reader never sees a partial file
+  const std::string tmpFilename = std::string(filename) + ".tmp";
+  FILE *f = fopen(tmpFilename.c_str(), "wb");
+  if (f == nullptr) {
+    fprintf(stderr, "Cannot write %s\n", filename);
+    return false;
+  }
+
+  writeu32le(f, INDEX_MAGIC);
+  writeu32le(f, INDEX_VERSION);
+
+  writeu32le(f, index.tracks.size());
+  for (const PatternIndex::IndexedTrack &t : index.tracks) {
+    writeu32le(f, t.filename.size());
+    fwrite(t.filename.data(), 1, t.filename.size(), f);
+    writeu32le(f, t.trackType);
+    writeu32le(f, t.first);
+    writeu32le(f, t.count);
+  }
+
+  writeu32le(f, index.tokens.size());
+  for (u16 token : index.tokens)
+    writeu32le(f, token);
+  for (u32 tick : index.ticks)
+    writeu32le(f, tick);
+
+  writeu32le(f, index.trigrams.size());
+  for (const PatternIndex::Trigram &t : index.trigrams) {
+    writeu64le(f, t.key);
+    writeu32le(f, t.first);
+    writeu32le(f, t.count);
+  }
+  writeu32le(f, index.positions.size());
+  for (u32 p : index.positions)
+    writeu32le(f, p);
+
+  const bool ok = !ferror(f);
+  if (fclose(f) != 0 || !ok ||
+      rename(tmpFilename.c_str(), filename) != 0) {
+    fprintf(stderr, "Cannot write %s\n", filename);
+    remove(tmpFilename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readPatternIndex(const char *filename, PatternIndex *index) {
+  ENSURE(index != nullptr);
+
+  usize size;
+  u8 *data = readFileContents(filename, &size);
+  if (data == nullptr) {
+    fprintf(stderr, "Cannot read %s\n", filename);
+    return false;
+  }
+
+  // Every read is bounds checked, the file may be truncated
+  const u8 *p = data;
+  const u8 *const end = data + size;
+  bool ok = true;
+  auto has = [&](usize bytes) {
+    ok = ok && (usize)(end - p) >= bytes;
+    return ok;
+  };
+  auto read = [&]() -> u32 { return has(sizeof(u32)) ? readu32le(&p) : 0; };
+
+  ok = read() == INDEX_MAGIC && read() == INDEX_VERSION;
+
+  // A track takes at least its name length, type, first and count
+  const u32 tracksCount = ok ? read() : 0;
+  ok = ok && has((usize)tracksCount * 4 * sizeof(u32));
+  index->tracks.resize(ok ? tracksCount : 0);
+  for (PatternIndex::IndexedTrack &t : index->tracks) {
+    const u32 length = read();
+    if (!has(length))
+      break;
+    t.filename.assign((const char *)p, length);
+    p += length;
+    const u32 trackType = read();
+    ok = ok && trackType < Track::Count;
+    t.trackType = Track::Type(ok ? trackType : 0);
+    t.first = read();
+    t.count = read();
+  }
+
+  const u32 tokensCount = read();
+  ok = ok && has((usize)tokensCount * 2 * sizeof(u32));
+  index->tokens.resize(ok ? tokensCount : 0);
+  index->ticks.resize(ok ? tokensCount : 0);
+  for (u16 &token : index->tokens)
+    token = readu32le(&p);
+  for (u32 &tick : index->ticks)
+    tick = readu32le(&p);
+
+  const u32 trigramsCount = read();
+  ok = ok && has((usize)trigramsCount * 4 * sizeof(u32));
+  index->trigrams.resize(ok ? trigramsCount : 0);
+  for (PatternIndex::Trigram &t : index->trigrams) {
+    const u64 lo = readu32le(&p);
+    const u64 hi = readu32le(&p);
+    t.key = lo | hi << 32;
+    t.first = readu32le(&p);
+    t.count = readu32le(&p);
+  }
+
+  const u32 positionsCount = read();
+  ok = ok && has((usize)positionsCount * sizeof(u32));
+  index->positions.resize(ok ? positionsCount : 0);
+  for (u32 &position : index->positions)
+    position = readu32le(&p);
+
+  // Nothing may point out of the arrays
+  for (const PatternIndex::IndexedTrack &t : index->tracks)
+    ok = ok && (u64)t.first + t.count <= tokensCount;
+  for (const PatternIndex::Trigram &t : index->trigrams)
+    ok = ok && (u64)t.first + t.count <= positionsCount;
+  for (u32 position : index->positions)
+    ok = ok && (u64)position + 2 < tokensCount;
+
+  free(data);
+  if (!ok)
+    fprintf(stderr, "%s is not a pattern index\n", filename);
+  return ok;
+}
+
+static bool parseValues(const std::string &values, std::vector<u32> *out) {
+  usize start = 0;
+  while (start <= values.size()) {
+    usize bar = values.find('|', start);
+    if (bar == std::string::npos)
+      bar = values.size();
+    const std::string value = values.substr(start, bar - start);
+    char *valueEnd;
+    const unsigned long v = strtoul(value.c_str(), &valueEnd, 10);
+    if (value.empty() || *valueEnd != '\0' || v > UINT32_MAX)
+      return false;
+    out->push_back(v);
+    start = bar + 1;
+  }
+  return true;
+}
+
+static bool parseElement(const std::string &text, PatternElement *e,
+                         std::string *error) {
+  e->isSkip = text == "...";
+  e->types = ALL_TYPES;
+  e->lanes = ALL_LANES;
+  e->angles = ALL_ANGLES;
+  e->minGap = 0;
+  e->maxGap = UINT32_MAX;
+  e->laneVar = 0;
+  e->isLaneVarDifferent = false;
+  if (e->isSkip)
+    return true;
+
+  // Types, then constraints
+  std::vector<std::string> parts;
+  usize start = 0;
+  while (start <= text.size()) {
+    usize colon = text.find(':', start);
+    if (colon == std::string::npos)
+      colon = text.size();
+    parts.push_back(text.substr(start, colon - start));
+    start = colon + 1;
+  }
+
+  if (parts[0] != "*") {
+    e->types = 0;
+    usize typeStart = 0;
+    while (typeStart <= parts[0].size()) {
+      usize bar = parts[0].find('|', typeStart);
+      if (bar == std::string::npos)
+        bar = parts[0].size();
+      const std::string name = parts[0].substr(typeStart, bar - typeStart);
+      u32 type = 0;
+      while (type < ARRAY_SIZE(TYPE_KEYWORDS) && name != TYPE_KEYWORDS[type])
+        ++type;
+      if (type == ARRAY_SIZE(TYPE_KEYWORDS)) {
+        *error = "unknown trigger type '" + name + "'";
+        return false;
+      }
+      e->types |= 1 << type;
+      typeStart = bar + 1;
+    }
+  }
+
+  for (usize i = 1; i < parts.size(); ++i) {
+    const std::string &c = parts[i];
+    const usize opAt = c.find_first_of("<>!=");
+    const usize valueAt = c.find_first_not_of("<>!=", opAt);
+    if (opAt == std::string::npos || valueAt == std::string::npos) {
+      *error = "expected KEY OP VALUE in '" + c + "'";
+      return false;
+    }
+    const std::string key = c.substr(0, opAt);
+    const std::string op = c.substr(opAt, valueAt - opAt);
+    const std::string value = c.substr(valueAt);
+
+    if (key == "lane" && value.size() == 1 && value[0] >= 'A' &&
+        value[0] <= 'Z' && (op == "=" || op == "!=")) {
+      e->laneVar = value[0];
+      e->isLaneVarDifferent = op == "!=";
+      continue;
+    }
+
+    std::vector<u32> values;
+    if (!parseValues(value, &values)) {
+      *error = "expected numbers in '" + c + "'";
+      return false;
+    }
+
+    if (key == "lane" && op == "=") {
+      e->lanes = 0;
+      for (u32 v : values)
+        e->lanes |= v < LANE_COUNT ? 1 << v : 0;
+    } else if (key == "angle" && op == "=") {
+      e->angles = 0;
+      for (u32 v : values)
+        e->angles |= 1 << getAngleBucket(v);
+    } else if (key == "dt" && values.size() == 1) {
+      const u32 v = values[0];
+      if (op == "=") {
+        e->minGap = v;
+        e->maxGap = v;
+      } else if (op == "<=") {
+        e->maxGap = v;
+      } else if (op == "<" && v > 0) {
+        e->maxGap = v - 1;
+      } else if (op == ">=") {
+        e->minGap = v;
+      } else if (op == ">" && v < UINT32_MAX) {
+        e->minGap = v + 1;
+      } else {
+        *error = "unknown comparison in '" + c + "'";
+        return false;
+      }
+    } else {
+      *error = "unknown constraint '" + c + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool parsePatternQuery(const char *text, PatternQuery *query,
+                       std::string *error) {
+  ENSURE(text != nullptr);
+  ENSURE(query != nullptr);
+  ENSURE(error != nullptr);
+
+  query->elements.clear();
+  const std::string s = text;
+  usize start = s.find_first_not_of(' ');
+  while (start != std::string::npos) {
+    usize space = s.find(' ', start);
+    PatternElement e;
+    if (!parseElement(s.substr(start, space - start), &e, error))
+      return false;
+    if (e.isSkip && !query->elements.empty() &&
+        query->elements.back().isSkip) {
+      *error = "two ... in a row";
+      return false;
+    }
+    query->elements.push_back(e);
+    start = s.find_first_not_of(' ', space);
+  }
+
+  if (query->elements.empty() || query->elements.front().isSkip ||
+      query->elements.back().isSkip) {
+    *error = "queries start and end with a trigger";
+    return false;
+  }
+  return true;
+}
+
+static bool matchesToken(const PatternElement &e, u16 token, u32 gap) {
+  return (e.types >> tokenType(token) & 1) &&
+         (e.lanes >> tokenLane(token) & 1) &&
+         (e.angles >> tokenAngle(token) & 1) && gap >= e.minGap &&
+         gap <= e.maxGap;
+}
+
+// Match elements from element ei at position p, up to end.  vars holds lane
+// variables bound so far, or -1.
+static bool matchAt(const PatternIndex &index, const PatternQuery &query,
+                    u32 ei, u32 p, u32 first, u32 end, s32 vars[26]) {
+  if (ei == query.elements.size())
+    return true;
+
+  const PatternElement &e = query.elements[ei];
+  if (e.isSkip) {
+    // Up to the nearest trigger of the next types, e.g. the end of a hold,
+    // whether the rest matches there or not
+    const u32 nextTypes = query.elements[ei + 1].types;
+    for (u32 skipped = 0;
+         skipped <= PatternQuery::MAX_SKIPPED && p + skipped < end;
+         ++skipped) {
+      if (nextTypes >> tokenType(index.tokens[p + skipped]) & 1)
+        return matchAt(index, query, ei + 1, p + skipped, first, end, vars);
+    }
+    return false;
+  }
+
+  if (p >= end)
+    return false;
+  const u16 token = index.tokens[p];
+  const u32 gap = p > first ? index.ticks[p] - index.ticks[p - 1]
+                            : index.ticks[p];
+  if (!matchesToken(e, token, gap))
+    return false;
+
+  if (e.laneVar == 0)
+    return matchAt(index, query, ei + 1, p + 1, first, end, vars);
+
+  s32 &var = vars[e.laneVar - 'A'];
+  const s32 lane = tokenLane(token);
+  if (var < 0) {
+    // Bind, and unbind if the rest doesn't match
+    if (e.isLaneVarDifferent)
+      return false;
+    var = lane;
+    if (matchAt(index, query, ei + 1, p + 1, first, end, vars))
+      return true;
+    var = -1;
+    return false;
+  }
+  if ((var == lane) == e.isLaneVarDifferent)
+    return false;
+  return matchAt(index, query, ei + 1, p + 1, first, end, vars);
+}
+
+// Whether a token may match e, from its gap bucket rather than the gap
+static bool mayMatchToken(const PatternElement &e, u16 token) {
+  const u32 bucket = tokenGapBucket(token);
+  const u32 low = bucket == 0 ? 0 : TICK_BUCKETS[bucket - 1] + 1;
+  const u32 high = bucket < ARRAY_SIZE(TICK_BUCKETS) ? TICK_BUCKETS[bucket]
+                                                     : UINT32_MAX;
+  return (e.types >> tokenType(token) & 1) &&
+         (e.lanes >> tokenLane(token) & 1) &&
+         (e.angles >> tokenAngle(token) & 1) && low <= e.maxGap &&
+         e.minGap <= high;
+}
+
+static u32 findTrack(const PatternIndex &index, u32 position) {
+  auto it = std::upper_bound(
+      index.tracks.begin(), index.tracks.end(), position,
+      [](u32 p, const PatternIndex::IndexedTrack &t) { return p < t.first; });
+  return it - index.tracks.begin() - 1;
+}
+
+void findPattern(const PatternIndex &index, const PatternQuery &query,
+                 std::vector<PatternMatch> *matches) {
+  ENSURE(matches != nullptr);
+  matches->clear();
+
+  const std::vector<PatternElement> &elements = query.elements;
+
+  // Pick the three consecutive elements with the fewest occurrences, among
+  // those before any skip so that matches start a known number of triggers
+  // earlier
+  const u32 mask = (1 << TOKEN_BITS) - 1;
+  std::vector<const PatternIndex::Trigram *> best, found;
+  u32 bestAt = 0;
+  usize bestCount = SIZE_MAX;
+  for (u32 i = 0; i + 2 < elements.size() && !elements[i + 2].isSkip; ++i) {
+    if (elements[i].isSkip || elements[i + 1].isSkip)
+      break;
+
+    found.clear();
+    usize count = 0;
+    for (const PatternIndex::Trigram &t : index.trigrams) {
+      if (mayMatchToken(elements[i], t.key >> (2 * TOKEN_BITS) & mask) &&
+          mayMatchToken(elements[i + 1], t.key >> TOKEN_BITS & mask) &&
+          mayMatchToken(elements[i + 2], t.key & mask)) {
+        found.push_back(&t);
+        count += t.count;
+      }
+    }
+    if (count < bestCount) {
+      bestCount = count;
+      bestAt = i;
+      best.swap(found);
+    }
+  }
+
+  s32 vars[26];
+  auto tryAt = [&](u32 track, u32 start) {
+    const PatternIndex::IndexedTrack &t = index.tracks[track];
+    std::fill(vars, vars + 26, -1);
+    if (matchAt(index, query, 0, start, t.first, t.first + t.count, vars))
+      matches->push_back(PatternMatch{track, index.ticks[start]});
+  };
+
+  if (bestCount == SIZE_MAX) {
+    // Nothing to look up, go through everything
+    for (u32 track = 0; track < index.tracks.size(); ++track) {
+      const PatternIndex::IndexedTrack &t = index.tracks[track];
+      for (u32 p = t.first; p < t.first + t.count; ++p)
+        tryAt(track, p);
+    }
+    return;
+  }
+
+  std::vector<u32> starts;
+  starts.reserve(bestCount);
+  for (const PatternIndex::Trigram *t : best) {
+    for (u32 i = t->first; i < t->first + t->count; ++i)
+      starts.push_back(index.positions[i]);
+  }
+  std::sort(starts.begin(), starts.end());
+
+  for (u32 p : starts) {
+    const u32 track = findTrack(index, p);
+    if (p - index.tracks[track].first < bestAt)
+      continue;
+    tryAt(track, p - bestAt);
+  }
+}
+
+} // namespace rideau
@@ -0,0 +1,104 @@
+#ifndef PATTERN_INDEX_H
+#define PATTERN_INDEX_H
+
+#include "thread_pool.h"
+#include "track.h"
+#include "utils.h"
+
+#include <string>
+#include <vector>
+
+namespace rideau {
+
+// Triggers of many charts reduced to tokens, with an index of every three
+// consecutive tokens, to find patterns across a whole game in milliseconds.
+// Track guides are left out.  A token packs, from the low bits:
+//
+//    Bits   Role
+//    ---------------------------------------------------------------
+//    0-2    Trigger type
+//    3-5    Lane: BMS lane, FMS position in fifths, 0 in EMS
+//    6-8    Angle, in eighths of a turn
+//    9-11   Ticks since the previous trigger, in buckets (TICK_BUCKETS)
+struct PatternIndex {
+  struct IndexedTrack {
+    std::string filename;
+    Track::Type trackType;
+    u32 first; // position of the first token
+    u32 count;
+  };
+
+  struct Trigram {
+    u64 key; // three tokens
+    u32 first; // in positions
+    u32 count;
+  };
+
+  std::vector<IndexedTrack> tracks;
+  std::vector<u16> tokens; // of all tracks, one after the other
+  std::vector<u32> ticks;  // of each token
+  std::vector<Trigram> trigrams; // sorted by key
+  std::vector<u32> positions;    // of each trigram's occurrences
+};
+
+// Upper bounds of the tick gap buckets; the last bucket takes the rest
+static const u32 TICK_BUCKETS[] = {0, 8, 15, 30, 60};
+
+u16 getPatternToken(Track::Type trackType, const Trigger &t, u32 gap);
+
+// Tokenize files on pool.  Files that can't be read are reported and skipped.
+void buildPatternIndex(const std::vector<std::string> &files, ThreadPool *pool,
+                       PatternIndex *index);
+bool writePatternIndex(const PatternIndex &index, const char *filename);
+bool readPatternIndex(const char *filename, PatternIndex *index);
+
+// Query: a sequence of elements, separated by spaces, matching consecutive
+// triggers:
+//
+//    TYPES[:KEY OP VALUES]...   a trigger, e.g. slide:angle=90|270
+//    ...                        up to MAX_SKIPPED triggers, until the first
+//                               of the types of the next element
+//
+// TYPES is * or type names joined by |: touch, slide, hold, holdlet, end,
+// endslide.  Keys:
+//
+//    lane=N|N...   lane (BMS) or fifth of the height (FMS)
+//    lane=X        any lane, the same for every element with variable X (a
+//    lane!=X       capital letter); != asks for a different one
+//    angle=D|D...  angle in degrees, to the nearest eighth of a turn
+//    dt<=N dt>=N   ticks since the previous trigger, also <, >, =
+struct PatternElement {
+  bool isSkip;
+  u32 types;  // bit per trigger type
+  u32 lanes;  // bit per lane
+  u32 angles; // bit per eighth of a turn
+  u32 minGap;
+  u32 maxGap;
+  char laneVar; // 0 if none
+  bool isLaneVarDifferent;
+};
+
+struct PatternQuery {
+  static const u32 MAX_SKIPPED = 16;
+
+  std::vector<PatternElement> elements;
+};
+
+// Returns false, with a reason in error, if text is not a valid query
+bool parsePatternQuery(const char *text, PatternQuery *query,
+                       std::string *error);
+
+struct PatternMatch {
+  u32 track; // in index.tracks
+  u32 tick;  // of the first trigger matched
+};
+
+// Matches in track order, then by tick.  Looks up the most selective three
+// elements in a row in the index; queries that start with fewer than three
+// before a skip scan every track instead.
+void findPattern(const PatternIndex &index, const PatternQuery &query,
+                 std::vector<PatternMatch> *matches);
+
+} // namespace rideau
+
+#endif
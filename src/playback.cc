@@ -0,0 +1,171 @@
+#include "playback.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace rideau {
+
+void Playback::init(float *songSamples[2], usize songFramesCount,
+                    u32 songSampleRate) {
+  isPlaying = false;
+  currentFrame = 0;
+  volume = 0.5f;
+
+  speed = 1.0f;
+  isLooping = false;
+  loopStart = 0;
+  loopEnd = songFramesCount;
+
+  load = 0.0f;
+  loadPeak = 0.0f;
+  underflows = 0;
+
+  sampleRate = songSampleRate;
+  samples[0] = songSamples[0];
+  samples[1] = songSamples[1];
+  framesCount = songFramesCount;
+
+  hitsounds.init(sampleRate);
+  stretcher.init();
+}
+
+void Playback::deinit() {
+  samples[0] = samples[1] = nullptr;
+
+  hitsounds.deinit();
+}
+
+void Playback::measureLoad(float elapsedUs, u32 frameCount) {
+  if (frameCount == 0)
+    return;
+
+  const float budgetUs = frameCount * 1e6f / sampleRate;
+  const float l = elapsedUs / budgetUs;
+  load = l;
+  if (l > loadPeak)
+    loadPeak = l;
+}
+
+// Play the song as is from currentFrame, wrapping around the loop region if
+// any.  Returns the number of frames rendered before the end of the song.
+static u32 renderSong(Playback *playback, float *out[2], u32 frameCount,
+                      usize *currentFrame, usize loopStart, usize loopEnd,
+                      float volume) {
+  const usize framesCount = playback->framesCount;
+
+  u32 done = 0;
+  while (done < frameCount) {
+    const bool inLoop = loopEnd > loopStart && *currentFrame < loopEnd;
+    const usize end = inLoop ? loopEnd : framesCount;
+    if (*currentFrame >= end)
+      break;
+
+    const u32 n = std::min((usize)(frameCount - done), end - *currentFrame);
+    for (int c = 0; c < 2; ++c) {
+      const float *src = playback->samples[c] + *currentFrame;
+      for (u32 i = 0; i < n; ++i)
+        out[c][done + i] = src[i] * volume;
+    }
+
+    float *dst[2] = {out[0] + done, out[1] + done};
+    playback->hitsounds.mix(dst, n, *currentFrame);
+
+    *currentFrame += n;
+    done += n;
+
+    if (inLoop && *currentFrame == loopEnd) {
+      *currentFrame = loopStart;
+      playback->hitsounds.jump();
+    }
+  }
+
+  return done;
+}
+
+// Same as renderSong, but at a different speed through the time-stretcher
+static u32 renderStretchedSong(Playback *playback, float *out[2],
+                               u32 frameCount, usize *currentFrame,
+                               usize loopStart, usize loopEnd, float volume,
+                               float speed) {
+  TimeStretcher &stretcher = playback->stretcher;
+  if ((usize)stretcher.playPos != *currentFrame)
+    stretcher.reset(*currentFrame);
+
+  // Stop at the loop end, so that hitsounds past a wrap are mixed from the
+  // loop start
+  u32 done = 0;
+  while (done < frameCount) {
+    const bool inLoop = loopEnd > loopStart && *currentFrame < loopEnd;
+    u32 n = frameCount - done;
+    if (inLoop) {
+      const double untilEnd = ceil((loopEnd - stretcher.playPos) / speed);
+      n = (u32)std::clamp(untilEnd, 1.0, (double)n);
+    }
+
+    float *dst[2] = {out[0] + done, out[1] + done};
+    const u32 rendered = stretcher.process(
+        playback->samples, playback->framesCount, speed, inLoop ? loopStart : 0,
+        inLoop ? loopEnd : 0, dst, n);
+    for (int c = 0; c < 2; ++c) {
+      for (u32 i = 0; i < rendered; ++i)
+        dst[c][i] *= volume;
+    }
+
+    playback->hitsounds.mix(dst, rendered, *currentFrame, speed);
+
+    const usize nextFrame =
+        std::min((usize)stretcher.playPos, playback->framesCount);
+    if (nextFrame < *currentFrame)
+      playback->hitsounds.jump();
+    *currentFrame = nextFrame;
+
+    done += rendered;
+    if (rendered < n)
+      break;
+  }
+
+  return done;
+}
+
+void renderPlayback(Playback *playback, float *out[2], u32 frameCount) {
+  u32 songFrames = 0;
+
+  if (playback->isPlaying) {
+    const usize startFrame = playback->currentFrame;
+    usize currentFrame = startFrame;
+    const float volume = playback->volume;
+    const float speed = playback->speed;
+
+    usize loopStart = 0;
+    usize loopEnd = 0;
+    if (playback->hasLoopRegion()) {
+      loopStart = playback->loopStart;
+      loopEnd = playback->loopEnd;
+    }
+
+    if (speed == 1.0f)
+      songFrames = renderSong(playback, out, frameCount, &currentFrame,
+                              loopStart, loopEnd, volume);
+    else
+      songFrames = renderStretchedSong(playback, out, frameCount,
+                                       &currentFrame, loopStart, loopEnd,
+                                       volume, speed);
+
+    if (songFrames < frameCount || currentFrame >= playback->framesCount) {
+      currentFrame = playback->framesCount;
+      playback->isPlaying = false;
+    }
+
+    // Don't overwrite a seek from the main thread
+    usize expectedFrame = startFrame;
+    playback->currentFrame.compare_exchange_strong(expectedFrame,
+                                                   currentFrame);
+  }
+
+  for (int c = 0; c < 2; ++c)
+    memset(out[c] + songFrames, 0, (frameCount - songFrames) * sizeof(float));
+}
+
+} // namespace rideau
@@ -0,0 +1,60 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include "hitsounds.h"
+#include "timestretch.h"
+#include "utils.h"
+
+#include <atomic>
+
+namespace rideau {
+
+// Frames mixed at once by audio sinks
+static const u32 MIX_CHUNK_FRAMES = 512;
+
+// Song and hitsound playback state, shared by the editor and the audio sink
+// driving it.  Fields read by the audio thread are atomic.
+struct Playback {
+  std::atomic<bool> isPlaying;
+  std::atomic<usize> currentFrame;
+  std::atomic<float> volume;
+
+  // Practice mode
+  std::atomic<float> speed;
+  std::atomic<bool> isLooping;
+  std::atomic<usize> loopStart;
+  std::atomic<usize> loopEnd;
+
+  // Measured by real-time sinks
+  std::atomic<float> load; // render time over buffer duration
+  std::atomic<float> loadPeak;
+  std::atomic<u32> underflows;
+
+  u32 sampleRate;
+  float *samples[2];
+  usize framesCount;
+
+  HitsoundMixer hitsounds;
+
+  // Used by the audio thread only
+  TimeStretcher stretcher;
+
+  // Samples stay owned by the caller, and must outlive playback
+  void init(float *songSamples[2], usize songFramesCount, u32 songSampleRate);
+  void deinit();
+
+  bool hasLoopRegion() const {
+    return isLooping && loopStart < loopEnd && loopEnd <= framesCount;
+  }
+
+  void measureLoad(float elapsedUs, u32 frameCount);
+};
+
+// Render frameCount frames of song and hitsounds into out, and advance the
+// playback position.  Renders silence when not playing.  Called from the audio
+// thread; doesn't allocate or lock.
+void renderPlayback(Playback *playback, float *out[2], u32 frameCount);
+
+} // namespace rideau
+
+#endif
@@ -0,0 +1,151 @@
+#include "profiler.h"
+
+#include "imgui.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+namespace rideau {
+
+static const char *const ZONE_NAMES[Profiler::ZoneCount] = {
+    "Input", "Sort triggers", "Draw track (EMS)", "Draw track (BMS/FMS)",
+    "ImGui render", "Swap", "Audio callback",
+};
+
+static const char *const THREAD_NAMES[Profiler::ThreadCount] = {
+    "Main",
+    "Audio",
+};
+
+static u64 steadyNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Profiler::init() {
+  originNs = steadyNs();
+  audioHead = 0;
+  audioTail = 0;
+  audioDropped = 0;
+  for (u32 z = 0; z < ZoneCount; ++z)
+    historyCount[z] = 0;
+  trace.resize(TRACE_SIZE);
+  traceCount = 0;
+}
+
+void Profiler::deinit() {
+  trace.clear();
+  trace.shrink_to_fit();
+}
+
+u64 Profiler::now() const { return steadyNs() - originNs; }
+
+void Profiler::record(Thread thread, Zone zone, u64 start, u64 end) {
+  const Sample sample = {start, (u32)std::min(end - start, (u64)UINT32_MAX),
+                         zone};
+
+  if (thread == MainThread) {
+    push(thread, sample);
+    return;
+  }
+
+  // Single producer queue, drop the sample if the main thread is behind
+  const u32 head = audioHead.load(std::memory_order_relaxed);
+  const u32 tail = audioTail.load(std::memory_order_acquire);
+  if (head - tail >= AUDIO_QUEUE_SIZE) {
+    audioDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  audioQueue[head & (AUDIO_QUEUE_SIZE - 1)] = sample;
+  audioHead.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::collect() {
+  const u32 head = audioHead.load(std::memory_order_acquire);
+  u32 tail = audioTail.load(std::memory_order_relaxed);
+  for (; tail != head; ++tail)
+    push(AudioThread, audioQueue[tail & (AUDIO_QUEUE_SIZE - 1)]);
+  audioTail.store(tail, std::memory_order_release);
+}
+
+void Profiler::push(Thread thread, const Sample &sample) {
+  const Zone z = sample.zone;
+  history[z][historyCount[z] % HISTORY_SIZE] = sample.durationNs * 1e-6f;
+  ++historyCount[z];
+
+  trace[traceCount % TRACE_SIZE] = TraceEvent{sample, thread};
+  ++traceCount;
+}
+
+bool Profiler::writeTrace(const char *filename) const {
+  FILE *f = fopen(filename, "w");
+  if (f == nullptr) {
+    fprintf(stderr, "Cannot write trace to %s\n", filename);
+    return false;
+  }
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (u32 t = 0; t < ThreadCount; ++t)
+    fprintf(f,
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+            "\"args\":{\"name\":\"%s\"}},\n",
+            t, THREAD_NAMES[t]);
+
+  // Oldest first; timestamps are in microseconds
+  const u32 count = std::min(traceCount, (u32)TRACE_SIZE);
+  for (u32 i = traceCount - count; i != traceCount; ++i) {
+    const TraceEvent &e = trace[i % TRACE_SIZE];
+    fprintf(f,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            ZONE_NAMES[e.sample.zone], e.thread, e.sample.startNs * 1e-3,
+            e.sample.durationNs * 1e-3, i + 1 != traceCount ? "," : "");
+  }
+  fprintf(f, "]}\n");
+
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Cannot write trace to %s\n", filename);
+    return false;
+  }
+  return true;
+}
+
+void Profiler::drawOverlay(bool *open) {
+  ImGui::SetNextWindowSize(ImVec2(420, 0), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Profiler", open)) {
+    ImGui::End();
+    return;
+  }
+
+  for (u32 z = 0; z < ZoneCount; ++z) {
+    const u32 count = std::min(historyCount[z], (u32)HISTORY_SIZE);
+    float sum = 0.0f;
+    float peak = 0.0f;
+    for (u32 i = 0; i < count; ++i) {
+      sum += history[z][i];
+      peak = std::max(peak, history[z][i]);
+    }
+    const float mean = count > 0 ? sum / count : 0.0f;
+
+    ImGui::Text("%-22s %6.3fms avg %6.3fms max", ZONE_NAMES[z], mean, peak);
+
+    // Oldest sample on the left once the history has wrapped
+    const u32 offset = historyCount[z] >= HISTORY_SIZE
+                           ? historyCount[z] % HISTORY_SIZE
+                           : 0;
+    ImGui::PushID(z);
+    ImGui::PlotHistogram("##zone", history[z], count, offset, nullptr, 0.0f,
+                         std::max(peak, 1.0f), ImVec2(-1, 32));
+    ImGui::PopID();
+  }
+
+  const u32 dropped = audioDropped.load(std::memory_order_relaxed);
+  if (dropped > 0)
+    ImGui::Text("%u audio callback timings dropped", dropped);
+
+  ImGui::End();
+}
+
+} // namespace rideau
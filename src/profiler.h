@@ -0,0 +1,97 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "utils.h"
+
+#include <atomic>
+#include <vector>
+
+namespace rideau {
+
+// Frame profiler.  Zones are timed on the main thread and in the audio
+// callback; the overlay shows recent timings of each zone, and the last few
+// seconds can be written out as a Chrome trace (chrome://tracing, Perfetto).
+struct Profiler {
+  enum Zone : u32 {
+    Input,
+    SortTriggers,
+    DrawTrackEms,
+    DrawTrackBms,
+    ImGuiRender,
+    Swap,
+    AudioCallback,
+    ZoneCount,
+  };
+
+  enum Thread : u32 {
+    MainThread,
+    AudioThread,
+    ThreadCount,
+  };
+
+  struct Sample {
+    u64 startNs; // since init
+    u32 durationNs;
+    Zone zone;
+  };
+
+  struct TraceEvent {
+    Sample sample;
+    Thread thread;
+  };
+
+  static const u32 HISTORY_SIZE = 256;   // samples per zone in the overlay
+  static const u32 TRACE_SIZE = 1 << 16; // events kept for export
+  // Power of two, so queue positions can wrap around
+  static const u32 AUDIO_QUEUE_SIZE = 1 << 10;
+
+  u64 originNs;
+
+  // Written by the audio thread only, drained by collect()
+  Sample audioQueue[AUDIO_QUEUE_SIZE];
+  std::atomic<u32> audioHead;
+  std::atomic<u32> audioTail;
+  std::atomic<u32> audioDropped;
+
+  // Main thread only
+  float history[ZoneCount][HISTORY_SIZE]; // milliseconds
+  u32 historyCount[ZoneCount];            // samples ever recorded
+  std::vector<TraceEvent> trace;          // ring buffer
+  u32 traceCount;                         // events ever recorded
+
+  void init();
+  void deinit();
+
+  u64 now() const;
+
+  // Record a zone that ran from start to end, as returned by now().  Lock
+  // and allocation free, so it can run in the audio callback.
+  void record(Thread thread, Zone zone, u64 start, u64 end);
+
+  // Move the audio thread samples into the history, once per frame
+  void collect();
+
+  bool writeTrace(const char *filename) const;
+
+  void drawOverlay(bool *open);
+
+private:
+  void push(Thread thread, const Sample &sample);
+};
+
+// Times the enclosing scope
+struct ProfileZone {
+  Profiler &profiler;
+  Profiler::Thread thread;
+  Profiler::Zone zone;
+  u64 start;
+
+  ProfileZone(Profiler &profiler, Profiler::Thread thread, Profiler::Zone zone)
+      : profiler(profiler), thread(thread), zone(zone),
+        start(profiler.now()) {}
+  ~ProfileZone() { profiler.record(thread, zone, start, profiler.now()); }
+};
+
+} // namespace rideau
+
+#endif
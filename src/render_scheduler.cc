@@ -0,0 +1,39 @@
+#include "render_scheduler.h"
+
+#include <GLFW/glfw3.h>
+
+namespace rideau {
+
+void RenderScheduler::init() {
+  lastFrameTime = glfwGetTime();
+  settleFrames = SETTLE_FRAMES;
+}
+
+void RenderScheduler::waitForFrame(GLFWwindow *window, Activity activity) {
+  const bool visible = glfwGetWindowAttrib(window, GLFW_FOCUSED) &&
+                       !glfwGetWindowAttrib(window, GLFW_ICONIFIED);
+
+  if (activity == Animating && visible) {
+    // Paced by vsync
+    glfwPollEvents();
+    settleFrames = SETTLE_FRAMES;
+  } else if (activity != Idle) {
+    const double remaining =
+        lastFrameTime + 1.0 / BACKGROUND_FPS - glfwGetTime();
+    if (remaining > 0.0)
+      glfwWaitEventsTimeout(remaining);
+    else
+      glfwPollEvents();
+    settleFrames = SETTLE_FRAMES;
+  } else if (settleFrames > 0) {
+    glfwPollEvents();
+    --settleFrames;
+  } else {
+    glfwWaitEventsTimeout(IDLE_TIMEOUT);
+    settleFrames = SETTLE_FRAMES - 1;
+  }
+
+  lastFrameTime = glfwGetTime();
+}
+
+} // namespace rideau
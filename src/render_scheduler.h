@@ -0,0 +1,39 @@
+#ifndef RENDER_SCHEDULER_H
+#define RENDER_SCHEDULER_H
+
+#include "utils.h"
+
+struct GLFWwindow;
+
+namespace rideau {
+
+// Decides when the main loop draws the next frame.  While idle it sleeps until
+// an input event arrives; playback and scrubbing render at full rate, and
+// background work, or playback in an unfocused window, at a reduced rate.
+struct RenderScheduler {
+  enum Activity : u32 {
+    Idle,       // nothing moves without input
+    Background, // background jobs are filling in the view
+    Animating,  // playback, seeking or a drag in progress
+  };
+
+  static constexpr double BACKGROUND_FPS = 15.0;
+  // Redraw this often when idle anyway, for clock-driven text such as the DSP
+  // load
+  static constexpr double IDLE_TIMEOUT = 0.5;
+  // ImGui needs a couple of frames to settle after an event (hover states,
+  // widget activation)
+  static const u32 SETTLE_FRAMES = 3;
+
+  double lastFrameTime;
+  u32 settleFrames;
+
+  void init();
+
+  // Process events, blocking until the next frame is due
+  void waitForFrame(GLFWwindow *window, Activity activity);
+};
+
+} // namespace rideau
+
+#endif
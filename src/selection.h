@@ -0,0 +1,59 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include "utils.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace rideau {
+
+// Set of selected trigger ids.  Ids are handed out densely by genId(), so a
+// bitset indexed by id gives O(1) membership, and bulk operations are linear
+// passes over the trigger list.
+struct TriggerSelection {
+  std::vector<u64> words;
+  usize count;
+
+  void init() {
+    words.clear();
+    count = 0;
+  }
+
+  bool contains(u32 id) const {
+    const usize word = id / 64;
+    return word < words.size() && (words[word] >> (id % 64) & 1);
+  }
+
+  void add(u32 id) {
+    const usize word = id / 64;
+    if (word >= words.size())
+      words.resize(word + 1, 0);
+    const u64 bit = (u64)1 << (id % 64);
+    count += (words[word] & bit) == 0;
+    words[word] |= bit;
+  }
+
+  void remove(u32 id) {
+    const usize word = id / 64;
+    if (word >= words.size())
+      return;
+    const u64 bit = (u64)1 << (id % 64);
+    count -= (words[word] & bit) != 0;
+    words[word] &= ~bit;
+  }
+
+  void clear() {
+    if (count == 0)
+      return;
+    std::fill(words.begin(), words.end(), 0);
+    count = 0;
+  }
+
+  usize size() const { return count; }
+  bool empty() const { return count == 0; }
+};
+
+} // namespace rideau
+
+#endif
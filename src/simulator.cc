@@ -0,0 +1,121 @@
+#include "simulator.h"
+
+#include "packed_track.h"
+
+#include <algorithm>
+
+namespace rideau {
+
+static const u32 JUDGEMENT_POINTS[] = {100, 70, 40, 10, 0};
+
+static const u32 MAX_INPUTS = 4;
+
+Judgement judgeHit(u32 offset) {
+  if (offset <= Simulation::CRITICAL_WINDOW)
+    return Judgement::Critical;
+  if (offset <= Simulation::GREAT_WINDOW)
+    return Judgement::Great;
+  if (offset <= Simulation::GOOD_WINDOW)
+    return Judgement::Good;
+  if (offset <= Simulation::BAD_WINDOW)
+    return Judgement::Bad;
+  return Judgement::Miss;
+}
+
+template <typename TrackT>
+void simulateTrack(const TrackT &track, Simulation *simulation) {
+  ENSURE(simulation != nullptr);
+
+  Simulation &s = *simulation;
+  s.timeline.clear();
+  s.issues.clear();
+  s.score = 0;
+  s.maxScore = 0;
+  s.maxCombo = 0;
+
+  // In tick order, keeping the order of triggers on the same tick
+  std::vector<u32> order(track.triggers.size());
+  for (u32 i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) {
+    return track.triggers[a].tick < track.triggers[b].tick;
+  });
+
+  // Per input: last tick pressed, and first tick a slide may start
+  u32 pressTick[MAX_INPUTS];
+  u32 slideTick[MAX_INPUTS];
+  std::fill(pressTick, pressTick + MAX_INPUTS, UINT32_MAX);
+  std::fill(slideTick, slideTick + MAX_INPUTS, 0);
+
+  const u32 noHold = UINT32_MAX;
+  u32 holdIndex = noHold; // trigger that started the current hold
+  u32 holdInput = 0;
+  u32 combo = 0;
+
+  for (u32 i : order) {
+    const Trigger t = track.triggers[i];
+    if (t.type == Trigger::TrackGuide)
+      continue;
+
+    const u32 input =
+        track.isBMS() ? std::min((u32)std::max(t.y, 0), MAX_INPUTS - 1) : 0;
+    const bool isHoldPart = t.type == Trigger::Holdlet ||
+                            t.type == Trigger::HoldEnd ||
+                            t.type == Trigger::HoldEndSlide;
+
+    // Hold starts pair with the next end whatever the lane, as drawn
+    if (t.type == Trigger::Hold && holdIndex != noHold)
+      s.issues.push_back(SimulationIssue{holdIndex, "hold has no end"});
+
+    const char *reason = nullptr;
+    bool isHit = true;
+    u32 hitTick = t.tick;
+    if (pressTick[input] == t.tick) {
+      reason = "another trigger is on the same tick and lane";
+      isHit = false;
+    } else if (isHoldPart && holdIndex == noHold) {
+      reason = "hold end or holdlet without a hold";
+      isHit = false;
+    } else if (!isHoldPart && t.type != Trigger::Hold &&
+               holdIndex != noHold && holdInput == input) {
+      reason = "trigger is on the lane of a hold before its end";
+      isHit = false;
+    } else if (t.type == Trigger::Slide && slideTick[input] > t.tick) {
+      hitTick = slideTick[input];
+      if (judgeHit(hitTick - t.tick) != Judgement::Critical)
+        reason = "slide is too close to a hold end";
+    }
+
+    if (isHit) {
+      pressTick[input] = t.tick;
+      if (t.type == Trigger::Hold) {
+        holdIndex = i;
+        holdInput = input;
+      } else if (t.type == Trigger::HoldEnd ||
+                 t.type == Trigger::HoldEndSlide) {
+        slideTick[input] = t.tick + Simulation::SLIDE_RECOVERY_TICKS;
+        holdIndex = noHold;
+      }
+    }
+
+    const Judgement judgement =
+        isHit ? judgeHit(hitTick - t.tick) : Judgement::Miss;
+    if (reason != nullptr)
+      s.issues.push_back(SimulationIssue{i, reason});
+
+    combo = judgement <= Judgement::Good ? combo + 1 : 0;
+    s.maxCombo = std::max(s.maxCombo, combo);
+    s.score += JUDGEMENT_POINTS[(u32)judgement];
+    s.maxScore += JUDGEMENT_POINTS[(u32)Judgement::Critical];
+    s.timeline.push_back(
+        ScoreEvent{t.tick, hitTick, i, judgement, combo, s.score});
+  }
+
+  if (holdIndex != noHold)
+    s.issues.push_back(SimulationIssue{holdIndex, "hold has no end"});
+}
+
+template void simulateTrack(const Track &, Simulation *);
+template void simulateTrack(const PackedTrack &, Simulation *);
+
+} // namespace rideau
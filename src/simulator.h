@@ -0,0 +1,77 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "track.h"
+#include "utils.h"
+
+#include <vector>
+
+namespace rideau {
+
+// Headless auto-play of a track, to tell whether a chart is playable without
+// loading it in the game.  The player hits every trigger right on its tick,
+// unless the chart prevents it:
+//
+//  - FMS and EMS have one input, BMS one per lane
+//  - one press per input and tick: a second trigger on the same tick and lane
+//    is missed
+//  - holds pair with the next end, as drawn; the lane of a hold is busy until
+//    its end, and triggers on it in between are missed
+//  - after a hold end, a slide on the same lane can only start
+//    SLIDE_RECOVERY_TICKS later, and is judged late
+//
+// Every trigger not hit critical is reported as an issue.  Guides are not
+// judged.
+enum class Judgement : u8 {
+  Critical,
+  Great,
+  Good,
+  Bad,
+  Miss,
+  Count,
+};
+
+static const char *const JUDGEMENT_NAMES[] = {"Critical", "Great", "Good",
+                                              "Bad", "Miss"};
+
+struct ScoreEvent {
+  u32 tick;         // of the trigger
+  u32 hitTick;      // when it was hit
+  u32 triggerIndex; // in the track
+  Judgement judgement;
+  u32 combo;
+  u32 score; // so far
+};
+
+struct SimulationIssue {
+  u32 triggerIndex;
+  const char *reason;
+};
+
+struct Simulation {
+  // Ticks either side of a trigger for each judgement; beyond is a miss
+  static const u32 CRITICAL_WINDOW = 2;
+  static const u32 GREAT_WINDOW = 4;
+  static const u32 GOOD_WINDOW = 6;
+  static const u32 BAD_WINDOW = 8;
+  // From a hold end to the next slide on the same lane
+  static const u32 SLIDE_RECOVERY_TICKS = 4;
+
+  std::vector<ScoreEvent> timeline; // by tick
+  std::vector<SimulationIssue> issues;
+  u32 score;
+  u32 maxScore; // all critical
+  u32 maxCombo;
+};
+
+// Judgement of a hit offset ticks away from its trigger
+Judgement judgeHit(u32 offset);
+
+// Play track through.  For Track and PackedTrack, valid as by findTrackError;
+// triggers need not be sorted.
+template <typename TrackT>
+void simulateTrack(const TrackT &track, Simulation *simulation);
+
+} // namespace rideau
+
+#endif
@@ -0,0 +1,239 @@
+#include "song.h"
+
+#include "brstm.h"
+
+#include "bcstm.h"
+#include "file_utils.h"
+#include "song_cache.h"
+#include "waveform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+namespace rideau {
+
+void resampleCubic(const s16 *samples, size_t sampleCount,
+                   float *resampledBuffer, size_t resampledCount,
+                   u32 inputFreq, u32 outputFreq) {
+  const double ratio = (double)inputFreq / outputFreq;
+  double mu = 0.0;
+  float s[4] = {0, 0, 0, 0};
+  float *const resampledEnd = resampledBuffer + resampledCount;
+
+  for (size_t i = 0; i < sampleCount; ++i) {
+    float sample = std::clamp((float)samples[i] / 32768.0f, -1.0f, 1.0f);
+
+    s[0] = s[1];
+    s[1] = s[2];
+    s[2] = s[3];
+    s[3] = sample;
+
+    while (mu <= 1.0 && resampledBuffer < resampledEnd) {
+      double A = s[3] - s[2] - s[0] + s[1];
+      double B = s[0] - s[1] - A;
+      double C = s[2] - s[0];
+      double D = s[1];
+
+      *resampledBuffer++ =
+          std::clamp(A * mu * mu * mu + B * mu * mu + C * mu + D, -1.0, 1.0);
+      mu += ratio;
+    }
+
+    mu -= 1.0;
+  }
+
+  while (resampledBuffer < resampledEnd)
+    *resampledBuffer++ = 0.0f;
+}
+
+void computeWaveform(const float *const samples[2], usize framesCount,
+                     float *waveform, u32 rows, ThreadPool *pool) {
+  ASSERT(rows < framesCount);
+
+  const u32 rowsPerJob = 256;
+  pool->parallelFor((rows + rowsPerJob - 1) / rowsPerJob, [&](usize job) {
+    const u32 firstRow = job * rowsPerJob;
+    const u32 lastRow = std::min(firstRow + rowsPerJob, rows);
+    for (u32 y = firstRow; y < lastRow; ++y) {
+      const WaveformBucket b =
+          reduceWaveform(samples, (u64)y * framesCount / rows,
+                         (u64)(y + 1) * framesCount / rows);
+      waveform[2 * y] = b.min;
+      waveform[2 * y + 1] = b.max;
+    }
+  });
+}
+
+static void initSongFromPCM(const s16 *const pcm[2], usize samplesCount,
+                            u32 pcmSampleRate, ThreadPool *pool, Song *song) {
+  // Resample to 48000Hz float for greater backend compatibility (JACK at
+  // least doesn't want anything else)
+  song->sampleRate = 48000;
+  song->framesCount = samplesCount * song->sampleRate / pcmSampleRate;
+  for (int c = 0; c < 2; ++c) {
+    song->samples[c] = (float *)malloc(song->framesCount * sizeof(float));
+    ENSURE(song->samples[c] != nullptr);
+  }
+  pool->parallelFor(2, [&](usize c) {
+    resampleCubic(pcm[c], samplesCount, song->samples[c], song->framesCount,
+                  pcmSampleRate, song->sampleRate);
+  });
+
+  song->waveformRows = SONG_WAVEFORM_ROWS;
+  song->waveform = (float *)malloc(song->waveformRows * 2 * sizeof(float));
+  ENSURE(song->waveform != nullptr);
+  computeWaveform(song->samples, song->framesCount, song->waveform,
+                  song->waveformRows, pool);
+
+  song->mapping = nullptr;
+  song->mappingSize = 0;
+}
+
+static void decodeSong(const u8 *raw, usize rawSize, ThreadPool *pool,
+                       Song *song) {
+  // DSP-ADPCM BCSTM, as shipped with the game, decodes in parallel.  Anything
+  // else goes through openrevolution.
+  BcstmStream stream;
+  if (parseBCSTM(raw, rawSize, &stream)) {
+    ENSURE(stream.channelsCount == 2);
+
+    s16 *pcm[2];
+    for (int c = 0; c < 2; ++c) {
+      pcm[c] = (s16 *)malloc(stream.samplesCount * sizeof(s16));
+      ENSURE(pcm[c] != nullptr);
+    }
+    decodeBCSTM(stream, pool, pcm);
+
+    initSongFromPCM(pcm, stream.samplesCount, stream.sampleRate, pool, song);
+
+    free(pcm[0]);
+    free(pcm[1]);
+    return;
+  }
+
+  Brstm brstm;
+  brstm_init(&brstm);
+
+  u8 ret = brstm_read(&brstm, raw, 0, 1);
+  ENSURE(ret < 128);
+  ENSURE(brstm.num_channels == 2);
+
+  initSongFromPCM(brstm.PCM_samples, brstm.total_samples, brstm.sample_rate,
+                  pool, song);
+
+  brstm_close(&brstm);
+}
+
+bool loadSong(const char *filename, ThreadPool *pool, Song *song) {
+  ENSURE(filename != nullptr);
+  ENSURE(pool != nullptr);
+  ENSURE(song != nullptr);
+
+  usize rawSize;
+  u8 *raw = readFileContents(filename, &rawSize);
+  if (raw == nullptr)
+    return false;
+
+  const u64 contentHash = hashBytes(raw, rawSize);
+  if (!loadCachedSong(contentHash, song)) {
+    decodeSong(raw, rawSize, pool, song);
+    storeCachedSong(contentHash, *song);
+  }
+
+  free(raw);
+  return true;
+}
+
+bool verifySongDecoder(const char *filename, ThreadPool *pool) {
+  ENSURE(filename != nullptr);
+  ENSURE(pool != nullptr);
+
+  usize rawSize;
+  u8 *raw = readFileContents(filename, &rawSize);
+  if (raw == nullptr) {
+    fprintf(stderr, "unable to read %s\n", filename);
+    return false;
+  }
+
+  BcstmStream stream;
+  if (!parseBCSTM(raw, rawSize, &stream)) {
+    fprintf(stderr, "%s is not a DSP-ADPCM BCSTM\n", filename);
+    free(raw);
+    return false;
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+
+  s16 *pcm[BcstmStream::MAX_CHANNELS];
+  for (u32 c = 0; c < stream.channelsCount; ++c) {
+    pcm[c] = (s16 *)malloc(stream.samplesCount * sizeof(s16));
+    ENSURE(pcm[c] != nullptr);
+  }
+  decodeBCSTM(stream, pool, pcm);
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  Brstm brstm;
+  brstm_init(&brstm);
+  u8 ret = brstm_read(&brstm, raw, 0, 1);
+  ENSURE(ret < 128);
+
+  auto t2 = std::chrono::steady_clock::now();
+
+  bool same = brstm.num_channels == stream.channelsCount &&
+              brstm.total_samples == stream.samplesCount;
+  if (!same)
+    fprintf(stderr, "layout differs: %u channels and %lu samples, expected "
+                    "%u channels and %lu samples\n",
+            stream.channelsCount, (unsigned long)stream.samplesCount,
+            brstm.num_channels, (unsigned long)brstm.total_samples);
+
+  for (u32 c = 0; c < stream.channelsCount && same; ++c) {
+    for (usize i = 0; i < stream.samplesCount; ++i) {
+      if (pcm[c][i] != brstm.PCM_samples[c][i]) {
+        fprintf(stderr, "channel %u differs at sample %zu: %d, expected %d\n",
+                c, i, pcm[c][i], brstm.PCM_samples[c][i]);
+        same = false;
+        break;
+      }
+    }
+  }
+
+  const double parallelMs =
+      std::chrono::duration<double, std::milli>(t1 - t0).count();
+  const double serialMs =
+      std::chrono::duration<double, std::milli>(t2 - t1).count();
+  printf("%s: %u channels, %u blocks, %u threads\n", filename,
+         stream.channelsCount, stream.blocksCount, pool->threadsCount());
+  printf("parallel decode: %.1fms, openrevolution: %.1fms, %s\n", parallelMs,
+         serialMs, same ? "identical" : "MISMATCH");
+
+  brstm_close(&brstm);
+  for (u32 c = 0; c < stream.channelsCount; ++c)
+    free(pcm[c]);
+  free(raw);
+
+  return same;
+}
+
+void freeSong(Song *song) {
+  ENSURE(song != nullptr);
+
+  if (song->mapping != nullptr) {
+    munmap(song->mapping, song->mappingSize);
+    song->mapping = nullptr;
+  } else {
+    free(song->samples[0]);
+    free(song->samples[1]);
+    free(song->waveform);
+  }
+
+  song->samples[0] = song->samples[1] = nullptr;
+  song->waveform = nullptr;
+}
+
+} // namespace rideau
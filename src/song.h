@@ -0,0 +1,47 @@
+#ifndef SONG_H
+#define SONG_H
+
+#include "thread_pool.h"
+#include "utils.h"
+
+namespace rideau {
+
+// Bump when decoding, resampling or waveform reduction changes, so that stale
+// cached songs are decoded again
+static const u32 SONG_DECODER_VERSION = 3;
+
+// Rows of the scrub bar waveform
+static const u32 SONG_WAVEFORM_ROWS = 8192;
+
+// Decoded song, resampled to stereo float at sampleRate, with the min/max
+// waveform of the scrub bar.  Buffers are either malloc'd, or mapped from the
+// song cache.
+struct Song {
+  u32 sampleRate;
+  usize framesCount;
+  float *samples[2];
+
+  u32 waveformRows;
+  float *waveform; // min and max per row
+
+  void *mapping;
+  usize mappingSize;
+};
+
+// Writes exactly resampledCount frames, padding with silence
+void resampleCubic(const s16 *samples, size_t sampleCount,
+                   float *resampledBuffer, size_t resampledCount,
+                   u32 inputFreq, u32 outputFreq);
+void computeWaveform(const float *const samples[2], usize framesCount,
+                     float *waveform, u32 rows, ThreadPool *pool);
+
+// Decode filename, or load it from the song cache if it was decoded before
+bool loadSong(const char *filename, ThreadPool *pool, Song *song);
+// Decode a BCSTM file with both the built-in decoder and openrevolution, and
+// report whether they agree
+bool verifySongDecoder(const char *filename, ThreadPool *pool);
+void freeSong(Song *song);
+
+} // namespace rideau
+
+#endif
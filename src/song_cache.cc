@@ -0,0 +1,171 @@
+#include "song_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rideau {
+
+static const char CACHE_MAGIC[8] = {'R', 'I', 'D', 'E', 'A', 'U', 'S', 'C'};
+static const u32 CACHE_FORMAT_VERSION = 1;
+static const u32 BYTE_ORDER_MARK = 0x01020304;
+
+u64 hashBytes(const u8 *data, usize size) {
+  // FNV-1a over 64-bit words, with a final avalanche
+  const u64 prime = 0x100000001b3;
+  u64 h = 0xcbf29ce484222325 ^ size;
+
+  usize i = 0;
+  for (; i + 8 <= size; i += 8) {
+    u64 w;
+    memcpy(&w, data + i, sizeof(w));
+    h = (h ^ w) * prime;
+  }
+  for (; i < size; ++i)
+    h = (h ^ data[i]) * prime;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53;
+  h ^= h >> 33;
+  return h;
+}
+
+static bool makeDir(const char *path) {
+  return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static bool getCachePath(u64 contentHash, char *path, usize pathSize) {
+  char dir[1024];
+  const char *xdgCache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdgCache != nullptr && xdgCache[0] != '\0') {
+    snprintf(dir, ARRAY_SIZE(dir), "%s", xdgCache);
+  } else if (home != nullptr) {
+    snprintf(dir, ARRAY_SIZE(dir), "%s/.cache", home);
+    if (!makeDir(dir))
+      return false;
+  } else {
+    return false;
+  }
+
+  const usize len = strlen(dir);
+  snprintf(dir + len, ARRAY_SIZE(dir) - len, "/rideau");
+  if (!makeDir(dir))
+    return false;
+
+  int ret = snprintf(path, pathSize, "%s/%016llx.song", dir,
+                     (unsigned long long)contentHash);
+  return ret > 0 && (usize)ret < pathSize;
+}
+
+static usize getCacheFileSize(usize framesCount, u32 waveformRows) {
+  return sizeof(SongCacheHeader) + framesCount * 2 * sizeof(float) +
+         waveformRows * 2 * sizeof(float);
+}
+
+bool loadCachedSong(u64 contentHash, Song *song) {
+  ENSURE(song != nullptr);
+
+  char path[1100];
+  if (!getCachePath(contentHash, path, ARRAY_SIZE(path)))
+    return false;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (usize)st.st_size < sizeof(SongCacheHeader)) {
+    close(fd);
+    return false;
+  }
+
+  const usize size = st.st_size;
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+
+  const SongCacheHeader *header = (const SongCacheHeader *)mapping;
+  const bool valid =
+      memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+      header->byteOrder == BYTE_ORDER_MARK &&
+      header->formatVersion == CACHE_FORMAT_VERSION &&
+      header->decoderVersion == SONG_DECODER_VERSION &&
+      header->contentHash == contentHash &&
+      size == getCacheFileSize(header->framesCount, header->waveformRows) &&
+      header->samplesOffset == sizeof(SongCacheHeader) &&
+      header->waveformOffset ==
+          header->samplesOffset + header->framesCount * 2 * sizeof(float);
+
+  if (!valid) {
+    munmap(mapping, size);
+    return false;
+  }
+
+  u8 *base = (u8 *)mapping;
+  song->sampleRate = header->sampleRate;
+  song->framesCount = header->framesCount;
+  song->samples[0] = (float *)(base + header->samplesOffset);
+  song->samples[1] = song->samples[0] + song->framesCount;
+  song->waveformRows = header->waveformRows;
+  song->waveform = (float *)(base + header->waveformOffset);
+  song->mapping = mapping;
+  song->mappingSize = size;
+
+  // Playback reads through the whole song in order
+  madvise(mapping, size, MADV_WILLNEED);
+
+  return true;
+}
+
+void storeCachedSong(u64 contentHash, const Song &song) {
+  char path[1100];
+  if (!getCachePath(contentHash, path, ARRAY_SIZE(path)))
+    return;
+
+  // Write then rename, so a concurrent reader never sees a partial file
+  char tmpPath[1200];
+  snprintf(tmpPath, ARRAY_SIZE(tmpPath), "%s.%d.tmp", path, (int)getpid());
+
+  FILE *f = fopen(tmpPath, "wb");
+  if (f == nullptr)
+    return;
+
+  SongCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.byteOrder = BYTE_ORDER_MARK;
+  header.formatVersion = CACHE_FORMAT_VERSION;
+  header.decoderVersion = SONG_DECODER_VERSION;
+  header.sampleRate = song.sampleRate;
+  header.contentHash = contentHash;
+  header.framesCount = song.framesCount;
+  header.waveformRows = song.waveformRows;
+  header.samplesOffset = sizeof(SongCacheHeader);
+  header.waveformOffset =
+      header.samplesOffset + song.framesCount * 2 * sizeof(float);
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  for (int c = 0; c < 2 && ok; ++c)
+    ok = fwrite(song.samples[c], sizeof(float), song.framesCount, f) ==
+         song.framesCount;
+  if (ok)
+    ok = fwrite(song.waveform, sizeof(float), song.waveformRows * 2, f) ==
+         song.waveformRows * 2;
+
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmpPath, path) != 0) {
+    fprintf(stderr, "unable to write song cache %s\n", path);
+    unlink(tmpPath);
+  }
+}
+
+} // namespace rideau
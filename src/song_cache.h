@@ -0,0 +1,43 @@
+#ifndef SONG_CACHE_H
+#define SONG_CACHE_H
+
+#include "song.h"
+#include "utils.h"
+
+namespace rideau {
+
+// Decoded songs are cached under $XDG_CACHE_HOME/rideau, keyed by a hash of
+// the music file contents.  Cache files are laid out so that a Song can point
+// straight into the mapped file:
+//
+//    Offset   Size    Role
+//    ----------------------------------------
+//    00h      40h     SongCacheHeader
+//    40h      N*4     Left samples (float)
+//    ...      N*4     Right samples (float)
+//    ...      R*2*4   Waveform min/max (float)
+
+struct SongCacheHeader {
+  char magic[8]; // "RIDEAUSC"
+  u32 byteOrder; // BYTE_ORDER_MARK in native order
+  u32 formatVersion;
+  u32 decoderVersion;
+  u32 sampleRate;
+  u64 contentHash;
+  u64 framesCount;
+  u32 waveformRows;
+  u32 reserved;
+  u64 samplesOffset;
+  u64 waveformOffset;
+};
+
+static_assert(sizeof(SongCacheHeader) == 0x40);
+
+u64 hashBytes(const u8 *data, usize size);
+
+bool loadCachedSong(u64 contentHash, Song *song);
+void storeCachedSong(u64 contentHash, const Song &song);
+
+} // namespace rideau
+
+#endif
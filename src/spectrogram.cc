@@ -0,0 +1,203 @@
+#include "spectrogram.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+namespace rideau {
+
+static const float MIN_FREQUENCY = 40.0f;
+static const float MAX_FREQUENCY = 16000.0f;
+static const float DB_RANGE = 80.0f;
+
+static u32 packColor(float r, float g, float b) {
+  return (u32)(r * 255.0f) | (u32)(g * 255.0f) << 8 |
+         (u32)(b * 255.0f) << 16 | 0xFFu << 24;
+}
+
+void SpectrogramCache::init(const float *const songSamples[2],
+                            usize songFramesCount, u32 songSampleRate,
+                            ThreadPool *threadPool) {
+  samples[0] = songSamples[0];
+  samples[1] = songSamples[1];
+  framesCount = songFramesCount;
+  sampleRate = songSampleRate;
+  pool = threadPool;
+
+  fft.init(FFT_SIZE);
+
+  const float binHz = (float)sampleRate / FFT_SIZE;
+  for (u32 r = 0; r <= ROWS; ++r) {
+    const float t = 1.0f - (float)r / ROWS;
+    const float hz = MIN_FREQUENCY * powf(MAX_FREQUENCY / MIN_FREQUENCY, t);
+    rowBins[r] = std::min((u32)(hz / binHz + 0.5f), FFT_SIZE / 2);
+  }
+
+  // Black, through purple and orange, to pale yellow
+  const float stops[][3] = {{0.0f, 0.0f, 0.02f},
+                            {0.35f, 0.05f, 0.45f},
+                            {0.85f, 0.3f, 0.25f},
+                            {1.0f, 0.75f, 0.2f},
+                            {1.0f, 1.0f, 0.75f}};
+  const u32 segments = ARRAY_SIZE(stops) - 1;
+  for (u32 i = 0; i < 256; ++i) {
+    const float t = i / 255.0f * segments;
+    const u32 s = std::min((u32)t, segments - 1);
+    const float f = t - s;
+    palette[i] = packColor(stops[s][0] + (stops[s + 1][0] - stops[s][0]) * f,
+                           stops[s][1] + (stops[s + 1][1] - stops[s][1]) * f,
+                           stops[s][2] + (stops[s + 1][2] - stops[s][2]) * f);
+  }
+
+  for (u32 i = 0; i < MAX_TILES; ++i) {
+    tiles[i].state = SpectrogramTile::Empty;
+    tiles[i].lastUsed = 0;
+    tiles[i].texture = 0;
+    tiles[i].pixels = (u32 *)malloc(TILE_COLUMNS * ROWS * sizeof(u32));
+    ENSURE(tiles[i].pixels != nullptr);
+  }
+  useCounter = 0;
+}
+
+void SpectrogramCache::deinit() {
+  // Jobs write into the tile pixels
+  for (u32 i = 0; i < MAX_TILES; ++i) {
+    if (tiles[i].state == SpectrogramTile::Computing) {
+      pool->waitIdle();
+      break;
+    }
+  }
+
+  for (u32 i = 0; i < MAX_TILES; ++i) {
+    if (tiles[i].texture != 0)
+      glDeleteTextures(1, &tiles[i].texture);
+    free(tiles[i].pixels);
+  }
+  fft.deinit();
+}
+
+u32 SpectrogramCache::zoomFor(float framesPerPixel) {
+  const float z = log2f(framesPerPixel / BASE_COLUMN_FRAMES);
+  return std::clamp((s32)roundf(z), 0, (s32)MAX_ZOOM);
+}
+
+void SpectrogramCache::computeTile(SpectrogramTile *tile) const {
+  const u32 bins = FFT_SIZE / 2 + 1;
+  float *buffer = (float *)malloc((4 * FFT_SIZE + 2 * bins) * sizeof(float));
+  ENSURE(buffer != nullptr);
+  float *frames[2] = {buffer, buffer + FFT_SIZE};
+  float *re = buffer + 2 * FFT_SIZE;
+  float *im = buffer + 3 * FFT_SIZE;
+  float *mags[2] = {buffer + 4 * FFT_SIZE, buffer + 4 * FFT_SIZE + bins};
+
+  // Full scale sine under a Hann window peaks at FFT_SIZE / 4
+  const float refMagnitude = FFT_SIZE / 4.0f;
+  const usize step = columnFrames(tile->zoom);
+  const s64 firstFrame = tile->index * (s64)tileFrames(tile->zoom);
+
+  for (u32 col = 0; col < TILE_COLUMNS; col += 2) {
+    for (u32 k = 0; k < 2; ++k) {
+      const s64 center = firstFrame + (s64)((col + k) * step + step / 2);
+      const s64 start = center - FFT_SIZE / 2;
+      for (u32 i = 0; i < FFT_SIZE; ++i) {
+        const s64 idx = start + i;
+        frames[k][i] = (idx >= 0 && (usize)idx < framesCount)
+                           ? (samples[0][idx] + samples[1][idx]) * 0.5f
+                           : 0.0f;
+      }
+    }
+    fft.magnitudes2(frames[0], frames[1], mags[0], mags[1], re, im);
+
+    for (u32 k = 0; k < 2; ++k) {
+      for (u32 r = 0; r < ROWS; ++r) {
+        // Loudest bin of the row; low rows share a bin
+        const u32 lo = rowBins[r + 1];
+        const u32 hi = std::max(rowBins[r], lo + 1);
+        float mag = 0.0f;
+        for (u32 b = lo; b < hi && b < bins; ++b)
+          mag = std::max(mag, mags[k][b]);
+
+        const float db = 20.0f * log10f(mag / refMagnitude + 1e-9f);
+        const float level = std::clamp(1.0f + db / DB_RANGE, 0.0f, 1.0f);
+        tile->pixels[r * TILE_COLUMNS + col + k] = palette[(u32)(level * 255)];
+      }
+    }
+  }
+
+  free(buffer);
+}
+
+bool SpectrogramCache::isBusy() const {
+  for (u32 i = 0; i < MAX_TILES; ++i) {
+    const u32 state = tiles[i].state.load(std::memory_order_relaxed);
+    if (state == SpectrogramTile::Computing ||
+        state == SpectrogramTile::Computed)
+      return true;
+  }
+  return false;
+}
+
+u32 SpectrogramCache::getTile(u32 zoom, s64 index) {
+  ++useCounter;
+
+  SpectrogramTile *tile = nullptr;
+  SpectrogramTile *leastRecent = nullptr;
+  u32 computingCount = 0;
+  for (u32 i = 0; i < MAX_TILES; ++i) {
+    const u32 state = tiles[i].state;
+    if (state != SpectrogramTile::Empty && tiles[i].zoom == zoom &&
+        tiles[i].index == index)
+      tile = &tiles[i];
+
+    // Slots being written by a job can't be recycled
+    if (state == SpectrogramTile::Computing)
+      ++computingCount;
+    else if (leastRecent == nullptr ||
+             tiles[i].lastUsed < leastRecent->lastUsed)
+      leastRecent = &tiles[i];
+  }
+
+  if (tile == nullptr) {
+    // Bound the queue, so that tiles scrolled past don't delay visible ones
+    if (computingCount >= MAX_COMPUTING || leastRecent == nullptr)
+      return 0;
+
+    tile = leastRecent;
+    tile->zoom = zoom;
+    tile->index = index;
+    tile->lastUsed = useCounter;
+    tile->state = SpectrogramTile::Computing;
+    pool->submit([this, tile] {
+      computeTile(tile);
+      tile->state.store(SpectrogramTile::Computed, std::memory_order_release);
+    });
+    return 0;
+  }
+
+  tile->lastUsed = useCounter;
+
+  if (tile->state.load(std::memory_order_acquire) ==
+      SpectrogramTile::Computed) {
+    if (tile->texture == 0) {
+      glGenTextures(1, &tile->texture);
+      glBindTexture(GL_TEXTURE_2D, tile->texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TILE_COLUMNS, ROWS, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, tile->pixels);
+    } else {
+      glBindTexture(GL_TEXTURE_2D, tile->texture);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILE_COLUMNS, ROWS, GL_RGBA,
+                      GL_UNSIGNED_BYTE, tile->pixels);
+    }
+    tile->state = SpectrogramTile::Uploaded;
+  }
+
+  return tile->state == SpectrogramTile::Uploaded ? tile->texture : 0;
+}
+
+} // namespace rideau
@@ -0,0 +1,83 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include "fft.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <atomic>
+
+namespace rideau {
+
+struct SpectrogramTile {
+  enum State : u32 {
+    Empty = 0,
+    Computing, // pixels owned by a pool job
+    Computed,  // pixels ready to upload
+    Uploaded,
+  };
+
+  std::atomic<u32> state;
+  u32 zoom;
+  s64 index;
+  u64 lastUsed;
+
+  u32 texture; // GLuint, created on first use
+  u32 *pixels; // RGBA, TILE_COLUMNS x ROWS
+};
+
+// Spectrogram of the song, computed lazily in tiles of TILE_COLUMNS columns.
+// At zoom z a column is one STFT frame every BASE_COLUMN_FRAMES << z song
+// frames, and rows are log-spaced frequencies, highest first.  Tiles are
+// computed on the thread pool, uploaded on the main thread, and kept in a
+// fixed set of slots recycled least recently used first.
+struct SpectrogramCache {
+  static const u32 FFT_SIZE = 1024;
+  static const u32 BASE_COLUMN_FRAMES = 16;
+  static const u32 MAX_ZOOM = 16;
+  static const u32 TILE_COLUMNS = 256;
+  static const u32 ROWS = 128;
+  static const u32 MAX_TILES = 96;
+  static const u32 MAX_COMPUTING = 8;
+
+  const float *samples[2];
+  usize framesCount;
+  u32 sampleRate;
+  ThreadPool *pool;
+
+  FFT fft;
+  u32 rowBins[ROWS + 1]; // bin range of each row, top row first
+  u32 palette[256];
+
+  SpectrogramTile tiles[MAX_TILES];
+  u64 useCounter;
+
+  void init(const float *const songSamples[2], usize songFramesCount,
+            u32 songSampleRate, ThreadPool *threadPool);
+  // Needs the GL context
+  void deinit();
+
+  static usize columnFrames(u32 zoom) {
+    return (usize)BASE_COLUMN_FRAMES << zoom;
+  }
+  static usize tileFrames(u32 zoom) {
+    return TILE_COLUMNS * columnFrames(zoom);
+  }
+
+  // Zoom whose columns are closest to framesPerPixel
+  static u32 zoomFor(float framesPerPixel);
+
+  // Texture of the tile, or 0 while it's being computed.  Call on the main
+  // thread, once per frame for each visible tile.
+  u32 getTile(u32 zoom, s64 index);
+
+  // Whether tiles are still being computed or waiting to be uploaded
+  bool isBusy() const;
+
+private:
+  void computeTile(SpectrogramTile *tile) const;
+};
+
+} // namespace rideau
+
+#endif
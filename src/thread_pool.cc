@@ -0,0 +1,109 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace rideau {
+
+void ThreadPool::init(u32 threadsCount) {
+  if (threadsCount == 0)
+    threadsCount = std::max(1u, std::thread::hardware_concurrency());
+
+  pendingJobs = 0;
+  stopping = false;
+  for (u32 i = 0; i < threadsCount; ++i)
+    threads.emplace_back([this] { workerLoop(); });
+}
+
+void ThreadPool::deinit() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  jobAvailable.notify_all();
+
+  for (std::thread &thread : threads)
+    thread.join();
+  threads.clear();
+  jobs.clear();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+    ++pendingJobs;
+  }
+  jobAvailable.notify_one();
+}
+
+bool ThreadPool::runQueuedJob(std::unique_lock<std::mutex> &lock) {
+  if (jobs.empty())
+    return false;
+
+  std::function<void()> job = std::move(jobs.front());
+  jobs.pop_front();
+
+  lock.unlock();
+  job();
+  lock.lock();
+
+  --pendingJobs;
+  jobFinished.notify_all();
+  return true;
+}
+
+void ThreadPool::waitIdle() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (pendingJobs > 0) {
+    if (!runQueuedJob(lock))
+      jobFinished.wait(lock);
+  }
+}
+
+void ThreadPool::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+    if (stopping)
+      return;
+    runQueuedJob(lock);
+  }
+}
+
+void ThreadPool::parallelFor(usize count,
+                             const std::function<void(usize)> &fn) {
+  if (count == 0)
+    return;
+
+  // Workers and the caller pull indices from a shared counter, so uneven
+  // items balance out
+  std::atomic<usize> nextIndex(0);
+  std::atomic<u32> helpersLeft(0);
+  auto work = [&] {
+    usize i;
+    while ((i = nextIndex.fetch_add(1)) < count)
+      fn(i);
+  };
+
+  const u32 helpersCount = std::min<usize>(threads.size(), count - 1);
+  helpersLeft = helpersCount;
+  for (u32 i = 0; i < helpersCount; ++i) {
+    submit([&] {
+      work();
+      helpersLeft.fetch_sub(1);
+    });
+  }
+
+  work();
+
+  // Helpers may still be queued behind other jobs (or behind us, when called
+  // from a worker), so run queued jobs instead of just sleeping
+  std::unique_lock<std::mutex> lock(mutex);
+  while (helpersLeft > 0) {
+    if (!runQueuedJob(lock))
+      jobFinished.wait(lock);
+  }
+}
+
+} // namespace rideau
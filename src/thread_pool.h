@@ -0,0 +1,47 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "utils.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rideau {
+
+// Fixed set of worker threads running queued jobs
+struct ThreadPool {
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable jobAvailable;
+  std::condition_variable jobFinished;
+  std::deque<std::function<void()>> jobs;
+  usize pendingJobs; // queued or running
+  bool stopping;
+
+  // threadsCount of 0 uses one thread per core
+  void init(u32 threadsCount = 0);
+  void deinit();
+
+  u32 threadsCount() const { return threads.size(); }
+
+  void submit(std::function<void()> job);
+  // Waits for every submitted job, running queued ones meanwhile
+  void waitIdle();
+
+  // Calls fn(i) for i in [0, count) across the workers and the calling
+  // thread, and returns once all calls are done.  May be called from a job.
+  void parallelFor(usize count, const std::function<void(usize)> &fn);
+
+private:
+  bool runQueuedJob(std::unique_lock<std::mutex> &lock);
+  void workerLoop();
+};
+
+} // namespace rideau
+
+#endif
@@ -0,0 +1,126 @@
+#include "timestretch.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace rideau {
+
+static inline float sampleAt(const float *s, s64 idx, usize count) {
+  return (idx >= 0 && (usize)idx < count) ? s[idx] : 0.0f;
+}
+
+void TimeStretcher::init() {
+  // Periodic Hann window: overlapping halves sum to one
+  for (u32 i = 0; i < WINDOW; ++i)
+    window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / WINDOW);
+
+  reset(0);
+}
+
+void TimeStretcher::reset(double frame) {
+  memset(overlap, 0, sizeof(overlap));
+  memset(pending, 0, sizeof(pending));
+  pendingPos = HOP;
+
+  analysisPos = frame;
+  prevSegment = (s64)frame - HOP;
+  playPos = frame;
+}
+
+s64 TimeStretcher::findSegment(const float *const samples[2],
+                               usize framesCount, s64 nominal,
+                               s64 natural) const {
+  // Match the candidate segment start against the natural continuation of
+  // the previous segment.  Coarse search on a decimated grid, then refine.
+  auto score = [&](s64 k) {
+    float corr = 0.0f;
+    float energy = 1e-6f;
+    for (u32 i = 0; i < HOP; i += 2) {
+      const float t = sampleAt(samples[0], natural + i, framesCount) +
+                      sampleAt(samples[1], natural + i, framesCount);
+      const float x = sampleAt(samples[0], k + i, framesCount) +
+                      sampleAt(samples[1], k + i, framesCount);
+      corr += t * x;
+      energy += x * x;
+    }
+    return corr / sqrtf(energy);
+  };
+
+  s64 best = nominal;
+  float bestScore = score(nominal);
+
+  const s64 range = SEEK_RANGE;
+  for (s64 k = nominal - range; k <= nominal + range; k += 4) {
+    const float s = score(k);
+    if (s > bestScore) {
+      bestScore = s;
+      best = k;
+    }
+  }
+
+  const s64 coarse = best;
+  for (s64 k = coarse - 3; k <= coarse + 3; ++k) {
+    const float s = score(k);
+    if (s > bestScore) {
+      bestScore = s;
+      best = k;
+    }
+  }
+
+  return best;
+}
+
+void TimeStretcher::step(float *const samples[2], usize framesCount,
+                         float speed, usize loopStart, usize loopEnd) {
+  const s64 natural = prevSegment + HOP;
+  const s64 segment =
+      findSegment(samples, framesCount, (s64)analysisPos, natural);
+
+  for (int c = 0; c < 2; ++c) {
+    for (u32 i = 0; i < HOP; ++i)
+      pending[c][i] =
+          overlap[c][i] +
+          window[i] * sampleAt(samples[c], segment + i, framesCount);
+    for (u32 i = 0; i < HOP; ++i)
+      overlap[c][i] = window[HOP + i] *
+                      sampleAt(samples[c], segment + HOP + i, framesCount);
+  }
+  pendingPos = 0;
+
+  prevSegment = segment;
+  analysisPos += HOP * speed;
+  if (loopEnd > loopStart && analysisPos >= loopEnd)
+    analysisPos -= loopEnd - loopStart;
+}
+
+u32 TimeStretcher::process(float *const samples[2], usize framesCount,
+                           float speed, usize loopStart, usize loopEnd,
+                           float *out[2], u32 frameCount) {
+  const bool looping = loopEnd > loopStart;
+
+  u32 done = 0;
+  while (done < frameCount) {
+    if (!looping && playPos >= framesCount)
+      break;
+
+    if (pendingPos == HOP)
+      step(samples, framesCount, speed, loopStart, loopEnd);
+
+    u32 n = frameCount - done;
+    if (n > HOP - pendingPos)
+      n = HOP - pendingPos;
+
+    for (int c = 0; c < 2; ++c)
+      memcpy(out[c] + done, pending[c] + pendingPos, n * sizeof(float));
+
+    pendingPos += n;
+    done += n;
+    playPos += n * speed;
+    if (looping && playPos >= loopEnd)
+      playPos -= loopEnd - loopStart;
+  }
+
+  return done;
+}
+
+} // namespace rideau
@@ -0,0 +1,43 @@
+#ifndef TIMESTRETCH_H
+#define TIMESTRETCH_H
+
+#include "utils.h"
+
+namespace rideau {
+
+// WSOLA time-stretcher reading straight from the in-memory song.  Changes the
+// playback speed without changing the pitch; the cost per output frame is
+// bounded by the fixed window and search sizes.
+struct TimeStretcher {
+  static const u32 WINDOW = 1024; // frames
+  static const u32 HOP = WINDOW / 2;
+  static const u32 SEEK_RANGE = 256; // max segment shift, in frames
+
+  float window[WINDOW];
+  float overlap[2][HOP]; // second half of the previous windowed segment
+  float pending[2][HOP]; // output frames not consumed yet
+  u32 pendingPos;
+
+  double analysisPos; // nominal song position of the next segment
+  s64 prevSegment;    // song position of the previous segment
+  double playPos;     // song position of the next output frame
+
+  void init();
+  void reset(double frame);
+
+  // Render frameCount frames at the given speed, wrapping around
+  // [loopStart, loopEnd) when loopEnd > loopStart.  Returns the number of
+  // frames rendered before reaching the end of the song.
+  u32 process(float *const samples[2], usize framesCount, float speed,
+              usize loopStart, usize loopEnd, float *out[2], u32 frameCount);
+
+private:
+  void step(float *const samples[2], usize framesCount, float speed,
+            usize loopStart, usize loopEnd);
+  s64 findSegment(const float *const samples[2], usize framesCount,
+                  s64 nominal, s64 natural) const;
+};
+
+} // namespace rideau
+
+#endif
@@ -1,8 +1,10 @@
 #include "track.h"
 
 #include "file_utils.h"
+#include "packed_track.h"
 
 #include <algorithm>
+#include <stdio.h>
 
 namespace rideau {
 
@@ -42,61 +44,273 @@ void parseTrack(const u8 *raw, u32 rawSize, Track *track) {
   ASSERT((r - raw) == rawSize);
 }
 
-void checkTrack(Track &track) {
-  // More user-friendly would be to emit a message for each assert violation
-  // pointing to the corresponding trigger instead of bailing on first fail.
+bool isParsableTrack(const u8 *raw, u32 rawSize) {
+  ENSURE(raw != nullptr);
+
+  const u32 headerSize = 10 * sizeof(u32);
+  const u32 triggerSize = 6 * sizeof(u32);
+  if (rawSize < headerSize)
+    return false;
+
+  const u8 *r = raw;
+  if (readu32le(&r) >= Track::Type::Count)
+    return false;
+  r = raw + headerSize - sizeof(u32);
+  const u32 triggerCount = readu32le(&r);
+  if ((rawSize - headerSize) % triggerSize != 0 ||
+      (rawSize - headerSize) / triggerSize != triggerCount)
+    return false;
+
+  for (u32 i = 0; i < triggerCount; ++i) {
+    r = raw + headerSize + i * triggerSize + sizeof(u32);
+    if (readu32le(&r) >= Trigger::Type::Count)
+      return false;
+  }
+  return true;
+}
+
+bool tryParseTrack(const u8 *raw, u32 rawSize, Track *track) {
+  ENSURE(track != nullptr);
 
-  ASSERT(track.trackType < Track::Type::Count);
+  if (!isParsableTrack(raw, rawSize))
+    return false;
+  track->triggers.clear();
+  parseTrack(raw, rawSize, track);
+  return true;
+}
 
-  ASSERT(track.tickStart == 0);
-  ASSERT(track.tickEnd == track.tickCount);
+template <typename TrackT>
+const char *findTrackError(const TrackT &track, u32 *triggerIndex) {
+  ENSURE(triggerIndex != nullptr);
+  *triggerIndex = track.triggers.size();
 
-  ASSERT(track.featureZoneStart < track.featureZoneEnd);
-  ASSERT(track.summonStart < track.summonEnd);
-  ASSERT(track.featureZoneEnd <= track.summonStart);
+  if (track.trackType >= Track::Type::Count)
+    return "unknown track type";
+
+  if (track.tickStart != 0)
+    return "tick start is not 0";
+  if (track.tickEnd != track.tickCount)
+    return "tick end is not the tick count";
+
+  if (track.featureZoneStart >= track.featureZoneEnd)
+    return "feature zone ends before it starts";
+  if (track.summonStart >= track.summonEnd)
+    return "summon ends before it starts";
+  if (track.featureZoneEnd > track.summonStart)
+    return "summon starts in the feature zone";
 
   if (track.isBMS()) {
     // summonTrigger actually has no effect in game
     //
-    // ASSERT((track.summonStart <= track.summonTrigger) &&
-    //        (track.summonTrigger <= track.summonEnd));
-  } else if (track.isFMS()) {
-    ASSERT(track.summonTrigger == 0);
-  } else if (track.isEMS()) {
-    ASSERT(track.summonTrigger == 0);
+    // if (track.summonTrigger < track.summonStart ||
+    //     track.summonTrigger > track.summonEnd)
+    //   return "summon trigger is outside of the summon";
+  } else if (track.summonTrigger != 0) {
+    return "summon trigger is not 0";
   }
 
-  ASSERT(track.triggers.size() == track.triggerCount);
+  if (track.triggers.size() != track.triggerCount)
+    return "trigger count does not match the triggers";
 
   for (u32 i = 0; i < track.triggerCount; ++i) {
-    Trigger &t = track.triggers[i];
-    USED_ONLY_FOR_ASSERT(t);
-    ASSERT(t.type < Trigger::Type::Count);
+    const Trigger &t = track.triggers[i];
+    *triggerIndex = i;
 
-    ASSERT(track.tickStart < t.tick && t.tick < track.tickEnd);
+    if (t.type >= Trigger::Type::Count)
+      return "unknown trigger type";
+
+    if (t.tick <= track.tickStart || t.tick >= track.tickEnd)
+      return "trigger is outside of the track";
 
     if (track.isBMS()) {
-      ASSERT(t.type != Trigger::TrackGuide && t.type != Trigger::Holdlet);
-      ASSERT(t.x == 0);
-      ASSERT(0 <= t.y && t.y < 4);
-      ASSERT(t.flags == Trigger::Flag::None);
+      if (t.type == Trigger::TrackGuide || t.type == Trigger::Holdlet)
+        return "BMS track has guides or holdlets";
+      if (t.x != 0 || t.flags != Trigger::Flag::None)
+        return "BMS trigger has an X position or flags";
+      if (t.y < 0 || t.y >= 4)
+        return "BMS lane is not in [0,3]";
     } else if (track.isFMS()) {
-      ASSERT(t.type < Trigger::TrackGuide);
-      ASSERT(t.x == 0);
-      ASSERT(0 <= t.y && t.y <= 100);
-      ASSERT(t.flags == Trigger::Flag::None);
+      if (t.type >= Trigger::TrackGuide)
+        return "FMS track has guides";
+      if (t.x != 0 || t.flags != Trigger::Flag::None)
+        return "FMS trigger has an X position or flags";
+      if (t.y < 0 || t.y > 100)
+        return "FMS position is not in [0,100]";
     } else if (track.isEMS()) {
       if (t.type == Trigger::TrackGuide) {
-        ASSERT(-150 <= t.x && t.x <= 150);
-        ASSERT(-75 <= t.y && t.y <= 75);
+        if (t.x < -150 || t.x > 150 || t.y < -75 || t.y > 75)
+          return "EMS guide is out of bounds";
       } else {
-        ASSERT(t.x == 0 && t.y == 0);
-        ASSERT(t.flags == Trigger::Flag::None ||
-               t.flags == Trigger::Flag::AbsoluteAngle);
+        if (t.x != 0 || t.y != 0)
+          return "EMS trigger has a position";
+        if (t.flags != Trigger::Flag::None &&
+            t.flags != Trigger::Flag::AbsoluteAngle)
+          return "EMS trigger has flags other than absolute angle";
       }
     }
 
-    ASSERT(t.angle < 360);
+    if (t.angle >= 360)
+      return "angle is not in [0,360)";
+  }
+
+  *triggerIndex = track.triggers.size();
+  return nullptr;
+}
+
+template const char *findTrackError(const Track &, u32 *);
+template const char *findTrackError(const PackedTrack &, u32 *);
+
+void checkTrack(Track &track) {
+  u32 index;
+  const char *error = findTrackError(track, &index);
+  if (error != nullptr) {
+    if (index < track.triggers.size())
+      fprintf(stderr, "Invalid track: trigger %u at tick %u: %s\n", index,
+              track.triggers[index].tick, error);
+    else
+      fprintf(stderr, "Invalid track: %s\n", error);
+  }
+  ASSERT(error == nullptr);
+}
+
+u32 findTrigger(const Track &track, u32 tick, u32 id) {
+  auto it = std::lower_bound(
+      track.triggers.begin(), track.triggers.end(), tick,
+      [](const Trigger &t, u32 tick) { return t.tick < tick; });
+  for (; it != track.triggers.end() && it->tick == tick; ++it) {
+    if (it->id == id)
+      return it - track.triggers.begin();
+  }
+
+  // Not sorted yet, e.g. while a tick is being dragged
+  for (u32 i = 0; i < track.triggers.size(); ++i) {
+    if (track.triggers[i].id == id)
+      return i;
+  }
+  return track.triggers.size();
+}
+
+u32 getTriggerInsertIndex(const Track &track, u32 tick) {
+  return std::upper_bound(
+             track.triggers.begin(), track.triggers.end(), tick,
+             [](u32 tick, const Trigger &t) { return tick < t.tick; }) -
+         track.triggers.begin();
+}
+
+u32 getSongTickCount(usize framesCount, u32 sampleRate) {
+  return TICKS_PER_SECOND * ((float)framesCount / sampleRate);
+}
+
+bool fixTickCount(Track &track, usize framesCount, u32 sampleRate) {
+  const u32 tickCount = getSongTickCount(framesCount, sampleRate);
+  if (track.tickCount == tickCount)
+    return false;
+  track.tickCount = tickCount;
+  track.tickEnd = tickCount;
+  return true;
+}
+
+void sortTrack(Track &track) {
+  std::stable_sort(track.triggers.begin(), track.triggers.end(),
+                   [](const Trigger &a, const Trigger &b) {
+                     return a.tick < b.tick;
+                   });
+}
+
+bool isSameTrigger(const Trigger &a, const Trigger &b) {
+  return a.tick == b.tick && a.type == b.type && a.x == b.x && a.y == b.y &&
+         a.angle == b.angle && a.flags == b.flags;
+}
+
+bool isSameTrack(const Track &a, const Track &b) {
+  if (a.trackType != b.trackType || a.tickCount != b.tickCount ||
+      a.tickStart != b.tickStart || a.tickEnd != b.tickEnd ||
+      a.featureZoneStart != b.featureZoneStart ||
+      a.featureZoneEnd != b.featureZoneEnd ||
+      a.summonStart != b.summonStart || a.summonEnd != b.summonEnd ||
+      a.summonTrigger != b.summonTrigger ||
+      a.triggerCount != b.triggerCount)
+    return false;
+
+  for (u32 i = 0; i < a.triggerCount; ++i) {
+    if (!isSameTrigger(a.triggers[i], b.triggers[i]))
+      return false;
+  }
+  return true;
+}
+
+void generateTrack(Track::Type type, u32 tickCount, u32 triggerCount,
+                   Track *track) {
+  ENSURE(track != nullptr);
+  ENSURE(tickCount > 2);
+  ENSURE(type != Track::EMS || triggerCount >= 2);
+
+  track->trackType = type;
+  track->tickCount = tickCount;
+  track->tickStart = 0;
+  track->tickEnd = tickCount;
+  track->featureZoneStart = tickCount / 4;
+  track->featureZoneEnd = tickCount / 2;
+  track->summonStart = tickCount / 2 + 1;
+  track->summonEnd = tickCount * 3 / 4 + 1;
+  track->summonTrigger = 0;
+  track->triggerCount = triggerCount;
+  track->triggers.resize(triggerCount);
+
+  // Holds span a few triggers; BMS has no holdlets
+  const Trigger::Type pattern[] = {
+      Trigger::Touch,   Trigger::Slide, Trigger::Hold,
+      Trigger::Holdlet, Trigger::HoldEnd, Trigger::Touch,
+      Trigger::Hold,    Trigger::HoldEndSlide};
+  const u32 guideEvery = 5;
+
+  const u32 none = UINT32_MAX;
+  u32 openHold = none; // hold without an end yet
+  u32 last = none;     // last trigger that isn't a guide
+  u32 patternIndex = 0;
+  for (u32 i = 0; i < triggerCount; ++i) {
+    Trigger &t = track->triggers[i];
+    // Strictly inside (tickStart, tickEnd), several per tick if need be
+    t.tick = 1 + (u64)i * (tickCount - 2) / triggerCount;
+    t.x = 0;
+    t.y = 0;
+    t.angle = 0;
+    t.flags = Trigger::Flag::None;
+    t.id = 0;
+
+    if (type == Track::EMS &&
+        (i % guideEvery == 0 || i + 1 == triggerCount)) {
+      t.type = Trigger::TrackGuide;
+      t.x = (s32)(i * 53 % 301) - 150;
+      t.y = (s32)(i * 29 % 151) - 75;
+      if (i % 3 == 1)
+        t.flags = Trigger::Flag::CurveInward;
+      continue;
+    }
+
+    t.type = pattern[patternIndex++ % ARRAY_SIZE(pattern)];
+    if (type == Track::BMS && t.type == Trigger::Holdlet)
+      t.type = Trigger::Touch;
+    if (t.type == Trigger::Slide || t.type == Trigger::HoldEndSlide)
+      t.angle = i * 45 % 360;
+
+    if (type == Track::BMS)
+      t.y = i % 4;
+    else if (type == Track::FMS)
+      t.y = i * 37 % 101;
+
+    if (t.type == Trigger::Hold)
+      openHold = i;
+    else if (t.type == Trigger::HoldEnd || t.type == Trigger::HoldEndSlide)
+      openHold = none;
+    last = i;
+  }
+
+  // End on a closed hold: the last trigger ends it, or replaces it
+  if (openHold != none) {
+    Trigger &t = track->triggers[last];
+    t.type = last == openHold ? Trigger::Touch : Trigger::HoldEnd;
+    t.angle = 0;
   }
 }
 
@@ -112,7 +326,8 @@ void writeTrack(Track &track, u8 *raw, u32 rawSize) {
 
   track.tickStart = 0;
   track.tickEnd = track.tickCount;
-  track.summonTrigger = track.summonEnd;
+  // Only BMS tracks have a summon trigger, see checkTrack
+  track.summonTrigger = track.isBMS() ? track.summonEnd : 0;
 
   writeu32le(&r, track.trackType);
   writeu32le(&r, track.tickCount);
@@ -127,9 +342,7 @@ void writeTrack(Track &track, u8 *raw, u32 rawSize) {
 
   ASSERT(track.triggers.size() == track.triggerCount);
 
-  // Keep the triggers sorted by increasing tick
-  std::sort(track.triggers.begin(), track.triggers.end(),
-            [&](Trigger &a, Trigger &b) { return a.tick < b.tick; });
+  sortTrack(track);
 
   for (u32 i = 0; i < track.triggerCount; ++i) {
     Trigger &t = track.triggers[i];
@@ -68,11 +68,51 @@ struct Track {
 
 static const char *const TRACK_TYPE_NAMES[] = {"FMS", "BMS", "EMS"};
 
+// The game runs tracks at this rate, whatever their tickCount says
+static const float TICKS_PER_SECOND = 59.825f;
+
+// Ticks of a song of framesCount frames at sampleRate
+u32 getSongTickCount(usize framesCount, u32 sampleRate);
+// Set track's tickCount to that of the song.  Returns whether it changed.
+bool fixTickCount(Track &track, usize framesCount, u32 sampleRate);
+
 void parseTrack(const u8 *raw, u32 rawSize, Track *track);
+// Whether raw is the size its trigger count says, with known track and
+// trigger types, which is all parseTrack asserts on
+bool isParsableTrack(const u8 *raw, u32 rawSize);
+// parseTrack, replacing the triggers of track, or false if raw isn't
+// parsable.  Says nothing of whether the track is valid, see findTrackError.
+bool tryParseTrack(const u8 *raw, u32 rawSize, Track *track);
+// Why track is not a valid chart, or nullptr if it is.  triggerIndex is set to
+// the offending trigger, or to the trigger count if the header is at fault.
+// For Track and PackedTrack.
+template <typename TrackT>
+const char *findTrackError(const TrackT &track, u32 *triggerIndex);
+// Report the first error of track, and assert there is none
 void checkTrack(Track &track);
 usize getTrackRawSize(const Track &track);
 void writeTrack(Track &track, u8 *raw, u32 rawSize);
 
+// Triggers are kept sorted by tick.  Index of the trigger with id at tick,
+// falling back to a linear search by id, or the trigger count if absent.
+u32 findTrigger(const Track &track, u32 tick, u32 id);
+// Index to insert a trigger at tick, after the triggers on the same tick
+u32 getTriggerInsertIndex(const Track &track, u32 tick);
+
+// Sort the triggers by increasing tick.  Stable, so that an already sorted
+// track keeps its order.
+void sortTrack(Track &track);
+
+// Same chart, ignoring the ids given by the editor
+bool isSameTrigger(const Trigger &a, const Trigger &b);
+bool isSameTrack(const Track &a, const Track &b);
+
+// Fill track with a valid synthetic chart of triggerCount triggers spread
+// over tickCount, cycling through touches, slides and holds.  EMS charts get
+// a guide every few triggers.  Trigger ids are left to the caller.
+void generateTrack(Track::Type type, u32 tickCount, u32 triggerCount,
+                   Track *track);
+
 } // namespace rideau
 
 #endif
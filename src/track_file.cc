@@ -0,0 +1,115 @@
+#include "track_file.h"
+
+#include "lz11.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace rideau {
+
+static u32 g_idCounter = 1; // 0 is not assigned
+u32 genId() { return g_idCounter++; }
+
+void parseTrackFile(const char *filename, Track *track) {
+  const bool ok = tryParseTrackFile(filename, track);
+  ENSURE(ok);
+}
+
+bool tryParseTrackFile(const char *filename, Track *track) {
+  ENSURE(filename != nullptr);
+  ENSURE(track != nullptr);
+
+  u32 rawSize;
+  u8 *raw = readLZ11File(filename, &rawSize);
+  if (raw == nullptr)
+    return false;
+
+  const bool ok = tryParseTrack(raw, rawSize, track);
+  free(raw);
+  if (!ok)
+    return false;
+
+  for (u32 i = 0; i < track->triggerCount; ++i)
+    track->triggers[i].id = genId();
+  return true;
+}
+
+void writeTrackFile(Track &track, const char *filename) {
+  FILE *dst = fopen(filename, "wb");
+  ENSURE(dst != nullptr);
+
+  u32 rawSize = getTrackRawSize(track);
+  u8 *raw = (u8 *)malloc(rawSize);
+  ENSURE(raw != nullptr);
+  writeTrack(track, raw, rawSize);
+
+  compressLZ11(raw, rawSize, dst);
+
+  free(raw);
+
+  int ret = fclose(dst);
+  ENSURE(ret == 0);
+}
+
+bool parsePackedTrackFile(const char *filename, PackedTrack *track) {
+  ENSURE(filename != nullptr);
+
+  u32 rawSize;
+  u8 *raw = readLZ11File(filename, &rawSize);
+  if (raw == nullptr)
+    return false;
+
+  const bool ok = parsePackedTrack(raw, rawSize, track);
+  free(raw);
+  return ok;
+}
+
+template <typename TrackT> void printTrackStats(const TrackT &track) {
+  printf("%s\n%d ticks\n%d--%d feature zone\n%d--%d summon\n",
+         TRACK_TYPE_NAMES[track.trackType], track.tickCount,
+         track.featureZoneStart, track.featureZoneEnd, track.summonStart,
+         track.summonEnd);
+
+  u32 triggerTypeCount[Trigger::Type::Count];
+
+  for (u32 i = 0; i < Trigger::Type::Count; ++i)
+    triggerTypeCount[i] = 0;
+
+  for (const Trigger t : track.triggers)
+    triggerTypeCount[t.type]++;
+
+  printf("%d triggers\n", track.triggerCount);
+  for (u32 i = 0; i < Trigger::Type::Count; ++i) {
+    printf("  %3d %s\n", triggerTypeCount[i], TRIGGER_TYPE_NAMES[i]);
+  }
+}
+
+template void printTrackStats(const Track &);
+template void printTrackStats(const PackedTrack &);
+
+std::vector<std::string> findDifficultyFiles(const char *path) {
+  const std::string file = path;
+  const std::string prefix = "trigger00";
+  const std::string suffix = ".bytes.lz";
+
+  const usize at = file.rfind(prefix);
+  const usize digit = at + prefix.size();
+  if (at == std::string::npos ||
+      digit + 1 + suffix.size() != file.size() ||
+      file.compare(digit + 1, suffix.size(), suffix) != 0 ||
+      file[digit] < '0' || file[digit] > '2')
+    return {file};
+
+  std::vector<std::string> files;
+  for (char d = '0'; d <= '2'; ++d) {
+    std::string sibling = file;
+    sibling[digit] = d;
+    // Keep path even if it's missing, so that opening it reports the error
+    if (sibling == file || access(sibling.c_str(), F_OK) == 0)
+      files.push_back(sibling);
+  }
+  return files;
+}
+
+} // namespace rideau
@@ -0,0 +1,34 @@
+#ifndef TRACK_FILE_H
+#define TRACK_FILE_H
+
+#include "packed_track.h"
+#include "track.h"
+#include "utils.h"
+
+#include <string>
+#include <vector>
+
+namespace rideau {
+
+// Editor ids of triggers, handed out densely; 0 is never assigned
+u32 genId();
+
+// LZ11 compressed trigger files.  Parsed triggers get fresh ids.
+void parseTrackFile(const char *filename, Track *track);
+// Returns false instead of asserting if the file can't be read or isn't a
+// trigger file.  Says nothing of whether the track is valid.
+bool tryParseTrackFile(const char *filename, Track *track);
+void writeTrackFile(Track &track, const char *filename);
+// Returns false if the file can't be read, or isn't a trigger file
+bool parsePackedTrackFile(const char *filename, PackedTrack *track);
+
+// For Track and PackedTrack
+template <typename TrackT> void printTrackStats(const TrackT &track);
+
+// Trigger files of the difficulties next to path, if it's named like
+// triggerNNN.bytes.lz, or else path alone
+std::vector<std::string> findDifficultyFiles(const char *path);
+
+} // namespace rideau
+
+#endif
@@ -0,0 +1,125 @@
+#include "track_transform.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace rideau {
+
+static bool parseInt(const char *s, long min, long max, long *value) {
+  char *end;
+  errno = 0;
+  const long v = strtol(s, &end, 10);
+  if (errno != 0 || end == s || *end != '\0' || v < min || v > max)
+    return false;
+  *value = v;
+  return true;
+}
+
+bool parseTrackTransform(const char *spec, TrackTransform *transform) {
+  ENSURE(spec != nullptr);
+  ENSURE(transform != nullptr);
+
+  long value;
+  if (strncmp(spec, "shift=", 6) == 0) {
+    if (!parseInt(spec + 6, INT32_MIN, INT32_MAX, &value))
+      return false;
+    transform->kind = TrackTransform::Shift;
+    transform->shift = value;
+    return true;
+  }
+  if (strncmp(spec, "scale=", 6) == 0) {
+    // Room for at least one trigger strictly inside the track
+    if (!parseInt(spec + 6, 2, INT32_MAX, &value))
+      return false;
+    transform->kind = TrackTransform::Scale;
+    transform->tickCount = value;
+    return true;
+  }
+  if (strcmp(spec, "mirror") == 0) {
+    transform->kind = TrackTransform::Mirror;
+    return true;
+  }
+  if (strcmp(spec, "ends=plain") == 0 || strcmp(spec, "ends=slide") == 0) {
+    transform->kind = TrackTransform::HoldEnds;
+    transform->holdEnd =
+        spec[5] == 'p' ? Trigger::HoldEnd : Trigger::HoldEndSlide;
+    return true;
+  }
+  return false;
+}
+
+// Ticks move as a whole; whatever lands outside the track is left for
+// validation to report
+static u32 shiftTick(u32 tick, s32 shift) {
+  const s64 shifted = (s64)tick + shift;
+  return shifted < 0 ? 0 : shifted > UINT32_MAX ? UINT32_MAX : shifted;
+}
+
+static u32 scaleTick(u32 tick, u32 from, u32 to) {
+  return ((u64)tick * to + from / 2) / from;
+}
+
+const char *applyTrackTransform(const TrackTransform &transform,
+                                Track &track) {
+  switch (transform.kind) {
+  case TrackTransform::Shift: {
+    const s32 d = transform.shift;
+    for (Trigger &t : track.triggers)
+      t.tick = shiftTick(t.tick, d);
+    track.featureZoneStart = shiftTick(track.featureZoneStart, d);
+    track.featureZoneEnd = shiftTick(track.featureZoneEnd, d);
+    track.summonStart = shiftTick(track.summonStart, d);
+    track.summonEnd = shiftTick(track.summonEnd, d);
+    if (track.summonTrigger != 0)
+      track.summonTrigger = shiftTick(track.summonTrigger, d);
+    return nullptr;
+  }
+
+  case TrackTransform::Scale: {
+    const u32 from = track.tickCount;
+    const u32 to = transform.tickCount;
+    if (from == 0)
+      return "track has no ticks to scale";
+    for (Trigger &t : track.triggers)
+      t.tick = scaleTick(t.tick, from, to);
+    track.featureZoneStart = scaleTick(track.featureZoneStart, from, to);
+    track.featureZoneEnd = scaleTick(track.featureZoneEnd, from, to);
+    track.summonStart = scaleTick(track.summonStart, from, to);
+    track.summonEnd = scaleTick(track.summonEnd, from, to);
+    track.summonTrigger = scaleTick(track.summonTrigger, from, to);
+    track.tickCount = to;
+    track.tickEnd = to;
+    return nullptr;
+  }
+
+  case TrackTransform::Mirror: {
+    if (track.isEMS())
+      return "EMS tracks have no lanes to mirror";
+    const s32 top = track.isBMS() ? 3 : 100;
+    for (Trigger &t : track.triggers) {
+      t.y = top - t.y;
+      // Angles go clockwise from up, so up and down swap
+      if (t.type == Trigger::Slide || t.type == Trigger::HoldEndSlide)
+        t.angle = (540 - t.angle % 360) % 360;
+    }
+    return nullptr;
+  }
+
+  case TrackTransform::HoldEnds:
+    for (Trigger &t : track.triggers) {
+      if (t.type != Trigger::HoldEnd && t.type != Trigger::HoldEndSlide)
+        continue;
+      // Plain hold ends carry no angle
+      if (transform.holdEnd == Trigger::HoldEnd)
+        t.angle = 0;
+      t.type = transform.holdEnd;
+    }
+    return nullptr;
+  }
+
+  UNREACHABLE();
+  return "unknown transform";
+}
+
+} // namespace rideau
@@ -0,0 +1,41 @@
+#ifndef TRACK_TRANSFORM_H
+#define TRACK_TRANSFORM_H
+
+#include "track.h"
+#include "utils.h"
+
+namespace rideau {
+
+// Bulk edit of a whole track, as declared on the command line:
+//
+//   shift=TICKS     move every trigger and zone by TICKS (may be negative)
+//   scale=TICKS     stretch the track to a tick count of TICKS
+//   mirror          flip BMS lanes or FMS positions upside down
+//   ends=plain      turn hold ends with arrows into plain hold ends
+//   ends=slide      turn plain hold ends into hold ends with arrows
+struct TrackTransform {
+  enum Kind : u32 {
+    Shift,
+    Scale,
+    Mirror,
+    HoldEnds,
+  };
+
+  Kind kind;
+  s32 shift;             // Shift
+  u32 tickCount;         // Scale
+  Trigger::Type holdEnd; // HoldEnds: type hold ends become
+};
+
+// Returns false if spec is not one of the forms above
+bool parseTrackTransform(const char *spec, TrackTransform *transform);
+
+// Returns why transform does not apply to track, or nullptr once applied.
+// The result may still be invalid, e.g. triggers shifted out of the track;
+// see findTrackError.
+const char *applyTrackTransform(const TrackTransform &transform,
+                                Track &track);
+
+} // namespace rideau
+
+#endif
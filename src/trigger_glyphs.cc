@@ -0,0 +1,177 @@
+#include "trigger_glyphs.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace rideau {
+
+struct GlyphShape {
+  int width;
+  int height;
+  float originX;
+  float originY;
+};
+
+// Sprites keep a pixel of margin for antialiasing
+static const GlyphShape GLYPH_SHAPES[TriggerGlyphs::Count] = {
+    {30, 30, 15.0f, 15.0f}, // Ring
+    {22, 22, 11.0f, 11.0f}, // Disc
+    {12, 12, 6.0f, 6.0f},   // SmallDisc
+    {8, 8, 4.0f, 4.0f},     // Dot
+    {44, 44, 22.0f, 22.0f}, // Selection
+    {24, 24, 12.0f, 12.0f}, // SmallSelection
+    {16, 26, 8.0f, 2.0f},   // Arrow
+};
+
+static bool isInsideRing(float x, float y, float inner, float outer) {
+  const float d2 = x * x + y * y;
+  return d2 >= inner * inner && d2 <= outer * outer;
+}
+
+static float edge(float ax, float ay, float bx, float by, float x, float y) {
+  return (bx - ax) * (y - ay) - (by - ay) * (x - ax);
+}
+
+// Glyph shapes, in pixels from the glyph center.  Match what the view used to
+// tessellate: AddCircle(r, thickness) covers radii r +- thickness / 2.
+static bool isInsideGlyph(u32 glyph, float x, float y) {
+  switch (glyph) {
+  case TriggerGlyphs::Ring:
+    return isInsideRing(x, y, 6.0f, 14.0f);
+  case TriggerGlyphs::Disc:
+    return isInsideRing(x, y, 0.0f, 10.0f);
+  case TriggerGlyphs::SmallDisc:
+    return isInsideRing(x, y, 0.0f, 5.0f);
+  case TriggerGlyphs::Dot:
+    return isInsideRing(x, y, 0.0f, 3.0f);
+  case TriggerGlyphs::Selection:
+    return isInsideRing(x, y, 19.0f, 21.0f);
+  case TriggerGlyphs::SmallSelection:
+    return isInsideRing(x, y, 9.0f, 11.0f);
+  case TriggerGlyphs::Arrow: {
+    // 3px shaft from the center to the head, then a 12px wide head
+    if (fabsf(x) <= 1.5f && y >= 0.0f && y <= 12.0f)
+      return true;
+    const float e0 = edge(-6.0f, 12.0f, 0.0f, 22.0f, x, y);
+    const float e1 = edge(0.0f, 22.0f, 6.0f, 12.0f, x, y);
+    const float e2 = edge(6.0f, 12.0f, -6.0f, 12.0f, x, y);
+    return (e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0);
+  }
+  }
+  return false;
+}
+
+void TriggerGlyphs::init(ImFontAtlas *atlas) {
+  ENSURE(atlas != nullptr);
+
+  for (u32 g = 0; g < Count; ++g)
+    rectIds[g] = atlas->AddCustomRectRegular(GLYPH_SHAPES[g].width,
+                                             GLYPH_SHAPES[g].height);
+  atlas->Build();
+
+  unsigned char *pixels;
+  int atlasWidth, atlasHeight;
+  atlas->GetTexDataAsRGBA32(&pixels, &atlasWidth, &atlasHeight);
+
+  // White sprites tinted by vertex colors, with 4x4 supersampled coverage
+  const int samples = 4;
+  for (u32 g = 0; g < Count; ++g) {
+    const GlyphShape &shape = GLYPH_SHAPES[g];
+    const ImFontAtlasCustomRect *rect = atlas->GetCustomRectByIndex(rectIds[g]);
+    ENSURE(rect != nullptr);
+
+    for (int y = 0; y < shape.height; ++y) {
+      u32 *row = (u32 *)pixels + (rect->Y + y) * atlasWidth + rect->X;
+      for (int x = 0; x < shape.width; ++x) {
+        int covered = 0;
+        for (int sy = 0; sy < samples; ++sy) {
+          for (int sx = 0; sx < samples; ++sx) {
+            const float px = x + (sx + 0.5f) / samples - shape.originX;
+            const float py = y + (sy + 0.5f) / samples - shape.originY;
+            covered += isInsideGlyph(g, px, py);
+          }
+        }
+        const u32 alpha = covered * 255 / (samples * samples);
+        row[x] = IM_COL32(255, 255, 255, alpha);
+      }
+    }
+
+    atlas->CalcCustomRectUV(rect, &uvMins[g], &uvMaxs[g]);
+    origins[g] = ImVec2(shape.originX, shape.originY);
+    sizes[g] = ImVec2(shape.width, shape.height);
+  }
+  whiteUv = atlas->TexUvWhitePixel;
+
+  for (u32 d = 0; d < 360; ++d) {
+    const float a = d * IM_PI / 180.0f;
+    rotations[d] = ImVec2(cosf(a), sinf(a));
+  }
+
+  instances.clear();
+  lines.clear();
+}
+
+void TriggerGlyphs::flush(ImDrawList *drawList) {
+  const usize quadsCount = lines.size() + instances.size();
+
+  usize quad = 0;
+  u32 reserved = 0;
+  auto reserve = [&]() {
+    if (reserved > 0) {
+      --reserved;
+      return;
+    }
+    reserved = std::min(quadsCount - quad, (usize)MAX_QUADS_PER_RESERVE);
+    drawList->PrimReserve(reserved * 6, reserved * 4);
+    --reserved;
+  };
+
+  for (const Line &l : lines) {
+    reserve();
+    ++quad;
+
+    const float dx = l.b.x - l.a.x;
+    const float dy = l.b.y - l.a.y;
+    const float length = sqrtf(dx * dx + dy * dy);
+    const float scale = length > 0.0f ? l.halfWidth / length : 0.0f;
+    const ImVec2 n(-dy * scale, dx * scale);
+    drawList->PrimQuadUV(ImVec2(l.a.x + n.x, l.a.y + n.y),
+                         ImVec2(l.b.x + n.x, l.b.y + n.y),
+                         ImVec2(l.b.x - n.x, l.b.y - n.y),
+                         ImVec2(l.a.x - n.x, l.a.y - n.y), whiteUv, whiteUv,
+                         whiteUv, whiteUv, l.color);
+  }
+
+  for (const Instance &i : instances) {
+    reserve();
+    ++quad;
+
+    const ImVec2 o = origins[i.glyph];
+    const ImVec2 s = sizes[i.glyph];
+    const ImVec2 uv0 = uvMins[i.glyph];
+    const ImVec2 uv1 = uvMaxs[i.glyph];
+
+    if (i.glyph != Arrow) {
+      const ImVec2 min(i.center.x - o.x, i.center.y - o.y);
+      drawList->PrimRectUV(min, ImVec2(min.x + s.x, min.y + s.y), uv0, uv1,
+                           i.color);
+      continue;
+    }
+
+    const ImVec2 r = rotations[i.degrees];
+    auto corner = [&](float x, float y) {
+      x -= o.x;
+      y -= o.y;
+      return ImVec2(i.center.x + x * r.x - y * r.y,
+                    i.center.y + x * r.y + y * r.x);
+    };
+    drawList->PrimQuadUV(corner(0, 0), corner(s.x, 0), corner(s.x, s.y),
+                         corner(0, s.y), uv0, ImVec2(uv1.x, uv0.y), uv1,
+                         ImVec2(uv0.x, uv1.y), i.color);
+  }
+
+  lines.clear();
+  instances.clear();
+}
+
+} // namespace rideau
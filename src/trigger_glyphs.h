@@ -0,0 +1,76 @@
+#ifndef TRIGGER_GLYPHS_H
+#define TRIGGER_GLYPHS_H
+
+#include "imgui.h"
+
+#include "utils.h"
+
+#include <vector>
+
+namespace rideau {
+
+// Trigger sprites baked into the ImGui font atlas.  Triggers, slide arrows and
+// hold lines of a view are queued as instances and emitted as textured quads
+// into one vertex buffer reservation, sharing the draw command of the rest of
+// the window, instead of tessellating thick circles every frame.
+struct TriggerGlyphs {
+  enum Glyph : u32 {
+    Ring,           // radius 10, 8px thick
+    Disc,           // radius 10
+    SmallDisc,      // radius 5
+    Dot,            // radius 3
+    Selection,      // radius 20, 2px thick
+    SmallSelection, // radius 10, 2px thick
+    Arrow,          // slide arrow pointing down, drawn rotated
+    Count,
+  };
+
+  struct Instance {
+    ImVec2 center;
+    ImU32 color;
+    Glyph glyph;
+    u32 degrees;
+  };
+
+  struct Line {
+    ImVec2 a;
+    ImVec2 b;
+    float halfWidth;
+    ImU32 color;
+  };
+
+  // Quads per vertex buffer reservation, to stay within 16-bit indices
+  static const u32 MAX_QUADS_PER_RESERVE = 8192;
+
+  int rectIds[Count];
+  ImVec2 origins[Count]; // position of the glyph center in the sprite
+  ImVec2 sizes[Count];
+  ImVec2 uvMins[Count];
+  ImVec2 uvMaxs[Count];
+  ImVec2 whiteUv;
+  ImVec2 rotations[360]; // cos and sin of each degree
+
+  std::vector<Instance> instances;
+  std::vector<Line> lines;
+
+  // Call before the renderer backend creates the font texture
+  void init(ImFontAtlas *atlas);
+
+  void add(Glyph glyph, ImVec2 center, ImU32 color) {
+    instances.push_back(Instance{center, color, glyph, 0});
+  }
+  // Arrow rotated clockwise by degrees
+  void addArrow(ImVec2 center, u32 degrees, ImU32 color) {
+    instances.push_back(Instance{center, color, Arrow, degrees % 360});
+  }
+  void addLine(ImVec2 a, ImVec2 b, float width, ImU32 color) {
+    lines.push_back(Line{a, b, width / 2.0f, color});
+  }
+
+  // Emit the queued lines, then glyphs on top, and clear the queues
+  void flush(ImDrawList *drawList);
+};
+
+} // namespace rideau
+
+#endif
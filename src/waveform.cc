@@ -0,0 +1,202 @@
+#include "waveform.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WAVEFORM_SSE2 1
+#endif
+
+namespace rideau {
+
+static WaveformBucket emptyBucket() { return {+1.0f, -1.0f, 0.0f}; }
+
+static void mergeBucket(WaveformBucket *dst, const WaveformBucket &src,
+                        float weight) {
+  dst->min = std::min(dst->min, src.min);
+  dst->max = std::max(dst->max, src.max);
+  dst->meanSquare += src.meanSquare * weight;
+}
+
+WaveformBucket reduceWaveform(const float *const samples[2], usize frameBegin,
+                              usize frameEnd) {
+  WaveformBucket b = emptyBucket();
+  if (frameBegin >= frameEnd)
+    return b;
+
+  const float *left = samples[0] + frameBegin;
+  const float *right = samples[1] + frameBegin;
+  const usize count = frameEnd - frameBegin;
+  usize i = 0;
+  float sumSquares = 0.0f;
+
+#if WAVEFORM_SSE2
+  if (count >= 4) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 vmin = _mm_set1_ps(+1.0f);
+    __m128 vmax = _mm_set1_ps(-1.0f);
+    __m128 vsum = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+      const __m128 s = _mm_mul_ps(
+          _mm_add_ps(_mm_loadu_ps(left + i), _mm_loadu_ps(right + i)), half);
+      vmin = _mm_min_ps(vmin, s);
+      vmax = _mm_max_ps(vmax, s);
+      vsum = _mm_add_ps(vsum, _mm_mul_ps(s, s));
+    }
+
+    float mins[4], maxs[4], sums[4];
+    _mm_storeu_ps(mins, vmin);
+    _mm_storeu_ps(maxs, vmax);
+    _mm_storeu_ps(sums, vsum);
+    for (int k = 0; k < 4; ++k) {
+      b.min = std::min(b.min, mins[k]);
+      b.max = std::max(b.max, maxs[k]);
+      sumSquares += sums[k];
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    const float sample = (left[i] + right[i]) * 0.5f;
+    b.min = std::min(b.min, sample);
+    b.max = std::max(b.max, sample);
+    sumSquares += sample * sample;
+  }
+
+  b.meanSquare = sumSquares / count;
+  return b;
+}
+
+void WaveformPyramid::init(const float *const songSamples[2],
+                           usize songFramesCount) {
+  samples[0] = songSamples[0];
+  samples[1] = songSamples[1];
+  framesCount = songFramesCount;
+
+  usize count = (framesCount + BASE_FRAMES - 1) / BASE_FRAMES;
+  levelsCount = 0;
+  while (levelsCount < MAX_LEVELS && count > 0) {
+    levels[levelsCount] =
+        (WaveformBucket *)malloc(count * sizeof(WaveformBucket));
+    ENSURE(levels[levelsCount] != nullptr);
+    bucketsCount[levelsCount] = count;
+    ++levelsCount;
+    if (count == 1)
+      break;
+    count = (count + 1) / 2;
+  }
+
+  chunksCount = (bucketsCount[0] + CHUNK_BUCKETS - 1) / CHUNK_BUCKETS;
+  chunkReady = new std::atomic<bool>[chunksCount];
+  for (u32 c = 0; c < chunksCount; ++c)
+    chunkReady[c] = false;
+  chunksLeft = chunksCount;
+  isComplete = false;
+  pool = nullptr;
+}
+
+void WaveformPyramid::deinit() {
+  // Jobs write into the levels
+  if (pool != nullptr && !isComplete)
+    pool->waitIdle();
+
+  for (u32 l = 0; l < levelsCount; ++l)
+    free(levels[l]);
+  levelsCount = 0;
+  delete[] chunkReady;
+  chunkReady = nullptr;
+}
+
+void WaveformPyramid::buildLevels(u32 firstLevel, u32 lastLevel,
+                                  usize firstBucket, usize lastBucket) {
+  // [firstBucket, lastBucket) at firstLevel - 1, halved at each level
+  for (u32 l = firstLevel; l <= lastLevel && l < levelsCount; ++l) {
+    firstBucket /= 2;
+    lastBucket = std::min((lastBucket + 1) / 2, bucketsCount[l]);
+
+    const WaveformBucket *src = levels[l - 1];
+    for (usize i = firstBucket; i < lastBucket; ++i) {
+      WaveformBucket b = src[2 * i];
+      if (2 * i + 1 < bucketsCount[l - 1]) {
+        b.meanSquare *= 0.5f;
+        mergeBucket(&b, src[2 * i + 1], 0.5f);
+      }
+      levels[l][i] = b;
+    }
+  }
+}
+
+void WaveformPyramid::buildChunk(u32 chunk) {
+  const usize firstBucket = (usize)chunk * CHUNK_BUCKETS;
+  const usize lastBucket =
+      std::min(firstBucket + CHUNK_BUCKETS, bucketsCount[0]);
+
+  for (usize i = firstBucket; i < lastBucket; ++i) {
+    const usize begin = i * BASE_FRAMES;
+    const usize end = std::min(begin + BASE_FRAMES, framesCount);
+    levels[0][i] = reduceWaveform(samples, begin, end);
+  }
+  buildLevels(1, CHUNK_LEVELS, firstBucket, lastBucket);
+
+  chunkReady[chunk].store(true, std::memory_order_release);
+
+  // Last chunk done builds the levels spanning several chunks
+  if (chunksLeft.fetch_sub(1) == 1) {
+    if (levelsCount > CHUNK_LEVELS + 1)
+      buildLevels(CHUNK_LEVELS + 1, levelsCount - 1, 0,
+                  bucketsCount[CHUNK_LEVELS]);
+    isComplete.store(true, std::memory_order_release);
+  }
+}
+
+void WaveformPyramid::build(ThreadPool *threadPool) {
+  ENSURE(threadPool != nullptr);
+  ENSURE(pool == nullptr);
+
+  pool = threadPool;
+  for (u32 c = 0; c < chunksCount; ++c)
+    pool->submit([this, c] { buildChunk(c); });
+}
+
+WaveformBucket WaveformPyramid::query(usize frameBegin, usize frameEnd) const {
+  frameEnd = std::min(frameEnd, framesCount);
+  if (frameBegin >= frameEnd)
+    return {0.0f, 0.0f, 0.0f};
+
+  // Below one bucket, the samples are cheaper than they look
+  const usize span = frameEnd - frameBegin;
+  if (span < BASE_FRAMES || levelsCount == 0)
+    return reduceWaveform(samples, frameBegin, frameEnd);
+
+  // Coarsest level whose buckets still fit in the range: the range then
+  // overlaps at most three of them
+  u32 level = 0;
+  while (level + 1 < levelsCount &&
+         ((usize)BASE_FRAMES << (level + 1)) <= span)
+    ++level;
+
+  const bool complete = isComplete.load(std::memory_order_acquire);
+  if (!complete && level > CHUNK_LEVELS)
+    level = CHUNK_LEVELS;
+
+  const usize bucketFrames = (usize)BASE_FRAMES << level;
+  const usize first = frameBegin / bucketFrames;
+  const usize last =
+      std::min((frameEnd - 1) / bucketFrames, bucketsCount[level] - 1);
+  const float weight = 1.0f / (last - first + 1);
+
+  WaveformBucket b = emptyBucket();
+  for (usize i = first; i <= last; ++i) {
+    if (!complete) {
+      const usize chunk = (i << level) / CHUNK_BUCKETS;
+      if (!chunkReady[chunk].load(std::memory_order_acquire))
+        continue;
+    }
+    mergeBucket(&b, levels[level][i], weight);
+  }
+  return b;
+}
+
+} // namespace rideau
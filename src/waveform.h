@@ -0,0 +1,68 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <atomic>
+
+namespace rideau {
+
+struct WaveformBucket {
+  float min;
+  float max;
+  float meanSquare;
+};
+
+// Min/max/mean square of frames [frameBegin, frameEnd), channels averaged
+WaveformBucket reduceWaveform(const float *const samples[2], usize frameBegin,
+                              usize frameEnd);
+
+// Min/max/RMS of the song (channels averaged) at power-of-two resolutions.
+// Level 0 reduces BASE_FRAMES frames per bucket, and each level above halves
+// the bucket count, so any frame range is summarized from a handful of
+// buckets.
+//
+// The pyramid is built in the background, one chunk of CHUNK_BUCKETS level 0
+// buckets per job.  Levels up to CHUNK_LEVELS only depend on their own chunk
+// and are readable as soon as it's done; the levels above once all chunks
+// are.
+struct WaveformPyramid {
+  static const u32 BASE_FRAMES = 64;
+  static const u32 MAX_LEVELS = 24;
+  static const u32 CHUNK_LEVELS = 12;
+  static const u32 CHUNK_BUCKETS = 1 << CHUNK_LEVELS;
+
+  const float *samples[2];
+  usize framesCount;
+
+  u32 levelsCount;
+  WaveformBucket *levels[MAX_LEVELS];
+  usize bucketsCount[MAX_LEVELS];
+
+  u32 chunksCount;
+  std::atomic<bool> *chunkReady;
+  std::atomic<u32> chunksLeft;
+  std::atomic<bool> isComplete;
+  ThreadPool *pool;
+
+  // samples must outlive the pyramid
+  void init(const float *const songSamples[2], usize songFramesCount);
+  void deinit();
+
+  // Queue the reduction jobs on threadPool; returns immediately
+  void build(ThreadPool *threadPool);
+
+  // Summary of frames [frameBegin, frameEnd), from the chunks built so far.
+  // min > max when nothing in range is built yet.
+  WaveformBucket query(usize frameBegin, usize frameEnd) const;
+
+private:
+  void buildChunk(u32 chunk);
+  void buildLevels(u32 firstLevel, u32 lastLevel, usize firstBucket,
+                   usize lastBucket);
+};
+
+} // namespace rideau
+
+#endif
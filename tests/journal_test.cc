@@ -0,0 +1,148 @@
+#include "test_utils.h"
+
+#include "file_utils.h"
+#include "history.h"
+#include "journal.h"
+#include "thread_pool.h"
+#include "track.h"
+#include "track_file.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using namespace rideau;
+
+static const char *const TRIGGER_FILE = "journal_test.bytes.lz";
+static const std::string JOURNAL_FILE = std::string(TRIGGER_FILE) + ".journal";
+static const std::string FAILED_FILE = JOURNAL_FILE + ".failed";
+
+// Like the editor does
+static void applyStep(Track &track, const EditStep &step) {
+  for (const TriggerEdit &e : step) {
+    if (e.kind != TriggerEdit::Insert) {
+      const u32 i = findTrigger(track, e.before.tick, e.before.id);
+      CHECK(i < track.triggers.size());
+      track.triggers.erase(track.triggers.begin() + i);
+    }
+    if (e.kind != TriggerEdit::Remove) {
+      const u32 i = getTriggerInsertIndex(track, e.after.tick);
+      track.triggers.insert(track.triggers.begin() + i, e.after);
+    }
+  }
+  track.triggerCount = track.triggers.size();
+}
+
+static std::vector<u8> readBytes(const std::string &filename) {
+  usize size;
+  u8 *data = readFileContents(filename.c_str(), &size);
+  CHECK(data != nullptr);
+  std::vector<u8> bytes(data, data + size);
+  free(data);
+  return bytes;
+}
+
+static void writeBytes(const std::string &filename,
+                       const std::vector<u8> &bytes) {
+  FILE *f = fopen(filename.c_str(), "wb");
+  CHECK(f != nullptr);
+  CHECK(fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+  CHECK(fclose(f) == 0);
+}
+
+static bool exists(const std::string &filename) {
+  return access(filename.c_str(), F_OK) == 0;
+}
+
+static Track replay(u32 expectedCount) {
+  Track track;
+  parseTrackFile(TRIGGER_FILE, &track);
+  CHECK(replayJournal(TRIGGER_FILE, &track) == expectedCount);
+  sortTrack(track);
+  return track;
+}
+
+int main() {
+  remove(JOURNAL_FILE.c_str());
+  remove(FAILED_FILE.c_str());
+
+  Track original;
+  generateTrack(Track::BMS, 20000, 300, &original);
+  writeTrackFile(original, TRIGGER_FILE);
+  parseTrackFile(TRIGGER_FILE, &original);
+  sortTrack(original);
+
+  ThreadPool pool;
+  pool.init();
+
+  EditJournal journal;
+  journal.init();
+  Track track = original;
+  CHECK(journal.open(TRIGGER_FILE, track, false, &pool));
+
+  // One record per step, then one for the header
+  Trigger inserted = track.triggers[20];
+  inserted.tick += 1;
+  inserted.y = (inserted.y + 1) % 4;
+  inserted.id = genId();
+  Trigger changed = track.triggers[40];
+  changed.tick += 2;
+  changed.y = (changed.y + 2) % 4;
+  const EditStep steps[] = {
+      {TriggerEdit::remove(track.triggers[10])},
+      {TriggerEdit::change(track.triggers[40], changed)},
+      {TriggerEdit::insert(inserted)},
+  };
+  for (const EditStep &step : steps) {
+    applyStep(track, step);
+    journal.appendEdits(step);
+    journal.update(track, true);
+  }
+  Track edited = track;
+  track.featureZoneStart += 5;
+  track.featureZoneEnd += 5;
+  journal.update(track, true);
+  journal.close();
+  pool.deinit();
+  sortTrack(edited);
+  sortTrack(track);
+  CHECK(!isSameTrack(edited, original));
+
+  // Everything comes back
+  CHECK(exists(JOURNAL_FILE));
+  CHECK(isSameTrack(replay(4), track));
+  CHECK(!exists(FAILED_FILE));
+
+  // A record torn by a crash is dropped, the ones before it replayed
+  const std::vector<u8> bytes = readBytes(JOURNAL_FILE);
+  std::vector<u8> torn = bytes;
+  torn.resize(torn.size() - 5);
+  writeBytes(JOURNAL_FILE, torn);
+  CHECK(isSameTrack(replay(3), edited));
+  CHECK(!exists(FAILED_FILE));
+
+  // Same for a garbled last record
+  std::vector<u8> garbled = bytes;
+  garbled.back() ^= 0xff;
+  writeBytes(JOURNAL_FILE, garbled);
+  CHECK(isSameTrack(replay(3), edited));
+  CHECK(!exists(FAILED_FILE));
+
+  // A damaged record before the end stops the replay, and the journal is
+  // kept aside rather than replaced by the next one
+  std::vector<u8> damaged = bytes;
+  damaged[12 + 2 * sizeof(u32)] ^= 0xff; // first record's payload
+  writeBytes(JOURNAL_FILE, damaged);
+  CHECK(isSameTrack(replay(0), original));
+  CHECK(!exists(JOURNAL_FILE));
+  CHECK(exists(FAILED_FILE));
+  CHECK(readBytes(FAILED_FILE) == damaged);
+
+  remove(FAILED_FILE.c_str());
+  remove(TRIGGER_FILE);
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "test_utils.h"
+
+#include "packed_track.h"
+#include "track.h"
+#include "track_file.h"
+#include "utils.h"
+
+#include <string.h>
+
+#include <vector>
+
+using namespace rideau;
+
+static std::vector<u8> writeBytes(Track &track) {
+  std::vector<u8> raw(getTrackRawSize(track));
+  writeTrack(track, raw.data(), raw.size());
+  return raw;
+}
+
+static std::vector<u8> writeBytes(const PackedTrack &track) {
+  std::vector<u8> raw(getTrackRawSize(track));
+  writePackedTrack(track, raw.data(), raw.size());
+  return raw;
+}
+
+static void testRoundTrip(Track::Type type) {
+  Track track;
+  generateTrack(type, 20000, 500, &track);
+  for (Trigger &t : track.triggers)
+    t.id = genId();
+  // Every field at its widest, and every flag
+  if (type == Track::EMS) {
+    track.triggers[0].x = INT16_MIN;
+    track.triggers[0].y = INT16_MAX;
+    track.triggers[1].flags = Trigger::Flag(
+        Trigger::AbsoluteAngle | Trigger::CurveInward);
+    track.triggers[2].flags = Trigger::CurveOutward;
+  }
+  track.triggers[3].angle = 359;
+
+  // Written once, so that the header and the order are normalized
+  const std::vector<u8> raw = writeBytes(track);
+
+  PackedTrack packed;
+  CHECK(packTrack(track, &packed));
+  CHECK(packed.triggers.size() == track.triggers.size());
+
+  Track unpacked;
+  unpackTrack(packed, &unpacked);
+  CHECK(isSameTrack(unpacked, track));
+  for (u32 i = 0; i < track.triggerCount; ++i)
+    CHECK(unpacked.triggers[i].id == track.triggers[i].id);
+
+  CHECK(writeBytes(packed) == raw);
+  CHECK(writeBytes(unpacked) == raw);
+
+  // And straight from the bytes
+  PackedTrack parsed;
+  CHECK(parsePackedTrack(raw.data(), raw.size(), &parsed));
+  CHECK(writeBytes(parsed) == raw);
+}
+
+static void testTooWide() {
+  Track track;
+  generateTrack(Track::EMS, 1000, 10, &track);
+
+  PackedTrack packed;
+  track.triggers[4].x = INT16_MAX + 1;
+  CHECK(!packTrack(track, &packed));
+  track.triggers[4].x = 0;
+  track.triggers[4].flags = Trigger::Flag(1 << 4);
+  CHECK(!packTrack(track, &packed));
+
+  // Same when parsing bytes
+  std::vector<u8> raw = writeBytes(track);
+  CHECK(!parsePackedTrack(raw.data(), raw.size(), &packed));
+  CHECK(!parsePackedTrack(raw.data(), raw.size() - 1, &packed));
+}
+
+int main() {
+  testRoundTrip(Track::FMS);
+  testRoundTrip(Track::BMS);
+  testRoundTrip(Track::EMS);
+  testTooWide();
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include "test_utils.h"
+
+#include "file_utils.h"
+#include "pattern_index.h"
+#include "thread_pool.h"
+#include "track.h"
+#include "track_file.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+using namespace rideau;
+
+static const char *const TRIGGER_FILE = "pattern_query_test.bytes.lz";
+static const char *const INDEX_FILE = "pattern_query_test.index";
+
+static void checkError(const char *text) {
+  PatternQuery query;
+  std::string error;
+  CHECK(!parsePatternQuery(text, &query, &error));
+  CHECK(!error.empty());
+}
+
+static void testParse() {
+  PatternQuery query;
+  std::string error;
+  CHECK(parsePatternQuery(" slide|hold:lane=1|2:angle=90:dt<=15  ... "
+                          "end:lane!=B * ",
+                          &query, &error));
+  CHECK(query.elements.size() == 4);
+
+  const PatternElement &e = query.elements[0];
+  CHECK(!e.isSkip);
+  CHECK(e.types == (1 << Trigger::Slide | 1 << Trigger::Hold));
+  CHECK(e.lanes == (1 << 1 | 1 << 2));
+  CHECK(e.angles == 1 << 2);
+  CHECK(e.minGap == 0 && e.maxGap == 15);
+  CHECK(e.laneVar == 0);
+
+  CHECK(query.elements[1].isSkip);
+  CHECK(query.elements[2].types == 1 << Trigger::HoldEnd);
+  CHECK(query.elements[2].laneVar == 'B');
+  CHECK(query.elements[2].isLaneVarDifferent);
+  CHECK(query.elements[3].types == (1 << Trigger::TrackGuide) - 1);
+
+  CHECK(parsePatternQuery("touch:dt>9 touch:dt=4 touch:dt<3", &query, &error));
+  CHECK(query.elements[0].minGap == 10);
+  CHECK(query.elements[0].maxGap == UINT32_MAX);
+  CHECK(query.elements[1].minGap == 4 && query.elements[1].maxGap == 4);
+  CHECK(query.elements[2].maxGap == 2);
+
+  checkError("");
+  checkError("   ");
+  checkError("...");
+  checkError("touch ...");
+  checkError("touch ... ... end");
+  checkError("tap");
+  checkError("touch|");
+  checkError("touch:lane");
+  checkError("touch:lane=x");
+  checkError("touch:lane=1|");
+  checkError("touch:dt=<5");
+  checkError("touch:dt<0");
+  checkError("touch:dt<=1|2");
+  checkError("touch:speed=3");
+  checkError("touch:angle>=90");
+}
+
+static std::vector<PatternMatch> find(const PatternIndex &index,
+                                      const char *text) {
+  PatternQuery query;
+  std::string error;
+  CHECK(parsePatternQuery(text, &query, &error));
+  std::vector<PatternMatch> matches;
+  findPattern(index, query, &matches);
+  return matches;
+}
+
+static std::vector<u32> findTicks(const PatternIndex &index,
+                                  const char *text) {
+  std::vector<u32> ticks;
+  for (const PatternMatch &m : find(index, text)) {
+    CHECK(m.track == 0);
+    ticks.push_back(m.tick);
+  }
+  return ticks;
+}
+
+static void testFind() {
+  struct {
+    u32 tick;
+    Trigger::Type type;
+    s32 y;
+    u32 angle;
+  } triggers[] = {
+      {10, Trigger::Touch, 0, 0},      {20, Trigger::Slide, 1, 90},
+      {30, Trigger::Slide, 2, 270},    {40, Trigger::Slide, 1, 90},
+      {100, Trigger::Hold, 3, 0},      {110, Trigger::Touch, 0, 0},
+      {120, Trigger::HoldEnd, 3, 0},   {200, Trigger::Hold, 2, 0},
+      {210, Trigger::TrackGuide, 2, 0}, {220, Trigger::HoldEnd, 1, 0},
+  };
+
+  Track track;
+  track.trackType = Track::BMS;
+  track.tickCount = 300;
+  track.tickStart = 0;
+  track.tickEnd = 300;
+  track.featureZoneStart = 0;
+  track.featureZoneEnd = 0;
+  track.summonStart = 0;
+  track.summonEnd = 0;
+  track.summonTrigger = 0;
+  for (const auto &t : triggers)
+    track.triggers.push_back(
+        Trigger{t.tick, t.type, 0, t.y, t.angle, Trigger::None, 0});
+  track.triggerCount = track.triggers.size();
+  writeTrackFile(track, TRIGGER_FILE);
+
+  ThreadPool pool;
+  pool.init();
+  PatternIndex index;
+  buildPatternIndex({TRIGGER_FILE, "pattern_query_test.missing"}, &pool,
+                    &index);
+  pool.deinit();
+  CHECK(index.tracks.size() == 1);
+  CHECK(index.tokens.size() == track.triggerCount - 1); // without the guide
+
+  typedef std::vector<u32> Ticks;
+  CHECK(findTicks(index, "slide:angle=90|270 slide:angle=90|270 "
+                         "slide:angle=90|270") == Ticks{20});
+  CHECK(findTicks(index, "slide slide") == (Ticks{20, 30}));
+  CHECK(findTicks(index, "*:lane=0 slide:angle=90") == Ticks{10});
+  CHECK(findTicks(index, "slide hold:dt>=60 touch:dt<=10") == Ticks{40});
+  CHECK(findTicks(index, "slide hold:dt>60 touch").empty());
+  CHECK(findTicks(index, "hold:lane=A ... end:lane=A") == Ticks{100});
+  CHECK(findTicks(index, "hold:lane=A ... end:lane!=A") == Ticks{200});
+  CHECK(findTicks(index, "slide ... hold touch") == (Ticks{20, 30, 40}));
+
+  // Written then read, the index finds the same
+  CHECK(writePatternIndex(index, INDEX_FILE));
+  PatternIndex read;
+  CHECK(readPatternIndex(INDEX_FILE, &read));
+  CHECK(read.tracks.size() == 1);
+  CHECK(read.tracks[0].filename == TRIGGER_FILE);
+  CHECK(read.tracks[0].trackType == Track::BMS);
+  CHECK(findTicks(read, "hold:lane=A ... end:lane!=A") == Ticks{200});
+  CHECK(findTicks(read, "slide slide slide") == Ticks{20});
+
+  // But not cut short
+  usize size;
+  u8 *data = readFileContents(INDEX_FILE, &size);
+  CHECK(data != nullptr);
+  FILE *f = fopen(INDEX_FILE, "wb");
+  CHECK(f != nullptr);
+  CHECK(fwrite(data, 1, size / 2, f) == size / 2);
+  CHECK(fclose(f) == 0);
+  free(data);
+  CHECK(!readPatternIndex(INDEX_FILE, &read));
+
+  remove(INDEX_FILE);
+  remove(TRIGGER_FILE);
+}
+
+int main() {
+  testParse();
+  testFind();
+  return 0;
+}
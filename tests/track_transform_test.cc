@@ -0,0 +1,152 @@
+#include "test_utils.h"
+
+#include "track.h"
+#include "track_transform.h"
+#include "utils.h"
+
+using namespace rideau;
+
+static TrackTransform parse(const char *spec) {
+  TrackTransform transform;
+  CHECK(parseTrackTransform(spec, &transform));
+  return transform;
+}
+
+static void apply(const char *spec, Track &track) {
+  CHECK(applyTrackTransform(parse(spec), track) == nullptr);
+}
+
+static bool isValid(const Track &track) {
+  u32 index;
+  return findTrackError(track, &index) == nullptr;
+}
+
+static void testParse() {
+  CHECK(parse("shift=-30").kind == TrackTransform::Shift);
+  CHECK(parse("shift=-30").shift == -30);
+  CHECK(parse("shift=2147483647").shift == INT32_MAX);
+  CHECK(parse("scale=2").kind == TrackTransform::Scale);
+  CHECK(parse("scale=12000").tickCount == 12000);
+  CHECK(parse("mirror").kind == TrackTransform::Mirror);
+  CHECK(parse("ends=plain").kind == TrackTransform::HoldEnds);
+  CHECK(parse("ends=plain").holdEnd == Trigger::HoldEnd);
+  CHECK(parse("ends=slide").holdEnd == Trigger::HoldEndSlide);
+
+  const char *const invalid[] = {
+      "",        "shift",    "shift=",   "shift=1x", "shift=2147483648",
+      "scale=1", "scale=-5", "scale=",   "mirror=1", "ends=",
+      "ends=arrow", "flip",
+  };
+  for (const char *spec : invalid) {
+    TrackTransform transform;
+    CHECK(!parseTrackTransform(spec, &transform));
+  }
+}
+
+static void testShift() {
+  Track track;
+  generateTrack(Track::BMS, 20000, 300, &track);
+  const Track original = track;
+
+  apply("shift=25", track);
+  for (u32 i = 0; i < track.triggerCount; ++i)
+    CHECK(track.triggers[i].tick == original.triggers[i].tick + 25);
+  CHECK(track.featureZoneStart == original.featureZoneStart + 25);
+  CHECK(track.summonEnd == original.summonEnd + 25);
+  apply("shift=-25", track);
+  CHECK(isSameTrack(track, original));
+
+  // Past the start, ticks stop at 0 and the track is invalid
+  apply("shift=-1000000", track);
+  CHECK(track.triggers[0].tick == 0);
+  CHECK(!isValid(track));
+}
+
+static void testScale() {
+  Track track;
+  generateTrack(Track::FMS, 20000, 300, &track);
+  const Track original = track;
+
+  apply("scale=40000", track);
+  CHECK(track.tickCount == 40000 && track.tickEnd == 40000);
+  for (u32 i = 0; i < track.triggerCount; ++i)
+    CHECK(track.triggers[i].tick == 2 * original.triggers[i].tick);
+  CHECK(track.featureZoneEnd == 2 * original.featureZoneEnd);
+  CHECK(isValid(track));
+  apply("scale=20000", track);
+  CHECK(isSameTrack(track, original));
+
+  // Rounded to the nearest tick
+  apply("scale=6667", track);
+  for (u32 i = 0; i < track.triggerCount; ++i) {
+    const u32 tick = original.triggers[i].tick;
+    CHECK(track.triggers[i].tick == (tick * 6667 + 10000) / 20000);
+  }
+
+  track.tickCount = 0;
+  CHECK(applyTrackTransform(parse("scale=100"), track) != nullptr);
+}
+
+static void testMirror() {
+  for (Track::Type type : {Track::FMS, Track::BMS}) {
+    Track track;
+    generateTrack(type, 20000, 300, &track);
+    const Track original = track;
+    const s32 top = type == Track::BMS ? 3 : 100;
+
+    apply("mirror", track);
+    for (u32 i = 0; i < track.triggerCount; ++i) {
+      const Trigger &t = track.triggers[i];
+      const Trigger &o = original.triggers[i];
+      CHECK(t.y == top - o.y);
+      if (t.type == Trigger::Slide || t.type == Trigger::HoldEndSlide)
+        CHECK((t.angle + o.angle) % 360 == 180);
+      else
+        CHECK(t.angle == o.angle);
+    }
+    CHECK(isValid(track));
+    apply("mirror", track);
+    CHECK(isSameTrack(track, original));
+  }
+
+  Track track;
+  generateTrack(Track::EMS, 20000, 300, &track);
+  const Track original = track;
+  CHECK(applyTrackTransform(parse("mirror"), track) != nullptr);
+  CHECK(isSameTrack(track, original));
+}
+
+static void testHoldEnds() {
+  Track track;
+  generateTrack(Track::BMS, 20000, 300, &track);
+  u32 endsCount = 0;
+  for (const Trigger &t : track.triggers)
+    endsCount += t.type == Trigger::HoldEnd || t.type == Trigger::HoldEndSlide;
+  CHECK(endsCount > 0);
+
+  apply("ends=slide", track);
+  for (const Trigger &t : track.triggers)
+    CHECK(t.type != Trigger::HoldEnd);
+  CHECK(isValid(track));
+
+  apply("ends=plain", track);
+  u32 plainCount = 0;
+  for (const Trigger &t : track.triggers) {
+    CHECK(t.type != Trigger::HoldEndSlide);
+    if (t.type == Trigger::HoldEnd) {
+      CHECK(t.angle == 0);
+      ++plainCount;
+    }
+  }
+  CHECK(plainCount == endsCount);
+  CHECK(isValid(track));
+}
+
+int main() {
+  testParse();
+  testShift();
+  testScale();
+  testMirror();
+  testHoldEnds();
+  return 0;
+}